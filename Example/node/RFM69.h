@@ -65,7 +65,9 @@
 #define RF69_BROADCAST_ADDR 255
 #define RF69_CSMA_LIMIT_MS 1000
 #define RF69_TX_LIMIT_MS   1000
-#define RF69_FSTEP  61.035156 // == FXOSC / 2^19 = 32MHz / 2^19 (p13 in datasheet) FXOSC = module crystal oscillator frequency 
+// FSTEP = FXOSC / 2^19 = 32MHz / 2^19 = 61.03515625Hz (p13 in datasheet) FXOSC = module crystal oscillator frequency
+// FRF = Hz / FSTEP = Hz * 256 / 15625, split so it fits in 32 bits. exact (rounded down) integer math with no float
+#define RF69_FREQ_TO_FRF(hz) ((uint32_t) (hz) / 15625 * 256 + (uint32_t) (hz) % 15625 * 256 / 15625)
 // TWS: define CTLbyte bits
 #define RFM69_CTL_SENDACK   0x80
 #define RFM69_CTL_REQACK    0x40
@@ -100,6 +102,7 @@ uint8_t receiveDone();
 void sendACK(const void* buffer = "", uint8_t bufferSize=0);
 uint32_t getFrequency();
 void setFrequency(uint32_t freqHz);
+void setFrf(uint32_t frf);
 void encrypt(const char* key);
 int16_t readRSSI(uint8_t forceTrigger=0);
 void setHighPower(uint8_t onOFF=1); // has to be called after initialize() for RFM69HW
@@ -288,20 +291,26 @@ uint8_t readTemperature(uint8_t calFactor) // returns centigrade
 // return the frequency (in Hz)
 uint32_t getFrequency()
 {
-	return RF69_FSTEP * (((uint32_t) readReg(REG_FRFMSB) << 16) + ((uint16_t) readReg(REG_FRFMID) << 8) + readReg(REG_FRFLSB));
+	uint32_t frf = ((uint32_t) readReg(REG_FRFMSB) << 16) | ((uint16_t) readReg(REG_FRFMID) << 8) | readReg(REG_FRFLSB);
+	return (frf >> 8) * 15625 + (((frf & 0xFF) * 15625) >> 8); // FRF * FSTEP = FRF * 15625 / 256
 }
 
 // set the frequency (in Hz)
 void setFrequency(uint32_t freqHz)
+{
+	setFrf(RF69_FREQ_TO_FRF(freqHz));
+}
+
+// set the frequency from a FRF value, e.g. RF69_FREQ_TO_FRF() of a constant, worked out at compile time
+void setFrf(uint32_t frf)
 {
 	uint8_t oldMode = mode;
 	if (oldMode == RF69_MODE_TX) {
 		setMode(RF69_MODE_RX);
 	}
-	freqHz /= RF69_FSTEP; // divide down by FSTEP to get FRF
-	writeReg(REG_FRFMSB, freqHz >> 16);
-	writeReg(REG_FRFMID, freqHz >> 8);
-	writeReg(REG_FRFLSB, freqHz);
+	writeReg(REG_FRFMSB, frf >> 16);
+	writeReg(REG_FRFMID, frf >> 8);
+	writeReg(REG_FRFLSB, frf);
 	if (oldMode == RF69_MODE_RX) {
 		setMode(RF69_MODE_SYNTH);
 	}
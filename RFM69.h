@@ -37,10 +37,28 @@
 
 // must include spi.h library
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 #include "spi.h"
 #include "RFM69registers.h"
 #include "get_millis.h"
+#include <avr/sleep.h>
 
+// atmega328p (and 88/168): SS -> PB2, DIO0 -> PD2 that is INT0. define INT_VECT and the rest yourself for other wiring
+#ifndef INT_VECT
+#if defined(__AVR_ATmega328P__) || defined(__AVR_ATmega328__) || defined(__AVR_ATmega168__) || defined(__AVR_ATmega88__)
+#define SS_DDR                DDRB
+#define SS_PORT              PORTB
+#define SS_PIN                 PB2
+
+#define INT_DDR               DDRD
+#define INT_PORT             PORTD
+#define INT_PIN                PD2
+#define INTn                  INT0
+#define ISCn0                ISC00
+#define ISCn1                ISC01
+#define INT_EICR             EICRA
+#define INT_VECT         INT0_vect
+#else
 #define SS_DDR                DDRB
 #define SS_PORT              PORTB
 #define SS_PIN                 PB0
@@ -51,7 +69,10 @@
 #define INTn                  INT5
 #define ISCn0                ISC50
 #define ISCn1                ISC51
+#define INT_EICR             EICRB
 #define INT_VECT         INT5_vect
+#endif
+#endif
 
 #define RF69_MAX_DATA_LEN       61 // to take advantage of the built in AES/CRC we want to limit the frame size to the internal FIFO size (66 bytes - 3 bytes overhead - 2 bytes crc)
 #define CSMA_LIMIT              -90 // upper RX signal sensitivity threshold in dBm for carrier sense access
@@ -60,31 +81,554 @@
 #define RF69_MODE_SYNTH         2 // PLL ON
 #define RF69_MODE_RX            3 // RX MODE
 #define RF69_MODE_TX            4 // TX MODE
+#define RF69_MODE_LISTEN        5 // duty cycled RX, see listenBegin()
 #define null                  0
 #define COURSE_TEMP_COEF    -90 // puts the temperature reading in the ballpark, user can fine tune the returned value
 #define RF69_BROADCAST_ADDR 255
 #define RF69_CSMA_LIMIT_MS 1000
 #define RF69_TX_LIMIT_MS   1000
-#define RF69_FSTEP  61.035156 // == FXOSC / 2^19 = 32MHz / 2^19 (p13 in datasheet) FXOSC = module crystal oscillator frequency 
+// FSTEP = FXOSC / 2^19 = 32MHz / 2^19 = 61.03515625Hz (p13 in datasheet) FXOSC = module crystal oscillator frequency
+// FRF = Hz / FSTEP = Hz * 256 / 15625, split so it fits in 32 bits. exact (rounded down) integer math with no float,
+// and a constant expression so channel tables can be worked out at compile time
+#define RF69_FREQ_TO_FRF(hz) ((uint32_t) (hz) / 15625 * 256 + (uint32_t) (hz) % 15625 * 256 / 15625)
 // TWS: define CTLbyte bits
 #define RFM69_CTL_SENDACK   0x80
 #define RFM69_CTL_REQACK    0x40
+#define RFM69_CTL_ARQ       0x20 // sendWindowed() frame, a sequence number byte follows the CTL byte. with SENDACK: its ACK
+#define RFM69_CTL_SEQ       0x10 // a sequence number byte follows (after the ARQ one), repeats of the frame carry the same one
+#define RFM69_CTL_RSSI      0x08 // with REQACK: put the RSSI in the ACK. with SENDACK: the RSSI byte (dBm, signed) follows
+#define RFM69_CTL_FRAG      0x04 // sendMessage() fragment: message id, offset (low, high | 0x80 on the last fragment) follow
+#define RFM69_CTL_AGGR      0x02 // sendAggregated() frame: the payload is messages, each with a length byte in front
+#define RFM69_CTL_COMPRESSED 0x01 // sendCompressed() frame: a method / tag byte (RF69_Z_*) comes before the payload
+#define RFM69_CTL_BEACON    (RFM69_CTL_SENDACK | RFM69_CTL_REQACK) // both at once: a TDMA beacon, see tdmaBegin()
+#define RFM69_CTL_HOP       (RFM69_CTL_BEACON | RFM69_CTL_FRAG) // a FHSS beacon, see fhssBegin()
+// optional header bytes (the ones announced by the CTL bits above) go between the CTL byte and the payload
+#define RF69_EXT_MAX        4
+
+// CSMA/CA in front of every frame: a random backoff with the MCU asleep, then one RSSI sample, see csmaWait()
+#ifndef RF69_CSMA_SLOT_MS
+#define RF69_CSMA_SLOT_MS   1 // backoff unit, has to cover receiver startup and an RSSI sample (2 bits) at the bitrate in use
+#endif
+#ifndef RF69_CSMA_CW_MIN
+#define RF69_CSMA_CW_MIN    8 // slots the first backoff is drawn from
+#endif
+#ifndef RF69_CSMA_CW_MAX
+#define RF69_CSMA_CW_MAX    128 // the window doubles every time the channel is busy, up to this. about the longest airtime
+#endif
+#ifndef RF69_CSMA_TRIES
+#define RF69_CSMA_TRIES     6 // busy samples before the frame goes out anyway, setCSMA() changes it
+#endif
+#if RF69_CSMA_CW_MIN < 1 || RF69_CSMA_CW_MAX < RF69_CSMA_CW_MIN || RF69_CSMA_CW_MAX > 32768
+#error "RF69_CSMA_CW_MIN must be at least 1, RF69_CSMA_CW_MAX between it and 32768"
+#endif
+
+#ifndef RF69_ARQ_WINDOW
+#define RF69_ARQ_WINDOW     4 // frames sendWindowed() keeps in flight, 1..8
+#endif
+#if RF69_ARQ_WINDOW < 1 || RF69_ARQ_WINDOW > 8
+#error "RF69_ARQ_WINDOW must be between 1 and 8"
+#endif
+#ifndef RF69_PEERS
+#define RF69_PEERS          8 // nodes the driver keeps send state for (peers[]), the oldest entry makes room for a new node
+#endif
+#ifndef RF69_SENDERS
+#define RF69_SENDERS        8 // nodes the driver keeps receive state for (senders[]), one entry is kept free for the ISR
+#endif
+#ifndef RF69_ARQ_HOLD_MS
+#define RF69_ARQ_HOLD_MS    4000 // sendWindowed() frames this long after the last one start a new transfer, more than RF69_RTO_MAX_MS
+#endif
+// define RF69_SEQ before including this file to number the frames this node sends, so receivers drop the repeats
+// sendWithRetry() and sendBurst() send. receiving numbered frames works either way
+#ifndef RF69_SEQ_HOLD_MS
+#define RF69_SEQ_HOLD_MS    2000 // a frame only counts as a repeat this soon after the last one, so a sender that restarted isn't ignored
+#endif
+// retryWaitTime RF69_RTO_AUTO: wait as long as the ACKs from that node took so far (Jacobson/Karels, srtt + 4 * rttvar)
+#define RF69_RTO_AUTO       0
+#ifndef RF69_RTO_INIT_MS
+#define RF69_RTO_INIT_MS    40 // until the first round trip to a node has been measured
+#endif
+#ifndef RF69_RTO_MIN_MS
+#define RF69_RTO_MIN_MS     10 // the receiver answers from its main loop, leave it some slack
+#endif
+#ifndef RF69_RTO_MAX_MS
+#define RF69_RTO_MAX_MS     2000 // the timeout doubles with every unanswered try, up to this
+#endif
+// define RF69_ATPC before including this file to let sendWithRetry() and sendWindowed() pick the power level per node:
+// the ACKs report the RSSI the frame came in with, and the level is moved so that they report about RF69_ATPC_TARGET
+#ifndef RF69_ATPC_TARGET
+#define RF69_ATPC_TARGET    -80 // dBm, 15-25dB above the sensitivity, depending on the bitrate
+#endif
+#ifndef RF69_ATPC_HYSTERESIS
+#define RF69_ATPC_HYSTERESIS 4 // dB either side of the target the level stays where it is
+#endif
+#ifndef RF69_ATPC_MAX
+#define RF69_ATPC_MAX       31 // power level for new nodes, broadcasts and ACKs, and the most a lossy link gets
+#endif
+#ifndef RF69_ATPC_MIN
+#define RF69_ATPC_MIN       0
+#endif
+// define RF69_MESSAGES before including this file for sendMessage() and for putting received messages together
+#ifndef RF69_MSG_MAX
+#define RF69_MSG_MAX        1024 // longest message that can be received
+#endif
+#ifndef RF69_MSG_SLOTS
+#define RF69_MSG_SLOTS      1 // messages put together at the same time, RF69_MSG_MAX bytes of RAM each
+#endif
+#ifndef RF69_MSG_TIMEOUT_MS
+#define RF69_MSG_TIMEOUT_MS 3000 // an unfinished message gives up its slot after this long without a fragment
+#endif
+// define RF69_AGGREGATE before including this file for sendAggregated(). receiving aggregated frames works either way
+#ifndef RF69_AGGR_LIMIT
+#define RF69_AGGR_LIMIT     RF69_MAX_DATA_LEN // frame size that sends what is queued right away
+#endif
+#ifndef RF69_AGGR_DEADLINE_MS
+#define RF69_AGGR_DEADLINE_MS 500 // pollAggregated() sends what is queued once the first message waited this long
+#endif
+#ifndef RF69_AGGR_RETRIES
+#define RF69_AGGR_RETRIES   2 // aggregated frames go out with sendWithRetry(), 0: with send() and no ACK
+#endif
+// define RF69_COMPRESS before including this file for sendCompressed() and for receiving compressed frames
+#ifndef RF69_DELTA_MAX
+#define RF69_DELTA_MAX      16 // longest payload that is delta coded against the previous one, that many bytes per peer
+#endif
+#define RF69_Z_STORED       0x00 // as it is
+#define RF69_Z_LZ           0x10 // literal runs (0x00 | n - 1, n bytes) and matches (0x80 | length - 3, distance back)
+#define RF69_Z_DELTA        0x20 // 16 bit little endian words minus the previous payload's, zigzag varints
+#ifndef RF69_Z_STEP
+#define RF69_Z_STEP(step)   // host simulator hook, charges a step of the compression loops to its cycle count (rfm69zbench)
+#endif
+// define RF69_TDMA before including this file for tdmaBegin(). gateway and nodes need the same RF69_TDMA_SLOTS and _SLOT_MS
+#ifndef RF69_TDMA_SLOTS
+#define RF69_TDMA_SLOTS     32 // per superframe, the first one carries the beacon. at most 61, the beacon lists them all
+#endif
+#ifndef RF69_TDMA_SLOT_MS
+#define RF69_TDMA_SLOT_MS   100 // has to hold the beacon, and a frame with its ACK
+#endif
+#ifndef RF69_TDMA_GUARD_MS
+#define RF69_TDMA_GUARD_MS  3 // a node sends this long after its slot starts, and listens this much early for a beacon
+#endif
+#ifndef RF69_TDMA_OPEN
+#define RF69_TDMA_OPEN      4 // slots at the end that are never assigned: nodes without a slot of their own use them, with CSMA
+#endif
+#ifndef RF69_TDMA_LEASE
+#define RF69_TDMA_LEASE     8 // superframes a node keeps its slot without the gateway hearing from it
+#endif
+#define RF69_TDMA_SUPERFRAME_MS ((unsigned long) RF69_TDMA_SLOTS * RF69_TDMA_SLOT_MS)
+#if RF69_TDMA_SLOTS < 2 || RF69_TDMA_SLOTS > RF69_MAX_DATA_LEN || RF69_TDMA_OPEN >= RF69_TDMA_SLOTS
+#error "RF69_TDMA_SLOTS must be between 2 and 61, and more than RF69_TDMA_OPEN"
+#endif
+// define RF69_FHSS before including this file for fhssBegin(). gateway and nodes need the same RF69_FHSS_CHANNELS, in the
+// band rfm69_init() is given, where the local rules allow hopping. not together with tdmaBegin() at run time
+#define RF69_FHSS_CHANNELS_433(X) \
+	X(433200000) X(433400000) X(433600000) X(433800000) \
+	X(434000000) X(434200000) X(434400000) X(434600000) /* 200kHz apart, within 433.05-434.79MHz */
+#define RF69_FHSS_CHANNELS_868(X) \
+	X(868000000) X(868200000) X(868400000) X(868600000) \
+	X(868800000) X(869000000) X(869200000) X(869400000) /* 200kHz apart, mind the duty cycle limit of each sub-band */
+#if defined(RF69_FHSS) && !defined(RF69_FHSS_CHANNELS)
+#error "define RF69_FHSS_CHANNELS for the band, e.g. #define RF69_FHSS_CHANNELS RF69_FHSS_CHANNELS_868"
+#endif
+#ifndef RF69_FHSS_DWELL_MS
+#define RF69_FHSS_DWELL_MS  200 // time on each channel if fhssBegin() isn't given one. has to hold the beacon, a frame and its ACK
+#endif
+#ifndef RF69_FHSS_GUARD_MS
+#define RF69_FHSS_GUARD_MS  5 // a node keeps this far from either end of a dwell, and listens this much early for a beacon
+#endif
+#ifndef RF69_FHSS_HOLD_MS
+#define RF69_FHSS_HOLD_MS   60000 // a node sends on its last beacon's timing for this long, then it listens for a new one
+#endif
+#ifndef RF69_FHSS_PER_LIMIT
+#define RF69_FHSS_PER_LIMIT 50 // percent of frames lost on a channel after which a node avoids it
+#endif
+#ifndef RF69_FHSS_PER_MIN
+#define RF69_FHSS_PER_MIN   4 // frames sent on a channel before its packet error rate counts
+#endif
+#ifndef RF69_FHSS_AVOID_MS
+#define RF69_FHSS_AVOID_MS  60000 // how long a node avoids a channel, then it tries it again
+#endif
+#define RF69_FHSS_FRF_OF(hz) RF69_FREQ_TO_FRF(hz),
+#define RF69_FHSS_ONE(hz) + 1
+#define RF69_FHSS_COUNT     (0 RF69_FHSS_CHANNELS(RF69_FHSS_ONE))
+#define RF69_FHSS_MAP_LEN   ((RF69_FHSS_COUNT + 7) / 8) // blacklist bitmap, a bit per channel
+#define RF69_FHSS_BEACON_LEN (5 + RF69_FHSS_MAP_LEN) // hop (16 bit), dwell ms (16 bit), ms late, the blacklist
+#if defined(RF69_FHSS) && defined(RF69_FHSS_CHANNELS)
+#if RF69_FHSS_COUNT < 2 || RF69_FHSS_COUNT > 64
+#error "RF69_FHSS_CHANNELS must list between 2 and 64 channels"
+#endif
+#endif
+
+// modem profiles: bitrate and frequency deviation, both picked from the RF_BITRATEMSB_* / RF_FDEVMSB_* constants.
+// RXBW, AFCBW and the RX restart delay are worked out from them below and every profile is checked at compile time.
+// all nodes of a network must use the same profile. define your own list (and RF69_MODEM_DEFAULT) before including RFM69.h to change it
+#ifndef RF69_MODEM_PROFILES
+#define RF69_MODEM_PROFILES(X) \
+	X(1200,   5000) /* long range */ \
+	X(2400,   5000) \
+	X(4800,   5000) \
+	X(9600,   50000) /* what rfm69_init() always used, stays compatible with older nodes. RXBW is 62.5kHz, was 125kHz */ \
+	X(19200,  50000) \
+	X(38400,  50000) \
+	X(55555,  50000) \
+	X(100000, 100000) \
+	X(200000, 100000) \
+	X(300000, 100000) /* backhaul */
+#endif
+#ifndef RF69_MODEM_DEFAULT
+#define RF69_MODEM_DEFAULT  RF69_MODEM_9600
+#endif
+#ifndef RF69_FREQ_ERROR_HZ
+#define RF69_FREQ_ERROR_HZ  5000 // carrier offset between two nodes the receiver bandwidth has to absorb (AFC is off). AFCBW gets twice that
+#endif
+#define RF69_PA_RAMP_US     40 // RegPaRamp reset value, the RX restart delay must cover the transmitter's ramp down
+
+// smallest RXBW/AFCBW mantissa|exponent (FSK, section 3.4.6 in datasheet) of at least hz, 0xFF if hz is over 500kHz
+#define RF69_RXBW_HZ(mant, exp) (32000000UL / ((mant) * (4UL << (exp))))
+#define RF69_RXBW_HZ_OF(bits) RF69_RXBW_HZ(16 + (((bits) >> 3) & 3) * 4, (bits) & 7)
+#define RF69_RXBW_STEP(hz, mant, exp, next) ((hz) <= RF69_RXBW_HZ(mant, exp) ? (RF_RXBW_MANT_##mant | RF_RXBW_EXP_##exp) : next)
+#define RF69_RXBW_FOR(hz) ( \
+	RF69_RXBW_STEP(hz, 24, 7, RF69_RXBW_STEP(hz, 20, 7, RF69_RXBW_STEP(hz, 16, 7, RF69_RXBW_STEP(hz, 24, 6, \
+	RF69_RXBW_STEP(hz, 20, 6, RF69_RXBW_STEP(hz, 16, 6, RF69_RXBW_STEP(hz, 24, 5, RF69_RXBW_STEP(hz, 20, 5, \
+	RF69_RXBW_STEP(hz, 16, 5, RF69_RXBW_STEP(hz, 24, 4, RF69_RXBW_STEP(hz, 20, 4, RF69_RXBW_STEP(hz, 16, 4, \
+	RF69_RXBW_STEP(hz, 24, 3, RF69_RXBW_STEP(hz, 20, 3, RF69_RXBW_STEP(hz, 16, 3, RF69_RXBW_STEP(hz, 24, 2, \
+	RF69_RXBW_STEP(hz, 20, 2, RF69_RXBW_STEP(hz, 16, 2, RF69_RXBW_STEP(hz, 24, 1, RF69_RXBW_STEP(hz, 20, 1, \
+	RF69_RXBW_STEP(hz, 16, 1, RF69_RXBW_STEP(hz, 24, 0, RF69_RXBW_STEP(hz, 20, 0, RF69_RXBW_STEP(hz, 16, 0, \
+	0xFF)))))))))))))))))))))))))
+// single sided bandwidth a profile needs (Carson's rule: FDEV + BitRate / 2) plus the carrier offset
+#define RF69_MODEM_RXBW_NEED(br, fdev) ((uint32_t) (fdev) + (uint32_t) (br) / 2 + RF69_FREQ_ERROR_HZ)
+#define RF69_MODEM_AFCBW_NEED(br, fdev) ((uint32_t) (fdev) + (uint32_t) (br) / 2 + 2 * RF69_FREQ_ERROR_HZ)
+// RxRestartDelay is 2^n bits (section 5.5.6 in datasheet): smallest n >= 1 that covers the PA ramp down
+#define RF69_RESTART_BITS(br) (((uint32_t) (br) * RF69_PA_RAMP_US + 999999UL) / 1000000UL)
+#define RF69_RESTART_DELAY(br) (RF69_RESTART_BITS(br) <= 2 ? RF_PACKET2_RXRESTARTDELAY_2BITS \
+                              : RF69_RESTART_BITS(br) <= 4 ? RF_PACKET2_RXRESTARTDELAY_4BITS \
+                              : RF69_RESTART_BITS(br) <= 8 ? RF_PACKET2_RXRESTARTDELAY_8BITS \
+                              : RF69_RESTART_BITS(br) <= 16 ? RF_PACKET2_RXRESTARTDELAY_16BITS : RF_PACKET2_RXRESTARTDELAY_32BITS)
+
+// compile time checks, a failing one shows up as "size of array is negative" naming the profile and the rule it breaks
+#define RF69_MODEM_CHECK(br, fdev) \
+	typedef char rf69_modem_##br##_fdev_plus_half_bitrate_over_500kHz[(uint32_t) (fdev) + (uint32_t) (br) / 2 <= 500000UL ? 1 : -1]; \
+	typedef char rf69_modem_##br##_modulation_index_under_0_5[4UL * (fdev) >= (br) ? 1 : -1]; \
+	typedef char rf69_modem_##br##_rxbw_narrower_than_carson[RF69_RXBW_HZ_OF(RF69_RXBW_FOR(RF69_MODEM_RXBW_NEED(br, fdev))) >= RF69_MODEM_RXBW_NEED(br, fdev) ? 1 : -1]; \
+	typedef char rf69_modem_##br##_afcbw_too_narrow[RF69_RXBW_HZ_OF(RF69_RXBW_FOR(RF69_MODEM_AFCBW_NEED(br, fdev))) >= RF69_MODEM_AFCBW_NEED(br, fdev) ? 1 : -1];
+RF69_MODEM_PROFILES(RF69_MODEM_CHECK)
 
-volatile uint8_t DATA[RF69_MAX_DATA_LEN]; // recv/xmit buf, including header & crc bytes
+#define RF69_MODEM_ID(br, fdev) RF69_MODEM_##br,
+enum { RF69_MODEM_PROFILES(RF69_MODEM_ID) RF69_MODEM_COUNT };
+
+// one row per profile, in modemRegs[] order. the REG_PACKETCONFIG2 byte only holds the restart delay bits
+#define RF69_MODEM_REGS     7
+#define RF69_MODEM_ROW(br, fdev) { RF_BITRATEMSB_##br, RF_BITRATELSB_##br, RF_FDEVMSB_##fdev, RF_FDEVLSB_##fdev, \
+	(uint8_t) (RF_RXBW_DCCFREQ_010 | RF69_RXBW_FOR(RF69_MODEM_RXBW_NEED(br, fdev))), \
+	(uint8_t) (RF_AFCBW_DCCFREQAFC_100 | RF69_RXBW_FOR(RF69_MODEM_AFCBW_NEED(br, fdev))), \
+	RF69_RESTART_DELAY(br) },
+const uint8_t RF69_MODEMS[RF69_MODEM_COUNT][RF69_MODEM_REGS] PROGMEM = { RF69_MODEM_PROFILES(RF69_MODEM_ROW) };
+const uint8_t modemRegs[RF69_MODEM_REGS] = { REG_BITRATEMSB, REG_BITRATELSB, REG_FDEVMSB, REG_FDEVLSB, REG_RXBW, REG_AFCBW, REG_PACKETCONFIG2 };
+
+#define RF69_FIFO_SIZE      66
+#define RF69_FIFO_THRESH    RF_FIFOTHRESH_VALUE // FifoLevel is set while the FIFO holds more bytes than this
+#define RF69_LISTEN_RXTIMEOUT 80 // listen mode: 16 bit periods from RSSI to PayloadReady before the radio gives up (2 full frames)
+#define RF69_RX_BURST       16 // FIFO bytes read per chip select, interrupts are off for about that many SPI bytes at a time
+#define RF69_FIFO_SPIN_LIMIT 0xFFFF // status polls before a FIFO wait gives up (well over the slowest byte time)
+// define RF69_LARGE_PACKETS before including this file to send and receive frames of up to 255 bytes.
+// frames that don't fit the FIFO are streamed: TX refills it on FifoLevel, RX drains it from the sync word on.
+// short frames keep the usual format and still interoperate with nodes that don't use the option.
+// AES works on the FIFO as a whole so encrypted frames stay limited to RF69_MAX_DATA_LEN.
+#ifdef RF69_LARGE_PACKETS
+#define RF69_DATA_LEN       252 // 255 byte frame - 3 header bytes
+#else
+#define RF69_DATA_LEN       RF69_MAX_DATA_LEN
+#endif
+
+#ifndef RF69_RX_QUEUE_LEN
+#define RF69_RX_QUEUE_LEN   4 // frames buffered between the ISR and receiveDone(), must be a power of 2 (2..128)
+#endif
+#if RF69_RX_QUEUE_LEN < 2 || RF69_RX_QUEUE_LEN > 128 || (RF69_RX_QUEUE_LEN & (RF69_RX_QUEUE_LEN - 1))
+#error "RF69_RX_QUEUE_LEN must be a power of 2 between 2 and 128"
+#endif
+#ifndef RF69_ACK_OWED
+#define RF69_ACK_OWED       4 // ACKs for repeated frames the ISR can queue for receiveDone(), one per node, a power of 2
+#endif
+#if RF69_ACK_OWED < 1 || RF69_ACK_OWED > 128 || (RF69_ACK_OWED & (RF69_ACK_OWED - 1))
+#error "RF69_ACK_OWED must be a power of 2 between 1 and 128"
+#endif
+
+// one received frame as pulled out of the FIFO by the ISR
+typedef struct
+{
+	uint8_t targetID;
+	uint8_t senderID;
+	uint8_t ctl;
+	uint8_t dataLen;
+	int16_t rssi;
+	unsigned long timestamp; // millis() when the frame was read from the FIFO
+	uint8_t data[RF69_DATA_LEN];
+} rf69_packet_t;
+
+// single producer (ISR) / single consumer (receiveDone) ring. head and tail are free running,
+// only the ISR advances rxHead and only receiveDone() advances rxTail, so no locking is needed
+volatile rf69_packet_t rxQueue[RF69_RX_QUEUE_LEN];
+volatile uint8_t rxHead = 0;
+volatile uint8_t rxTail = 0;
+volatile uint16_t rxDropped = 0; // frames lost because the queue was full
+volatile uint16_t rxRejected = 0; // frames discarded by the ISR (malformed or addressed to another node)
+volatile uint16_t rxWakeups = 0; // frames the ISR had to read out of the FIFO
+volatile uint16_t rxDuplicates = 0; // frames dropped by the ISR because they had been received before
+volatile uint16_t rxForeign = 0; // frames for other nodes that still reached the ISR. the radio filters them in hardware
+                                 // so this only grows in promiscuous mode, where it counts the wakeups the filter saves
+
+volatile uint8_t DATA[RF69_DATA_LEN]; // recv/xmit buf, including header & crc bytes
 volatile uint8_t DATALEN;
 volatile uint8_t SENDERID;
 volatile uint8_t TARGETID; // should match _address
 volatile uint8_t PAYLOADLEN;
 volatile uint8_t ACK_REQUESTED;
 volatile uint8_t ACK_RECEIVED; // should be polled immediately after sending a packet with ACK request
+volatile int16_t ACK_RSSI; // RSSI the received ACK reports for the acknowledged frame, 0 if it doesn't
 volatile int16_t RSSI; // most accurate RSSI during reception (closest to the reception)
+volatile uint8_t CTLBYTE; // control byte of the last received frame, RFM69_CTL_*
+volatile uint8_t ARQSEQ; // sequence number of the last received sendWindowed() frame
+uint8_t TXATTEMPTS; // frames the last sendWithRetry() sent
+uint16_t TXRTT; // ms from the end of its last frame to the ACK, 0 if none came
+uint16_t TXBACKOFF; // ms the last frame waited for a clear channel
+uint8_t TXBUSY; // times CSMA found the channel busy before the last frame
 volatile uint8_t mode = RF69_MODE_STANDBY; // should be protected?
 uint8_t isRFM69HW = 1; // if RFM69HW model matches high power enable possible
 uint8_t address; //nodeID
 uint8_t powerLevel = 31;
 uint8_t promiscuousMode = 0;
 unsigned long millis_current;
-volatile uint8_t inISR = 0; 
+volatile uint8_t inISR = 0; // set in the top half of the ISR only, interruptHandler() runs with interrupts on
+volatile uint8_t rxPending = 0; // DIO0 rose and interruptHandler() hasn't dealt with it yet
+volatile unsigned long irqTime; // timer1_millis when DIO0 rose, latched by the top half
+volatile uint16_t irqOffMax = 0; // longest stretch the driver kept interrupts off, in Timer1 ticks (8 CPU cycles)
+uint16_t irqOffStart;
+uint8_t fifoBurst; // FIFO bytes readFifoByte() may still read before it lets go of the chip select
+volatile uint8_t txBusy = 0; // set while a frame is on air, cleared by the ISR on PacketSent
+uint8_t txAsync = 0; // current frame was started by sendAsync()
+uint8_t txDoneMode = RF69_MODE_STANDBY; // mode the ISR leaves the radio in after PacketSent
+unsigned long txStart;
+void (*sendDoneHandler)(void) = 0;
+uint8_t txCtl = 0; // CTL bits for the next frame on top of SENDACK/REQACK, loadFrame() uses them up
+uint8_t txExt[RF69_EXT_MAX]; // header extension of the next frame, goes out between the CTL byte and the payload
+uint8_t txExtLen = 0; // cleared by writeFrameTail() once the frame is loaded
+uint8_t aggrRxPos = 0; // next message in the aggregated frame at the head of the receive queue, 0: none started
+#ifdef RF69_AGGREGATE
+uint8_t aggrTo; // destination of what is queued
+uint8_t aggrLen = 0; // bytes queued, length bytes included
+uint8_t aggrBuf[RF69_DATA_LEN]; // a message longer than RF69_AGGR_LIMIT goes out alone, up to maxDataLen()
+unsigned long aggrSince; // millis() when the first one was queued
+#endif
+#ifdef RF69_SEQ
+uint8_t txSeq = 0; // sequence number of the last frame sent
+uint8_t txSeqRepeat = 0; // the next frame repeats the last one, it keeps its sequence number
+#endif
+uint8_t txMsgId = 0; // id of the last sendMessage() message
+#ifdef RF69_COMPRESS
+uint8_t zTxTo; // the last acknowledged sendCompressed() payload, what the next one to the same node is delta coded against
+uint8_t zTxRef[RF69_DELTA_MAX];
+uint8_t zTxLen;
+uint8_t zTxTag = 0; // 4 bit counter of sendCompressed() payloads
+uint8_t zTxValid = 0;
+uint16_t rxUndecodable = 0; // compressed frames dropped by receiveDone(), the sender sends the next one whole
+#endif
+uint8_t tdmaOwnSlot = 0; // send() goes without CSMA, the frame goes out in a TDMA slot of this node's own
+#ifdef RF69_TDMA
+uint8_t tdmaGateway = 0; // node id of the gateway whose beacons set the schedule, 0: TDMA off
+uint8_t tdmaOwner[RF69_TDMA_SLOTS]; // node each slot belongs to, 0: open. [0] is the beacon slot
+uint8_t tdmaLease[RF69_TDMA_SLOTS]; // gateway: superframes left until the slot is taken back
+uint8_t tdmaSynced = 0; // tdmaOwner[] and tdmaEpoch are from a beacon
+unsigned long tdmaEpoch; // millis() at the end of the last beacon, slot 1 starts there
+unsigned long tdmaNext; // gateway: when the next beacon goes out
+uint8_t tdmaCounter = 0; // superframes, the first byte of the beacon
+uint16_t tdmaBeacons = 0; // beacons received
+uint16_t tdmaMissed = 0; // and missed
+#endif
+#ifdef RF69_FHSS
+const uint32_t RF69_FHSS_FRF[RF69_FHSS_COUNT] PROGMEM = { RF69_FHSS_CHANNELS(RF69_FHSS_FRF_OF) };
+uint8_t fhssGateway = 0; // node id of the gateway whose beacons set the hops, 0: FHSS off
+uint8_t fhssSeq[RF69_FHSS_COUNT]; // channel of each hop, shuffled from the network id
+uint8_t fhssBanned[RF69_FHSS_MAP_LEN]; // channels the hops skip. the gateway's fhssBlacklist(), the beacons carry it
+uint16_t fhssDwell; // ms on each channel
+uint16_t fhssHop; // hop that started at fhssEpoch
+unsigned long fhssEpoch; // millis()
+unsigned long fhssHeard; // millis() at the end of the last beacon
+uint8_t fhssSynced = 0; // fhssHop and fhssEpoch are from a beacon
+uint8_t fhssTuned = 0xFF; // channel the radio is on
+uint8_t fhssScan = 0; // hops an unsynced node listened through
+uint16_t fhssSent[RF69_FHSS_COUNT]; // fhssSend() tries on each channel, both halved every 32 so they follow changes
+uint16_t fhssLost[RF69_FHSS_COUNT]; // and the ones that weren't acknowledged
+unsigned long fhssAvoid[RF69_FHSS_COUNT]; // millis() until which this node doesn't send on the channel, 0: it does
+uint16_t fhssBeacons = 0; // beacons received
+uint16_t fhssMissed = 0; // and missed
+#endif
+uint16_t randomState = 1; // random16(), seeded with the node and network id
+int8_t csmaThreshold = CSMA_LIMIT; // dBm, a channel this loud is busy
+uint8_t csmaTries = RF69_CSMA_TRIES;
+uint16_t csmaGiveUps = 0; // frames sent on a busy channel, after csmaTries busy samples or RF69_CSMA_LIMIT_MS
+
+// an ACK the driver owes the sender of a repeated frame (the ACK for the first one got lost), receiveDone() sends it
+typedef struct
+{
+	uint8_t to;
+	uint8_t arq; // the frame was a sendWindowed() one
+	int16_t rssi; // it asked for the RSSI in the ACK (RFM69_CTL_RSSI), 0 if it didn't
+} rf69_ack_t;
+volatile rf69_ack_t ackOwed[RF69_ACK_OWED]; // a ring like rxQueue, filled by the ISR
+volatile uint8_t ackOwedHead = 0;
+volatile uint8_t ackOwedTail = 0;
+
+// what the driver keeps per node it sends to, only used outside the ISR
+typedef struct
+{
+	uint8_t used;
+	uint8_t id;
+	uint8_t flags; // RF69_PEER_*
+	uint8_t txSeq; // sequence number of the next sendWindowed() frame to this node, starts at random
+	uint16_t srtt8; // smoothed ACK round trip in ms, times 8
+	uint16_t rttvar4; // its mean deviation in ms, times 4
+	uint8_t backoff; // the timeout doubles this many times, until an ACK for a frame sent only once comes
+#ifdef RF69_ATPC
+	uint8_t txPower; // power level for frames to this node
+#endif
+} rf69_peer_t;
+#define RF69_PEER_RTT       0x04 // srtt8 and rttvar4 are valid
+#define RF69_PEER_POWER     0x08 // txPower is valid
+
+// what the driver keeps per node it receives from. the ISR takes free entries, only receiveDone() frees them
+typedef struct
+{
+	uint8_t used;
+	uint8_t id;
+	uint8_t flags; // RF69_SENDER_*
+	uint16_t heard; // last frame from this node, millis() truncated
+	uint8_t rxNext; // oldest sendWindowed() frame from this node not received yet
+	uint8_t rxMask; // bit i: frame rxNext + i already received
+	uint16_t rxArqTime; // when the last of them came, millis() truncated
+	uint8_t rxSeq; // RFM69_CTL_SEQ number of the last frame from this node
+	uint16_t rxSeqTime; // and when it came, millis() truncated
+#ifdef RF69_COMPRESS
+	uint8_t zRxRef[RF69_DELTA_MAX]; // the last compressed payload from this node, the next delta is against it
+	uint8_t zRxLen;
+	uint8_t zRxTag;
+#endif
+} rf69_sender_t;
+#define RF69_SENDER_ARQ     0x01 // rxNext is valid
+#define RF69_SENDER_SEQ     0x02 // rxSeq is valid
+#define RF69_SENDER_ZREF    0x04 // zRxRef is valid
+
+rf69_peer_t peers[RF69_PEERS];
+rf69_sender_t senders[RF69_SENDERS];
+#ifdef RF69_MESSAGES
+#define RF69_MSG_FRAG_MIN   (RF69_MAX_DATA_LEN - 4) // shortest fragment but the last, so no two offsets share a have[] bit
+// a message being put together
+typedef struct
+{
+	uint8_t state; // RF69_MSG_FREE, _BUSY or _DONE
+	uint8_t sender;
+	uint8_t id;
+	uint16_t size; // 0xFFFF until the last fragment came
+	uint16_t received; // bytes so far
+	uint8_t have[RF69_MSG_MAX / RF69_MSG_FRAG_MIN / 8 + 1]; // fragments so far, by offset / RF69_MSG_FRAG_MIN
+	uint16_t time; // of the last fragment, millis() truncated
+	uint8_t data[RF69_MSG_MAX];
+} rf69_msg_t;
+#define RF69_MSG_FREE       0
+#define RF69_MSG_BUSY       1
+#define RF69_MSG_DONE       2 // handed to the application, free again with the next receiveDone()
+rf69_msg_t msgPool[RF69_MSG_SLOTS];
+rf69_msg_t* msgDelivered = 0;
+uint8_t* MESSAGE = 0; // the message receiveDone() just put together, valid until the next receiveDone()
+uint16_t MESSAGELEN = 0; // its length, 0 if receiveDone() returned a single frame
+#endif
+uint8_t peerNext = 0; // entry findPeer() hands out next
+uint8_t modemProfile = RF69_MODEM_DEFAULT; // RF69_MODEM_* in use
+uint8_t listenEndAction = RF_LISTEN1_END_10; // RF_LISTEN1_END_* the radio was given, the ISR follows it up after a wake
+#ifdef RF69_LARGE_PACKETS
+uint8_t rxFrameLen = 0; // length byte of the frame being received, 0 while waiting for a sync word
+int16_t rxRssi; // RSSI latched at the sync word
+uint8_t fifoAvail; // bytes of the current frame known to be in the FIFO
+uint8_t fifoRemaining; // bytes of the current frame not read yet
+uint8_t fifoError; // a FIFO wait timed out or the CRC failed, the frame is garbage
+uint8_t irqFlags2; // last REG_IRQFLAGS2 value seen by waitIrqFlags2()
+#define RF69_DIO0_RX        RF_DIOMAPPING1_DIO0_10 // "SyncAddress", so long frames can be drained while they come in
+#ifdef RF69_RX_POLLED
+#error "RF69_RX_POLLED can't keep up with frames streamed through the FIFO, don't use it with RF69_LARGE_PACKETS"
+#endif
+#else
+#define RF69_DIO0_RX        RF_DIOMAPPING1_DIO0_01 // "PayloadReady"
+#endif
+
+// RAM copies of the configuration registers the driver read-modify-writes, kept up to date by writeReg()
+// so the hot paths (setMode, send, receiveBegin ...) don't have to read them back over SPI first
+#define RF69_SHADOW_OPMODE         0
+#define RF69_SHADOW_PALEVEL        1
+#define RF69_SHADOW_PACKETCONFIG1  2
+#define RF69_SHADOW_PACKETCONFIG2  3
+#define RF69_SHADOW_BITRATEMSB     4
+#define RF69_SHADOW_BITRATELSB     5
+#define RF69_SHADOW_FDEVMSB        6
+#define RF69_SHADOW_FDEVLSB        7
+#define RF69_SHADOW_RXBW           8
+#define RF69_SHADOW_AFCBW          9
+#define RF69_SHADOW_FRFMSB         10
+#define RF69_SHADOW_FRFMID         11
+#define RF69_SHADOW_FRFLSB         12
+#define RF69_SHADOW_COUNT          13
+uint8_t regShadow[RF69_SHADOW_COUNT];
+const uint8_t shadowRegs[RF69_SHADOW_COUNT] = { REG_OPMODE, REG_PALEVEL, REG_PACKETCONFIG1, REG_PACKETCONFIG2,
+	REG_BITRATEMSB, REG_BITRATELSB, REG_FDEVMSB, REG_FDEVLSB, REG_RXBW, REG_AFCBW, REG_FRFMSB, REG_FRFMID, REG_FRFLSB };
+uint32_t spiSaved = 0; // SPI transactions avoided by reading a shadow copy instead of the radio
+
+// define RF69_TRACE before including this file to see where the radio path spends its time: SPI transactions per
+// register, how long the chip select was held, and Timer1 ticks (8 CPU cycles) spent in the main calls and in the
+// mode transition waits. the application dumps rf69Trace (over the UART or so) and clears it with traceReset().
+// without RF69_TRACE the RF69_TRACE_* hooks are empty and the driver compiles to exactly the same code
+#ifdef RF69_TRACE
+#define RF69_TRACE_REGS     0x70 // REG_FIFO..REG_TESTDAGC
+
+// calls, total and longest time of one traced call or wait, in Timer1 ticks
+typedef struct
+{
+	uint16_t calls;
+	uint32_t ticks;
+	uint32_t maxTicks;
+} rf69_timing_t;
+
+typedef struct
+{
+	uint16_t regAccess[RF69_TRACE_REGS]; // SPI transactions by register, a burst counts for the register it starts at
+	uint32_t fifoBytes; // frame bytes written to or read from the FIFO
+	uint32_t spiTicks; // chip select held low, outside the top half of the ISR
+	// calls that change anything, a nested call counts for both (send() includes sendFrame(), which includes setMode())
+	rf69_timing_t send;
+	rf69_timing_t sendWithRetry;
+	rf69_timing_t sendFrame;
+	rf69_timing_t receiveDone;
+	rf69_timing_t setMode;
+	rf69_timing_t readRSSI;
+	rf69_timing_t interruptHandler;
+	// waits inside them
+	rf69_timing_t modeReady; // ModeReady after sleep in setMode() and before the FIFO is loaded in loadFrame()
+	rf69_timing_t packetSent; // sendFrame() waiting for the ISR to see PacketSent
+} rf69_trace_t;
+
+rf69_trace_t rf69Trace;
+uint16_t traceSelectStart;
+#define RF69_TRACE_BEGIN(timing)    uint32_t trace_##timing = traceTicks()
+#define RF69_TRACE_END(timing)      traceAdd(&rf69Trace.timing, trace_##timing)
+#define RF69_TRACE_END_IF(cond, timing) do { if (cond) RF69_TRACE_END(timing); } while (0)
+#define RF69_TRACE_SPI(addr)        do { if (((addr) & 0x7F) < RF69_TRACE_REGS) rf69Trace.regAccess[(addr) & 0x7F]++; } while (0)
+#define RF69_TRACE_FIFO(bytes)      rf69Trace.fifoBytes += (bytes)
+#define RF69_TRACE_SELECT()         traceSelectStart = TCNT1
+#define RF69_TRACE_UNSELECT()       traceUnselect()
+#else
+#define RF69_TRACE_BEGIN(timing)
+#define RF69_TRACE_END(timing)
+#define RF69_TRACE_END_IF(cond, timing)
+#define RF69_TRACE_SPI(addr)
+#define RF69_TRACE_FIFO(bytes)
+#define RF69_TRACE_SELECT()
+#define RF69_TRACE_UNSELECT()
+#endif
     
 
 void rfm69_init(uint16_t freqBand, uint8_t nodeID, uint8_t networkID=33);
@@ -92,14 +636,90 @@ void setAddress(uint8_t addr);
 void setNetwork(uint8_t networkID);
 uint8_t canSend();
 void send(uint8_t toAddress, const void* buffer, uint8_t bufferSize, uint8_t requestACK=0);
+uint8_t sendAsync(uint8_t toAddress, const void* buffer, uint8_t bufferSize, uint8_t requestACK=0);
+uint8_t sendDone();
+void setSendDoneCallback(void (*callback)(void));
 uint8_t sendWithRetry(uint8_t toAddress, const void* buffer, uint8_t bufferSize, uint8_t retries, uint8_t retryWaitTime);
+uint8_t sendWindowed(uint8_t toAddress, const void* buffer, uint16_t size, uint8_t retries, uint8_t retryWaitTime, uint8_t fragment=0);
+#ifdef RF69_AGGREGATE
+uint8_t sendAggregated(uint8_t toAddress, const void* buffer, uint8_t size);
+uint8_t flushAggregated();
+uint8_t pollAggregated();
+#endif
+#ifdef RF69_COMPRESS
+uint8_t sendCompressed(uint8_t toAddress, const void* buffer, uint8_t size, uint8_t retries, uint8_t retryWaitTime);
+uint8_t compressFrame(uint8_t* out, const uint8_t* in, uint8_t size, uint8_t tag, const uint8_t* ref);
+uint8_t decompressFrame(rf69_sender_t* peer, uint8_t* out, const uint8_t* in, uint8_t len);
+uint8_t packLz(uint8_t* out, const uint8_t* in, uint8_t size, uint8_t max);
+uint8_t unpackLz(uint8_t* out, const uint8_t* in, uint8_t len, uint8_t max);
+uint8_t packDelta(uint8_t* out, const uint8_t* in, const uint8_t* ref, uint8_t size, uint8_t max);
+uint8_t unpackDelta(uint8_t* out, const uint8_t* in, uint8_t len, const uint8_t* ref, uint8_t size);
+#endif
+#ifdef RF69_TDMA
+void tdmaBegin(uint8_t gatewayID);
+void tdmaEnd();
+void tdmaPoll();
+uint8_t tdmaSend(uint8_t toAddress, const void* buffer, uint8_t bufferSize, uint8_t retries, uint8_t retryWaitTime);
+uint8_t tdmaNextSlot();
+uint8_t tdmaSync();
+void tdmaWait(unsigned long until);
+void tdmaHeard(uint8_t id);
+#endif
+#ifdef RF69_FHSS
+void fhssBegin(uint8_t gatewayID, uint16_t dwellMs=0);
+void fhssEnd();
+void fhssPoll();
+uint8_t fhssSend(uint8_t toAddress, const void* buffer, uint8_t bufferSize, uint8_t retries, uint8_t retryWaitTime);
+uint8_t fhssBlacklist(uint8_t channel, uint8_t onOff);
+uint8_t fhssChannel(uint16_t hop);
+uint8_t fhssIsBanned(uint8_t channel);
+uint8_t fhssAvoiding(uint8_t channel);
+uint16_t fhssNow();
+void fhssTune(uint8_t channel);
+uint8_t fhssSync();
+uint16_t fhssWindow(uint16_t need, uint8_t any, uint16_t after);
+void fhssResult(uint8_t channel, uint8_t ok);
+#endif
+#ifdef RF69_MESSAGES
+uint8_t sendMessage(uint8_t toAddress, const void* buffer, uint16_t size, uint8_t retries, uint8_t retryWaitTime);
+rf69_msg_t* msgFind(uint8_t sender, uint8_t id, uint8_t claim);
+uint8_t msgClaim(uint8_t sender, volatile uint8_t* frag, uint8_t len);
+uint8_t msgFragment(const uint8_t* frag);
+#endif
 uint8_t ACKRequested();
 uint8_t ACKReceived(uint8_t fromNodeID);
 void receiveBegin();
 uint8_t receiveDone();
+uint8_t rxQueueCount();
+void takeBeacon(volatile rf69_packet_t* packet);
+#if defined(RF69_TDMA) || defined(RF69_FHSS)
+void takeBeacons();
+#endif
 void sendACK(const void* buffer = "", uint8_t bufferSize=0);
+void sendACKTo(uint8_t toAddress, const void* buffer, uint8_t bufferSize, int16_t rssi);
+rf69_peer_t* findPeer(uint8_t id);
+rf69_sender_t* findSender(uint8_t id);
+void senderRoom();
+uint8_t arqAccept(uint8_t sender, uint8_t seq, uint8_t book);
+uint8_t seqAccept(uint8_t sender, uint8_t seq, uint8_t book);
+uint8_t extLen(uint8_t ctl);
+uint16_t rtoOf(rf69_peer_t* peer);
+void rttSample(rf69_peer_t* peer, uint16_t rtt);
+#ifdef RF69_ATPC
+void atpcUpdate(rf69_peer_t* peer, int16_t rssi);
+#endif
+void sendArqAck(uint8_t toAddress, int16_t rssi);
+void oweAck(uint8_t to, uint8_t arq, int16_t rssi);
+uint16_t xorshift16(uint16_t x);
+uint16_t random16();
+uint16_t byteAirUs();
+void csmaWait();
+void setCSMA(int8_t thresholdDbm, uint8_t tries);
+void mcuIdle(unsigned long until);
+void csmaBackoff(uint16_t slots);
 uint32_t getFrequency();
 void setFrequency(uint32_t freqHz);
+void setFrf(uint32_t frf);
 void encrypt(const char* key);
 int16_t readRSSI(uint8_t forceTrigger=0);
 void setHighPower(uint8_t onOFF=1); // has to be called after initialize() for RFM69HW
@@ -109,65 +729,124 @@ uint8_t readTemperature(uint8_t calFactor=0); // get CMOS temperature (8bit)
 void rcCalibration(); // calibrate the internal RC oscillator for use in wide temperature variations - see datasheet section [4.3.5. RC Timer Accuracy]
 uint8_t readReg(uint8_t addr);
 void writeReg(uint8_t addr, uint8_t val);
+uint8_t readRegCached(uint8_t addr);
+void updateReg(uint8_t addr, uint8_t keep, uint8_t bits);
+int8_t shadowIndex(uint8_t addr);
+void resyncShadowRegs();
+uint8_t verifyShadowRegs();
+void writeProfile(uint32_t frf, uint8_t nodeID, uint8_t networkID);
+uint8_t setModemProfile(uint8_t profile);
+uint8_t modemValue(uint8_t profile, uint8_t reg);
+uint8_t verifyProfile();
 void sendFrame(uint8_t toAddress, const void* buffer, uint8_t size, uint8_t requestACK=0, uint8_t sendACK=0);
+uint8_t loadFrame(uint8_t toAddress, const void* buffer, uint8_t bufferSize, uint8_t requestACK, uint8_t sendACK);
+void writeFrameTail(const void* buffer, uint8_t sent, uint8_t bufferSize);
+void readFrame(uint8_t payloadLen, int16_t rssi);
+uint8_t waitIrqFlags2(uint8_t flag, uint8_t set);
+#ifdef RF69_LARGE_PACKETS
+uint8_t waitRxByte();
+#endif
+uint8_t readFifoByte();
+uint8_t frameDataLen();
+uint8_t maxDataLen();
 void setMode(uint8_t mode);
 void setHighPowerRegs(uint8_t onOff);
+void setListenConfig(uint8_t resolIdle, uint8_t coefIdle, uint8_t resolRx, uint8_t coefRx, uint8_t criteria=RF_LISTEN1_CRITERIA_RSSI, uint8_t end=RF_LISTEN1_END_10);
+uint8_t setListenPeriod(uint32_t idleUs, uint32_t rxUs, uint8_t criteria=RF_LISTEN1_CRITERIA_RSSI, uint8_t end=RF_LISTEN1_END_10);
+void listenBegin();
+void listenStop();
+void listenWoken();
+void sendBurst(uint8_t toAddress, const void* buffer, uint8_t bufferSize, uint16_t durationMs);
 void promiscuous(uint8_t onOff);
 void maybeInterrupts();
+void irqOffDone();
+void interruptHandler();
+void pollInterrupt();
 void select();
 void unselect();
 uint8_t receiveDone();
+#ifdef RF69_TRACE
+uint32_t traceTicks();
+void traceUnselect();
+void traceAdd(rf69_timing_t* timing, uint32_t start);
+void traceReset();
+#endif
+
+// init profile, kept in flash and written with SX1231 burst access: one chip select per block of
+// contiguous registers. each block is { first register, register count, values... }, 255 ends the table.
+// the frequency, network id and node id bytes are placeholders, writeProfile() patches them in on the fly
+const uint8_t RF69_PROFILE[] PROGMEM =
+{
+	REG_OPMODE, 9,
+	/* 0x01 */ RF_OPMODE_SEQUENCER_ON | RF_OPMODE_LISTEN_OFF | RF_OPMODE_STANDBY,
+	/* 0x02 */ RF_DATAMODUL_DATAMODE_PACKET | RF_DATAMODUL_MODULATIONTYPE_FSK | RF_DATAMODUL_MODULATIONSHAPING_00, // no shaping
+	/* 0x03 */ 0, // REG_BITRATEMSB, from RF69_MODEM_DEFAULT
+	/* 0x04 */ 0, // REG_BITRATELSB, from RF69_MODEM_DEFAULT
+	/* 0x05 */ 0, // REG_FDEVMSB, from RF69_MODEM_DEFAULT
+	/* 0x06 */ 0, // REG_FDEVLSB, from RF69_MODEM_DEFAULT
+	/* 0x07 */ 0, // REG_FRFMSB, from freqBand
+	/* 0x08 */ 0, // REG_FRFMID, from freqBand
+	/* 0x09 */ 0, // REG_FRFLSB, from freqBand
+
+	// looks like PA1 and PA2 are not implemented on RFM69W, hence the max output power is 13dBm
+	// +17dBm and +20dBm are possible on RFM69HW
+	// +13dBm formula: Pout = -18 + OutputPower (with PA0 or PA1**)
+	// +17dBm formula: Pout = -14 + OutputPower (with PA1 and PA2)**
+	// +20dBm formula: Pout = -11 + OutputPower (with PA1 and PA2)** and high power PA settings (section 3.3.7 in datasheet)
+	// PALEVEL (0x11) and OCP (0x13) are left at their defaults, setHighPower() takes care of them
+
+	// listen mode (used only after listenBegin()): idle ~1s, RX window ~2ms, wake on RSSI, back to listening after a frame
+	REG_LISTEN1, 3,
+	/* 0x0D */ RF_LISTEN1_RESOL_IDLE_4100 | RF_LISTEN1_RESOL_RX_64 | RF_LISTEN1_CRITERIA_RSSI | RF_LISTEN1_END_10,
+	/* 0x0E */ RF_LISTEN2_COEFIDLE_VALUE, // 245 * 4.1ms
+	/* 0x0F */ RF_LISTEN3_COEFRX_VALUE, // 32 * 64us
+
+	REG_RXBW, 2,
+	/* 0x19 */ 0, // REG_RXBW, from RF69_MODEM_DEFAULT
+	/* 0x1A */ 0, // REG_AFCBW, from RF69_MODEM_DEFAULT
+
+	REG_DIOMAPPING1, 12,
+	/* 0x25 */ RF69_DIO0_RX, // DIO0 is the only IRQ we're using
+	/* 0x26 */ RF_DIOMAPPING2_CLKOUT_OFF, // DIO5 ClkOut disable for power saving
+	/* 0x27 */ 0x00, // IRQFLAGS1, writing 0 leaves the flags alone
+	/* 0x28 */ RF_IRQFLAGS2_FIFOOVERRUN, // writing to this bit ensures that the FIFO & status flags are reset
+	/* 0x29 */ 220, // must be set to dBm = (-Sensitivity / 2), default is 0xE4 = 228 so -114dBm
+	/* 0x2A */ RF_RXTIMEOUT1_RXSTART_VALUE,
+	/* 0x2B */ RF_RXTIMEOUT2_RSSITHRESH_VALUE,
+	/* 0x2C */ RF_PREAMBLESIZE_MSB_VALUE,
+	/* 0x2D */ RF_PREAMBLESIZE_LSB_VALUE, // default 3 preamble bytes 0xAAAAAA
+	/* 0x2E */ RF_SYNC_ON | RF_SYNC_FIFOFILL_AUTO | RF_SYNC_SIZE_2 | RF_SYNC_TOL_0,
+	/* 0x2F */ 0x2D, // attempt to make this compatible with sync1 byte of RFM12B lib
+	/* 0x30 */ 0, // REG_SYNCVALUE2, NETWORK ID
+
+	REG_PACKETCONFIG1, 7,
+#ifdef RF69_LARGE_PACKETS
+	/* 0x37 */ RF_PACKET1_FORMAT_VARIABLE | RF_PACKET1_DCFREE_OFF | RF_PACKET1_CRC_ON | RF_PACKET1_CRCAUTOCLEAR_OFF | RF_PACKET1_ADRSFILTERING_NODEBROADCAST, // keep bad frames so PayloadReady always ends a frame, the ISR checks CrcOk
+	/* 0x38 */ 255, // in variable length mode: the max frame size, not used in TX
+#else
+	/* 0x37 */ RF_PACKET1_FORMAT_VARIABLE | RF_PACKET1_DCFREE_OFF | RF_PACKET1_CRC_ON | RF_PACKET1_CRCAUTOCLEAR_ON | RF_PACKET1_ADRSFILTERING_NODEBROADCAST, // the radio drops frames for other nodes without waking us
+	/* 0x38 */ 66, // in variable length mode: the max frame size, not used in TX
+#endif
+	/* 0x39 */ 0, // REG_NODEADRS, node id, matched by the address filter
+	/* 0x3A */ RF69_BROADCAST_ADDR, // the other address the filter lets through
+	/* 0x3B */ RF_AUTOMODES_ENTER_OFF | RF_AUTOMODES_EXIT_OFF | RF_AUTOMODES_INTERMEDIATE_SLEEP,
+	/* 0x3C */ RF_FIFOTHRESH_TXSTART_FIFONOTEMPTY | RF_FIFOTHRESH_VALUE, // TX on FIFO not empty
+	/* 0x3D */ RF_PACKET2_AUTORXRESTART_ON | RF_PACKET2_AES_OFF, // RXRESTARTDELAY comes from RF69_MODEM_DEFAULT, it must match transmitter PA ramp-down time
+
+	REG_TESTDAGC, 1,
+	/* 0x6F */ RF_DAGC_IMPROVED_LOWBETA0, // run DAGC continuously in RX mode for Fading Margin Improvement, recommended default for AfcLowBetaOn=0
+
+	255
+};
 
 // freqBand must be selected from 315, 433, 868, 915
 void rfm69_init(uint16_t freqBand, uint8_t nodeID, uint8_t networkID)
 {
-	const uint8_t CONFIG[][2] =
-	{
-		/* 0x01 */ { REG_OPMODE, RF_OPMODE_SEQUENCER_ON | RF_OPMODE_LISTEN_OFF | RF_OPMODE_STANDBY },
-		/* 0x02 */ { REG_DATAMODUL, RF_DATAMODUL_DATAMODE_PACKET | RF_DATAMODUL_MODULATIONTYPE_FSK | RF_DATAMODUL_MODULATIONSHAPING_00 }, // no shaping
-		/* 0x03 */ { REG_BITRATEMSB, RF_BITRATEMSB_9600}, // default: 4.8 KBPS
-		/* 0x04 */ { REG_BITRATELSB, RF_BITRATELSB_9600},
-		/* 0x05 */ { REG_FDEVMSB, RF_FDEVMSB_50000}, // default: 5KHz, (FDEV + BitRate / 2 <= 500KHz)
-		/* 0x06 */ { REG_FDEVLSB, RF_FDEVLSB_50000},
-
-		//* 0x07 */ { REG_FRFMSB, RF_FRFMSB_433},
-		//* 0x08 */ { REG_FRFMID, RF_FRFMID_433},
-		//* 0x09 */ { REG_FRFLSB, RF_FRFLSB_433},
-		
-		/* 0x07 */ { REG_FRFMSB, (uint8_t) (freqBand==RF_315MHZ ? RF_FRFMSB_315 : (freqBand==RF_433MHZ ? RF_FRFMSB_433 : (freqBand==RF_868MHZ ? RF_FRFMSB_868 : RF_FRFMSB_915))) },
-		/* 0x08 */ { REG_FRFMID, (uint8_t) (freqBand==RF_315MHZ ? RF_FRFMID_315 : (freqBand==RF_433MHZ ? RF_FRFMID_433 : (freqBand==RF_868MHZ ? RF_FRFMID_868 : RF_FRFMID_915))) },
-		/* 0x09 */ { REG_FRFLSB, (uint8_t) (freqBand==RF_315MHZ ? RF_FRFLSB_315 : (freqBand==RF_433MHZ ? RF_FRFLSB_433 : (freqBand==RF_868MHZ ? RF_FRFLSB_868 : RF_FRFLSB_915))) },
-
-
-		// looks like PA1 and PA2 are not implemented on RFM69W, hence the max output power is 13dBm
-		// +17dBm and +20dBm are possible on RFM69HW
-		// +13dBm formula: Pout = -18 + OutputPower (with PA0 or PA1**)
-		// +17dBm formula: Pout = -14 + OutputPower (with PA1 and PA2)**
-		// +20dBm formula: Pout = -11 + OutputPower (with PA1 and PA2)** and high power PA settings (section 3.3.7 in datasheet)
-		///* 0x11 */ { REG_PALEVEL, RF_PALEVEL_PA0_ON | RF_PALEVEL_PA1_OFF | RF_PALEVEL_PA2_OFF | RF_PALEVEL_OUTPUTPOWER_11111},
-		///* 0x13 */ { REG_OCP, RF_OCP_ON | RF_OCP_TRIM_95 }, // over current protection (default is 95mA)
-
-		// RXBW defaults are { REG_RXBW, RF_RXBW_DCCFREQ_010 | RF_RXBW_MANT_24 | RF_RXBW_EXP_5} (RxBw: 10.4KHz)
-		/* 0x19 */ { REG_RXBW, RF_RXBW_DCCFREQ_010 | RF_RXBW_MANT_16 | RF_RXBW_EXP_2 }, // (BitRate < 2 * RxBw)
-		//for BR-19200: /* 0x19 */ { REG_RXBW, RF_RXBW_DCCFREQ_010 | RF_RXBW_MANT_24 | RF_RXBW_EXP_3 },
-		/* 0x25 */ { REG_DIOMAPPING1, RF_DIOMAPPING1_DIO0_01 }, // DIO0 is the only IRQ we're using
-		/* 0x26 */ { REG_DIOMAPPING2, RF_DIOMAPPING2_CLKOUT_OFF }, // DIO5 ClkOut disable for power saving
-		/* 0x28 */ { REG_IRQFLAGS2, RF_IRQFLAGS2_FIFOOVERRUN }, // writing to this bit ensures that the FIFO & status flags are reset
-		/* 0x29 */ { REG_RSSITHRESH, 220 }, // must be set to dBm = (-Sensitivity / 2), default is 0xE4 = 228 so -114dBm
-		///* 0x2D */ { REG_PREAMBLELSB, RF_PREAMBLESIZE_LSB_VALUE } // default 3 preamble bytes 0xAAAAAA
-		/* 0x2E */ { REG_SYNCCONFIG, RF_SYNC_ON | RF_SYNC_FIFOFILL_AUTO | RF_SYNC_SIZE_2 | RF_SYNC_TOL_0 },
-		/* 0x2F */ { REG_SYNCVALUE1, 0x2D },      // attempt to make this compatible with sync1 byte of RFM12B lib
-		/* 0x30 */ { REG_SYNCVALUE2, networkID }, // NETWORK ID
-		/* 0x37 */ { REG_PACKETCONFIG1, RF_PACKET1_FORMAT_VARIABLE | RF_PACKET1_DCFREE_OFF | RF_PACKET1_CRC_ON | RF_PACKET1_CRCAUTOCLEAR_ON | RF_PACKET1_ADRSFILTERING_OFF },
-		/* 0x38 */ { REG_PAYLOADLENGTH, 66 }, // in variable length mode: the max frame size, not used in TX
-		///* 0x39 */ { REG_NODEADRS, nodeID }, // turned off because we're not using address filtering
-		/* 0x3C */ { REG_FIFOTHRESH, RF_FIFOTHRESH_TXSTART_FIFONOTEMPTY | RF_FIFOTHRESH_VALUE }, // TX on FIFO not empty
-		/* 0x3D */ { REG_PACKETCONFIG2, RF_PACKET2_RXRESTARTDELAY_2BITS | RF_PACKET2_AUTORXRESTART_ON | RF_PACKET2_AES_OFF }, // RXRESTARTDELAY must match transmitter PA ramp-down time (bitrate dependent)
-		//for BR-19200: /* 0x3D */ { REG_PACKETCONFIG2, RF_PACKET2_RXRESTARTDELAY_NONE | RF_PACKET2_AUTORXRESTART_ON | RF_PACKET2_AES_OFF }, // RXRESTARTDELAY must match transmitter PA ramp-down time (bitrate dependent)
-		/* 0x6F */ { REG_TESTDAGC, RF_DAGC_IMPROVED_LOWBETA0 }, // run DAGC continuously in RX mode for Fading Margin Improvement, recommended default for AfcLowBetaOn=0
-		{255, 0}
-	};
-    
+	uint32_t frf = freqBand==RF_315MHZ ? ((uint32_t) RF_FRFMSB_315 << 16) | ((uint16_t) RF_FRFMID_315 << 8) | RF_FRFLSB_315
+	             : freqBand==RF_433MHZ ? ((uint32_t) RF_FRFMSB_433 << 16) | ((uint16_t) RF_FRFMID_433 << 8) | RF_FRFLSB_433
+	             : freqBand==RF_868MHZ ? ((uint32_t) RF_FRFMSB_868 << 16) | ((uint16_t) RF_FRFMID_868 << 8) | RF_FRFLSB_868
+	             :                       ((uint32_t) RF_FRFMSB_915 << 16) | ((uint16_t) RF_FRFMID_915 << 8) | RF_FRFLSB_915;
+
 	spi_init(); // spi init
 	//DDRC |= 1<<PC6; // temporary for testing. LED output
 	SS_DDR |= 1<<SS_PIN; // setting SS as output
@@ -185,8 +864,8 @@ void rfm69_init(uint16_t freqBand, uint8_t nodeID, uint8_t networkID)
 		writeReg(REG_SYNCVALUE1, 0x55);
 	}
 
-	for (uint8_t i = 0; CONFIG[i][0] != 255; i++)
-	    writeReg(CONFIG[i][0], CONFIG[i][1]);
+	writeProfile(frf, nodeID, networkID);
+	resyncShadowRegs(); // the bursts bypass writeReg(), PALEVEL is still at its reset value
 
 	// Encryption is persistent between resets and can trip you up during debugging.
 	// Disable it during initialization so we always start from a known state.
@@ -196,21 +875,122 @@ void rfm69_init(uint16_t freqBand, uint8_t nodeID, uint8_t networkID)
 	setMode(RF69_MODE_STANDBY);
 	while ((readReg(REG_IRQFLAGS1) & RF_IRQFLAGS1_MODEREADY) == 0x00);
 	
-	EICRB |= (1<<ISCn1)|(1<<ISCn0); // setting INTn rising. details datasheet p91. must change with interrupt pin.
+	INT_EICR |= (1<<ISCn1)|(1<<ISCn0); // setting INTn rising. details datasheet p91
 	EIMSK |= 1<<INTn; // enable INTn
     inISR = 0;
 	//sei(); //not needed because in millis_init() sei declared :)
 	millis_init(); // to get miliseconds
 
-	address = nodeID;
-	setAddress(address); // setting this node id
-	setNetwork(networkID);
+	address = nodeID; // node id and network id are already in the radio, writeProfile() put them there
+	randomState = (uint16_t) networkID << 8 | nodeID;
+	if (!randomState)
+		randomState = 1;
+}
+
+// internal function: streams RF69_PROFILE to the radio, patching in the run time values
+void writeProfile(uint32_t frf, uint8_t nodeID, uint8_t networkID)
+{
+	const uint8_t* p = RF69_PROFILE;
+	uint8_t reg;
+	while ((reg = pgm_read_byte(p++)) != 255)
+	{
+		uint8_t count = pgm_read_byte(p++);
+		select();
+		spi_fast_shift(reg | 0x80); // the address auto-increments after every byte
+		RF69_TRACE_SPI(reg);
+		for (; count; count--, reg++)
+		{
+			uint8_t value = pgm_read_byte(p++);
+			if (reg == REG_FRFMSB) value = frf >> 16;
+			else if (reg == REG_FRFMID) value = frf >> 8;
+			else if (reg == REG_FRFLSB) value = frf;
+			else if (reg == REG_SYNCVALUE2) value = networkID;
+			else if (reg == REG_NODEADRS) value = nodeID;
+			else value |= modemValue(modemProfile, reg);
+			spi_fast_shift(value);
+		}
+		unselect();
+	}
+}
+
+// internal function: what profile puts in one of the modemRegs[], 0 for any other register
+uint8_t modemValue(uint8_t profile, uint8_t reg)
+{
+	for (uint8_t i = 0; i < RF69_MODEM_REGS; i++)
+	    if (modemRegs[i] == reg)
+	        return pgm_read_byte(&RF69_MODEMS[profile][i]);
+	return 0;
+}
+
+// switches bitrate, frequency deviation, RXBW, AFCBW and RX restart delay to one of the RF69_MODEM_* presets.
+// only the registers that differ from the current profile are written. returns how many, 0xFF if profile is unknown
+uint8_t setModemProfile(uint8_t profile)
+{
+	if (profile >= RF69_MODEM_COUNT)
+	    return 0xFF;
+	while (!sendDone()); // don't change the bitrate under a frame
+	uint8_t oldMode = mode;
+	setMode(RF69_MODE_STANDBY);
+	uint8_t written = 0;
+	for (uint8_t i = 0; i < RF69_MODEM_REGS; i++)
+	{
+		uint8_t reg = modemRegs[i];
+		uint8_t value = pgm_read_byte(&RF69_MODEMS[profile][i]);
+		uint8_t current = readRegCached(reg);
+		if (reg == REG_PACKETCONFIG2)
+		    value |= current & 0x0F; // keep AutoRxRestart and AES
+		if (value != current)
+		{
+			writeReg(reg, value);
+			written++;
+		}
+	}
+	modemProfile = profile;
+	if (oldMode == RF69_MODE_RX)
+	    receiveBegin();
+	else if (oldMode == RF69_MODE_LISTEN)
+	    listenBegin();
+	return written;
+}
+
+// burst-reads the RF69_PROFILE ranges back and returns how many registers differ (0 = radio configured as expected)
+// registers the driver changes at run time are compared with their shadow copy / node id, or skipped when
+// they are status or per-mode registers (IRQ flags, DIO mapping, RX timeout) or set by the application (network id, listen mode)
+uint8_t verifyProfile()
+{
+	const uint8_t* p = RF69_PROFILE;
+	uint8_t reg, errors = 0;
+	while ((reg = pgm_read_byte(p++)) != 255)
+	{
+		uint8_t count = pgm_read_byte(p++);
+		select();
+		spi_fast_shift(reg & 0x7F);
+		RF69_TRACE_SPI(reg);
+		for (; count; count--, reg++)
+		{
+			uint8_t expected = pgm_read_byte(p++);
+			uint8_t value = spi_fast_shift(0);
+			int8_t shadow = shadowIndex(reg);
+			if (shadow >= 0)
+			    expected = regShadow[shadow];
+			else if (reg == REG_NODEADRS)
+			    expected = address;
+			else if (reg == REG_DIOMAPPING1 || reg == REG_IRQFLAGS1 || reg == REG_IRQFLAGS2 || reg == REG_SYNCVALUE2
+			      || (reg >= REG_LISTEN1 && reg <= REG_LISTEN3) || reg == REG_RXTIMEOUT2)
+			    continue;
+			if (value != expected)
+			    errors++;
+		}
+		unselect();
+	}
+	return errors;
 }
 
 //set this node's address
 void setAddress(uint8_t addr)
 {
-	writeReg(REG_NODEADRS, addr);
+	address = addr;
+	writeReg(REG_NODEADRS, addr); // hardware address filter
 }
 
 //set network address
@@ -221,7 +1001,7 @@ void setNetwork(uint8_t networkID)
 
 uint8_t canSend()
 {
-	if (mode == RF69_MODE_RX && PAYLOADLEN == 0 && readRSSI() < CSMA_LIMIT) // if signal stronger than -100dBm is detected assume channel activity
+	if (mode == RF69_MODE_RX && readRSSI() < csmaThreshold) // if signal stronger than csmaThreshold is detected assume channel activity
 	{
 		setMode(RF69_MODE_STANDBY);
 		return 1;
@@ -231,10 +1011,15 @@ uint8_t canSend()
 
 void send(uint8_t toAddress, const void* buffer, uint8_t bufferSize, uint8_t requestACK)
 {
-	writeReg(REG_PACKETCONFIG2, (readReg(REG_PACKETCONFIG2) & 0xFB) | RF_PACKET2_RXRESTART); // avoid RX deadlocks
-	millis_current = millis();
-	while (!canSend() && millis() - millis_current < RF69_CSMA_LIMIT_MS) receiveDone();
+	RF69_TRACE_BEGIN(send);
+	while (!sendDone()); // let a frame started by sendAsync() go out first
+	updateReg(REG_PACKETCONFIG2, 0xFB, RF_PACKET2_RXRESTART); // avoid RX deadlocks
+	TXBACKOFF = 0;
+	TXBUSY = 0;
+	if (!tdmaOwnSlot) // nobody else sends in this node's own TDMA slot
+		csmaWait();
 	sendFrame(toAddress, buffer, bufferSize, requestACK, 0);
+	RF69_TRACE_END(send);
 }
 
 // check whether an ACK was requested in the last received packet (non-broadcasted packet)
@@ -247,13 +1032,22 @@ uint8_t ACKRequested()
 void sendACK(const void* buffer, uint8_t bufferSize)
 {
 	ACK_REQUESTED = 0;   // TWS added to make sure we don't end up in a timing race and infinite loop sending Acks
-	uint8_t sender = SENDERID;
+	sendACKTo(SENDERID, buffer, bufferSize, (CTLBYTE & (RFM69_CTL_SENDACK | RFM69_CTL_RSSI)) == RFM69_CTL_RSSI ? RSSI : 0);
+}
+
+// internal function: sends an ACK frame to toAddress. rssi: of the frame it acknowledges if that asked for it, else 0
+void sendACKTo(uint8_t toAddress, const void* buffer, uint8_t bufferSize, int16_t rssi)
+{
+	while (!sendDone()); // let a frame started by sendAsync() go out first
 	int16_t _RSSI = RSSI; // save payload received RSSI value
-	writeReg(REG_PACKETCONFIG2, (readReg(REG_PACKETCONFIG2) & 0xFB) | RF_PACKET2_RXRESTART); // avoid RX deadlocks
-	millis_current = millis();
-	while (!canSend() && millis() - millis_current < RF69_CSMA_LIMIT_MS) receiveDone();
-	SENDERID = sender;    // TWS: Restore SenderID after it gets wiped out by receiveDone() n.b. actually now there is no receiveDone() :D
-	sendFrame(sender, buffer, bufferSize, 0, 1);
+	updateReg(REG_PACKETCONFIG2, 0xFB, RF_PACKET2_RXRESTART); // avoid RX deadlocks
+	csmaWait();
+	if (rssi)
+	{
+		txCtl |= RFM69_CTL_RSSI; // the sender wants to know how well its frame came in
+		txExt[txExtLen++] = (int8_t) rssi;
+	}
+	sendFrame(toAddress, buffer, bufferSize, 0, 1);
 	RSSI = _RSSI; // restore payload RSSI
 }
 
@@ -269,7 +1063,7 @@ void setPowerLevel(uint8_t powerLevel)
 {
 	uint8_t _powerLevel = powerLevel;
 	if (isRFM69HW==1) _powerLevel /= 2;
-	writeReg(REG_PALEVEL, (readReg(REG_PALEVEL) & 0xE0) | _powerLevel);
+	updateReg(REG_PALEVEL, 0xE0, _powerLevel);
 }
 
 //put transceiver in sleep mode to save battery - to wake or resume receiving just call receiveDone()
@@ -286,23 +1080,39 @@ uint8_t readTemperature(uint8_t calFactor) // returns centigrade
 	return ~readReg(REG_TEMP2) + COURSE_TEMP_COEF + calFactor; // 'complement' corrects the slope, rising temp = rising val
 } // COURSE_TEMP_COEF puts reading in the ballpark, user can add additional correction
 
-// return the frequency (in Hz)
+// return the frequency (in Hz), from the shadow copies: no SPI and no division
 uint32_t getFrequency()
 {
-	return RF69_FSTEP * (((uint32_t) readReg(REG_FRFMSB) << 16) + ((uint16_t) readReg(REG_FRFMID) << 8) + readReg(REG_FRFLSB));
+	uint32_t frf = ((uint32_t) readRegCached(REG_FRFMSB) << 16) | ((uint16_t) readRegCached(REG_FRFMID) << 8) | readRegCached(REG_FRFLSB);
+	return (frf >> 8) * 15625 + (((frf & 0xFF) * 15625) >> 8); // FRF * FSTEP = FRF * 15625 / 256
 }
 
 // set the frequency (in Hz)
 void setFrequency(uint32_t freqHz)
+{
+	setFrf(RF69_FREQ_TO_FRF(freqHz));
+}
+
+// set the frequency from a FRF value, e.g. a channel table built with RF69_FREQ_TO_FRF() at compile time.
+// one burst from the first FRF byte that changed: the new frequency takes effect when FRFLSB is written, so that one always is
+void setFrf(uint32_t frf)
 {
 	uint8_t oldMode = mode;
 	if (oldMode == RF69_MODE_TX) {
 		setMode(RF69_MODE_RX);
 	}
-	freqHz /= RF69_FSTEP; // divide down by FSTEP to get FRF
-	writeReg(REG_FRFMSB, freqHz >> 16);
-	writeReg(REG_FRFMID, freqHz >> 8);
-	writeReg(REG_FRFLSB, freqHz);
+	uint8_t reg = readRegCached(REG_FRFMSB) != (uint8_t) (frf >> 16) ? REG_FRFMSB
+	            : readRegCached(REG_FRFMID) != (uint8_t) (frf >> 8) ? REG_FRFMID : REG_FRFLSB;
+	select();
+	spi_fast_shift(reg | 0x80);
+	RF69_TRACE_SPI(reg);
+	for (; reg <= REG_FRFLSB; reg++)
+	{
+		uint8_t value = frf >> (8 * (REG_FRFLSB - reg));
+		spi_fast_shift(value);
+		regShadow[shadowIndex(reg)] = value;
+	}
+	unselect();
 	if (oldMode == RF69_MODE_RX) {
 		setMode(RF69_MODE_SYNTH);
 	}
@@ -313,6 +1123,7 @@ uint8_t readReg(uint8_t addr)
 {
     select();
 	spi_fast_shift(addr & 0x7F);
+	RF69_TRACE_SPI(addr);
 	uint8_t regval = spi_fast_shift(0);
 	unselect();
 	return regval;
@@ -320,12 +1131,73 @@ uint8_t readReg(uint8_t addr)
 
 void writeReg(uint8_t addr, uint8_t value)
 {
+	int8_t shadow = shadowIndex(addr);
 	select();
 	spi_fast_shift(addr | 0x80);
+	RF69_TRACE_SPI(addr);
 	spi_fast_shift(value);
+	if (shadow >= 0) // strip the self clearing trigger bits, they always read back as 0
+	    regShadow[shadow] = value & ~(addr == REG_OPMODE ? RF_OPMODE_LISTENABORT : addr == REG_PACKETCONFIG2 ? RF_PACKET2_RXRESTART : 0);
 	unselect();
 }
 
+// position of addr in regShadow[], -1 if the register isn't shadowed
+int8_t shadowIndex(uint8_t addr)
+{
+	switch (addr)
+	{
+		case REG_OPMODE: return RF69_SHADOW_OPMODE;
+		case REG_PALEVEL: return RF69_SHADOW_PALEVEL;
+		case REG_PACKETCONFIG1: return RF69_SHADOW_PACKETCONFIG1;
+		case REG_PACKETCONFIG2: return RF69_SHADOW_PACKETCONFIG2;
+		case REG_BITRATEMSB: return RF69_SHADOW_BITRATEMSB;
+		case REG_BITRATELSB: return RF69_SHADOW_BITRATELSB;
+		case REG_FDEVMSB: return RF69_SHADOW_FDEVMSB;
+		case REG_FDEVLSB: return RF69_SHADOW_FDEVLSB;
+		case REG_RXBW: return RF69_SHADOW_RXBW;
+		case REG_AFCBW: return RF69_SHADOW_AFCBW;
+		case REG_FRFMSB: return RF69_SHADOW_FRFMSB;
+		case REG_FRFMID: return RF69_SHADOW_FRFMID;
+		case REG_FRFLSB: return RF69_SHADOW_FRFLSB;
+		default: return -1;
+	}
+}
+
+// like readReg() but answers shadowed registers from RAM without touching the SPI bus
+uint8_t readRegCached(uint8_t addr)
+{
+	int8_t shadow = shadowIndex(addr);
+	if (shadow < 0)
+	    return readReg(addr);
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) // interruptHandler() counts on it too, with interrupts on
+	    spiSaved++;
+	return regShadow[shadow];
+}
+
+// internal function: read-modify-write of a shadowed register, keeps the bits in keep and sets bits. atomic, so the
+// interruptHandler() can't change the register between the read of the shadow copy and the write
+void updateReg(uint8_t addr, uint8_t keep, uint8_t bits)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	    writeReg(addr, (readRegCached(addr) & keep) | bits);
+}
+
+// reloads every shadow copy from the radio, use it to recover after the module was reset behind our back
+void resyncShadowRegs()
+{
+	for (uint8_t i = 0; i < RF69_SHADOW_COUNT; i++)
+	    regShadow[i] = readReg(shadowRegs[i]);
+}
+
+// returns 1 if the radio still holds what the shadow copies say, 0 if resyncShadowRegs() (or rfm69_init()) is needed
+uint8_t verifyShadowRegs()
+{
+	for (uint8_t i = 0; i < RF69_SHADOW_COUNT; i++)
+	    if (readReg(shadowRegs[i]) != regShadow[i])
+	        return 0;
+	return 1;
+}
+
 // To enable encryption: radio.encrypt("ABCDEFGHIJKLMNOP");
 // To disable encryption: encrypt(null) or encrypt(0)
 // KEY HAS TO BE 16 bytes !!!
@@ -336,47 +1208,153 @@ void encrypt(const char* key)
 	{
 		select();
 		spi_fast_shift(REG_AESKEY1 | 0x80);
+		RF69_TRACE_SPI(REG_AESKEY1);
 		for (uint8_t i = 0; i < 16; i++)
 		    spi_fast_shift(key[i]);
 		unselect();
 	}
-	else
-	    writeReg(REG_PACKETCONFIG2, (readReg(REG_PACKETCONFIG2) & 0xFE) | 0x00);	
+	updateReg(REG_PACKETCONFIG2, 0xFE, key ? RF_PACKET2_AES_ON : RF_PACKET2_AES_OFF);
 }
 
 void setMode(uint8_t newMode)
 {
 	if (newMode == mode)
 	return;
+	RF69_TRACE_BEGIN(setMode);
+	if (mode == RF69_MODE_LISTEN)
+		listenStop(); // the mode bits only take effect once listen mode is aborted
 
 	switch (newMode)
 	{
 		case RF69_MODE_TX:
-			writeReg(REG_OPMODE, (readReg(REG_OPMODE) & 0xE3) | RF_OPMODE_TRANSMITTER);
+			updateReg(REG_OPMODE, 0xE3, RF_OPMODE_TRANSMITTER);
 			if (isRFM69HW) setHighPowerRegs(1);
 			break;
 		case RF69_MODE_RX:
-			writeReg(REG_OPMODE, (readReg(REG_OPMODE) & 0xE3) | RF_OPMODE_RECEIVER);
+			updateReg(REG_OPMODE, 0xE3, RF_OPMODE_RECEIVER);
 			if (isRFM69HW) setHighPowerRegs(0);
 			break;
 		case RF69_MODE_SYNTH:
-			writeReg(REG_OPMODE, (readReg(REG_OPMODE) & 0xE3) | RF_OPMODE_SYNTHESIZER);
+			updateReg(REG_OPMODE, 0xE3, RF_OPMODE_SYNTHESIZER);
 			break;
 		case RF69_MODE_STANDBY:
-			writeReg(REG_OPMODE, (readReg(REG_OPMODE) & 0xE3) | RF_OPMODE_STANDBY);
+			updateReg(REG_OPMODE, 0xE3, RF_OPMODE_STANDBY);
 			break;
 		case RF69_MODE_SLEEP:
-			writeReg(REG_OPMODE, (readReg(REG_OPMODE) & 0xE3) | RF_OPMODE_SLEEP);
+			updateReg(REG_OPMODE, 0xE3, RF_OPMODE_SLEEP);
 			break;
 		default:
 		return;
 	}
     // we are using packet mode, so this check is not really needed
     // but waiting for mode ready is necessary when going from sleep because the FIFO may not be immediately available from previous mode
+    RF69_TRACE_BEGIN(modeReady);
     while (mode == RF69_MODE_SLEEP && (readReg(REG_IRQFLAGS1) & RF_IRQFLAGS1_MODEREADY) == 0x00); // wait for ModeReady
+    RF69_TRACE_END_IF(mode == RF69_MODE_SLEEP, modeReady);
     mode = newMode;
+    RF69_TRACE_END(setMode);
 }
 	
+// listen mode timing: the radio idles (about 1.2uA) for coefIdle * resolIdle, then listens for coefRx * resolRx, over and over
+// resolIdle is RF_LISTEN1_RESOL_IDLE_64/4100/262000 and resolRx RF_LISTEN1_RESOL_RX_64/4100/262000 (us)
+// criteria: RF_LISTEN1_CRITERIA_RSSI wakes on any signal above the RSSI threshold, RF_LISTEN1_CRITERIA_RSSIANDSYNC also needs
+// the sync word inside the RX window (fewer false wakes, but the window must then span a whole frame of a burst)
+// end: what follows a received frame. RF_LISTEN1_END_10 back to listening, RF_LISTEN1_END_00 stay in RX, RF_LISTEN1_END_01 standby
+// takes effect on the next listenBegin()
+void setListenConfig(uint8_t resolIdle, uint8_t coefIdle, uint8_t resolRx, uint8_t coefRx, uint8_t criteria, uint8_t end)
+{
+	listenEndAction = end;
+	select();
+	spi_fast_shift(REG_LISTEN1 | 0x80); // LISTEN1..3 are contiguous
+	RF69_TRACE_SPI(REG_LISTEN1);
+	spi_fast_shift(resolIdle | resolRx | criteria | end);
+	spi_fast_shift(coefIdle);
+	spi_fast_shift(coefRx);
+	unselect();
+}
+
+// same as setListenConfig() with the durations in microseconds, picks the finest resolution that fits
+// returns 0 (and changes nothing) if a duration is out of range (over 255 * 262ms)
+uint8_t setListenPeriod(uint32_t idleUs, uint32_t rxUs, uint8_t criteria, uint8_t end)
+{
+	static const uint32_t resolUs[3] = { 64, 4100, 262000 };
+	uint8_t resol[2], coef[2];
+	uint32_t us[2] = { idleUs, rxUs };
+	for (uint8_t i = 0; i < 2; i++)
+	{
+		uint8_t r = 0;
+		while (r < 3 && (us[i] + resolUs[r] / 2) / resolUs[r] > 255)
+			r++;
+		if (r == 3)
+			return 0;
+		uint32_t c = (us[i] + resolUs[r] / 2) / resolUs[r];
+		resol[i] = r + 1; // 01 = 64us, 10 = 4.1ms, 11 = 262ms
+		coef[i] = c ? c : 1;
+	}
+	setListenConfig(resol[0] << 6, coef[0], resol[1] << 4, coef[1], criteria, end);
+	return 1;
+}
+
+// puts the radio in listen mode: it sleeps and briefly listens in turn, in hardware, until a frame arrives.
+// frames land in the receive queue like in RX mode and receiveDone() leaves listen mode running.
+// sending, sleep(), setMode() etc. stop it, call listenBegin() again afterwards.
+// senders have to keep a frame on air for a whole idle period to be heard, see sendBurst()
+void listenBegin()
+{
+	while (!sendDone());
+	setMode(RF69_MODE_STANDBY);
+	if (isRFM69HW) setHighPowerRegs(0); // the RX periods need the normal PA settings
+	writeReg(REG_DIOMAPPING1, RF_DIOMAPPING1_DIO0_01); // DIO0 is "PayloadReady", frames that don't fit the FIFO can't be heard while listening
+	writeReg(REG_RXTIMEOUT2, RF69_LISTEN_RXTIMEOUT); // a false RSSI wake would otherwise keep the receiver on
+	writeReg(REG_IRQFLAGS2, RF_IRQFLAGS2_FIFOOVERRUN); // flush anything left from the last RX
+	mode = RF69_MODE_LISTEN;
+	updateReg(REG_OPMODE, 0x83, RF_OPMODE_LISTEN_ON | RF_OPMODE_STANDBY);
+}
+
+// internal function: aborts listen mode into standby (two writes, see datasheet "Listen Mode" section)
+void listenStop()
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) // like updateReg()
+	{
+		uint8_t opmode = (readRegCached(REG_OPMODE) & 0x83) | RF_OPMODE_STANDBY;
+		writeReg(REG_OPMODE, opmode | RF_OPMODE_LISTENABORT);
+		writeReg(REG_OPMODE, opmode);
+	}
+	writeReg(REG_RXTIMEOUT2, RF_RXTIMEOUT2_RSSITHRESH_VALUE);
+	mode = RF69_MODE_STANDBY;
+}
+
+// internal function, called from the ISR after a frame was read while listening
+void listenWoken()
+{
+	if (listenEndAction == RF_LISTEN1_END_10)
+		return; // the radio is already back to listening by itself
+	listenStop(); // listen mode has ended, leave it properly so the mode bits work again
+	if (listenEndAction == RF_LISTEN1_END_00)
+		receiveBegin(); // stay awake for the rest of the conversation
+}
+
+// sends the same frame back to back for durationMs so a node in listen mode catches it in one of its RX windows.
+// durationMs has to be longer than the receivers' idle period. receivers may get it more than once
+void sendBurst(uint8_t toAddress, const void* buffer, uint8_t bufferSize, uint16_t durationMs)
+{
+	while (!sendDone());
+	updateReg(REG_PACKETCONFIG2, 0xFB, RF_PACKET2_RXRESTART); // avoid RX deadlocks
+	csmaWait();
+	unsigned long start = millis(); // sendFrame() uses millis_current
+	do
+	{
+		sendFrame(toAddress, buffer, bufferSize, 0, 0);
+#ifdef RF69_SEQ
+		txSeqRepeat = 1;
+#endif
+	}
+	while (millis() - start < durationMs);
+#ifdef RF69_SEQ
+	txSeqRepeat = 0;
+#endif
+}
+
 // internal function
 void setHighPowerRegs(uint8_t onOff)
 {
@@ -399,7 +1377,7 @@ void setHighPower(uint8_t onOff)
 	if(isRFM69HW==0)
 	    writeReg(REG_OCP, RF_OCP_OFF);
 	else if(isRFM69HW==1) // turning ON
-	    writeReg(REG_PALEVEL, (readReg(REG_PALEVEL) & 0x1F) | RF_PALEVEL_PA1_ON | RF_PALEVEL_PA2_ON); // enable P1 & P2 amplifier stages
+	    updateReg(REG_PALEVEL, 0x1F, RF_PALEVEL_PA1_ON | RF_PALEVEL_PA2_ON); // enable P1 & P2 amplifier stages
 	else
 	    writeReg(REG_PALEVEL, RF_PALEVEL_PA0_ON | RF_PALEVEL_PA1_OFF | RF_PALEVEL_PA2_OFF | powerLevel); // enable P0 only
 }
@@ -407,6 +1385,7 @@ void setHighPower(uint8_t onOff)
 // get the received signal strength indicator (RSSI)
 int16_t readRSSI(uint8_t forceTrigger)
 {
+	RF69_TRACE_BEGIN(readRSSI);
 	int16_t rssi = 0;
 	if (forceTrigger==1)
 	{
@@ -416,48 +1395,176 @@ int16_t readRSSI(uint8_t forceTrigger)
 	}
 	rssi = -readReg(REG_RSSIVALUE);
 	rssi >>= 1;
+	RF69_TRACE_END(readRSSI);
 	return rssi;
 }
 
 // internal function
 void sendFrame(uint8_t toAddress, const void* buffer, uint8_t bufferSize, uint8_t requestACK, uint8_t sendACK)
+{
+	RF69_TRACE_BEGIN(sendFrame);
+	uint8_t sent = loadFrame(toAddress, buffer, bufferSize, requestACK, sendACK);
+	txAsync = 0;
+	txDoneMode = RF69_MODE_STANDBY;
+	txBusy = 1;
+	// no need to wait for transmit mode to be ready since its handled by the radio
+	setMode(RF69_MODE_TX);
+	writeFrameTail(buffer, sent, bufferSize);
+	RF69_TRACE_BEGIN(packetSent);
+	millis_current = millis();
+	while (txBusy && millis() - millis_current < RF69_TX_LIMIT_MS) // the ISR clears txBusy on PacketSent
+		pollInterrupt();
+	RF69_TRACE_END(packetSent);
+	if (txBusy)
+	{
+		txBusy = 0; // PacketSent never came, don't leave the transmitter on
+		setMode(RF69_MODE_STANDBY);
+	}
+	RF69_TRACE_END(sendFrame);
+}
+
+// internal function: puts the radio in standby and writes the frame to the FIFO
+// returns how many payload bytes went in, frames longer than the FIFO get the rest from writeFrameTail()
+uint8_t loadFrame(uint8_t toAddress, const void* buffer, uint8_t bufferSize, uint8_t requestACK, uint8_t sendACK)
 {
 	setMode(RF69_MODE_STANDBY); // turn off receiver to prevent reception while filling fifo
+	RF69_TRACE_BEGIN(modeReady);
 	while ((readReg(REG_IRQFLAGS1) & RF_IRQFLAGS1_MODEREADY) == 0x00); // wait for ModeReady
+	RF69_TRACE_END(modeReady);
 	writeReg(REG_DIOMAPPING1, RF_DIOMAPPING1_DIO0_00); // DIO0 is "Packet Sent"
-	if (bufferSize > RF69_MAX_DATA_LEN)
-	    bufferSize = RF69_MAX_DATA_LEN;
+#ifdef RF69_SEQ
+	if (!sendACK && !(txCtl & RFM69_CTL_ARQ))
+	{
+		if (!txSeqRepeat)
+			txSeq++;
+		txSeqRepeat = 0;
+		txCtl |= RFM69_CTL_SEQ;
+		txExt[txExtLen++] = txSeq;
+	}
+#endif
+#ifdef RF69_ATPC
+	if (requestACK && toAddress != RF69_BROADCAST_ADDR)
+	{
+		rf69_peer_t* peer = findPeer(toAddress);
+		txCtl |= RFM69_CTL_RSSI; // the ACK tells how well this came in
+		setPowerLevel(peer->flags & RF69_PEER_POWER ? peer->txPower : RF69_ATPC_MAX);
+	}
+	else
+		setPowerLevel(RF69_ATPC_MAX);
+#endif
+	if (bufferSize > frameDataLen() - txExtLen)
+	    bufferSize = frameDataLen() - txExtLen;
+	uint8_t loaded = bufferSize < RF69_FIFO_SIZE - 4 - txExtLen ? bufferSize : RF69_FIFO_SIZE - 4 - txExtLen;
 
 	// control byte
-	uint8_t CTLbyte = 0x00;
+	uint8_t CTLbyte = txCtl;
+	txCtl = 0;
 	if (sendACK==1)
-	    CTLbyte = RFM69_CTL_SENDACK;
+	    CTLbyte |= RFM69_CTL_SENDACK;
 	else if (requestACK==1)
-	    CTLbyte = RFM69_CTL_REQACK;
+	    CTLbyte |= RFM69_CTL_REQACK;
 
 	// write to FIFO
 	select(); //enable data transfer
 	spi_fast_shift(REG_FIFO | 0x80);
-	spi_fast_shift(bufferSize + 3);
+	RF69_TRACE_SPI(REG_FIFO);
+	spi_fast_shift(bufferSize + 3 + txExtLen);
 	spi_fast_shift(toAddress);
 	spi_fast_shift(address);
 	spi_fast_shift(CTLbyte);
+	for (uint8_t i = 0; i < txExtLen; i++)
+	    spi_fast_shift(txExt[i]);
 
-	for (uint8_t i = 0; i < bufferSize; i++)
+	for (uint8_t i = 0; i < loaded; i++)
 	    spi_fast_shift(((uint8_t*) buffer)[i]);
+	RF69_TRACE_FIFO(loaded + 4 + txExtLen);
 	
     unselect();
+	return loaded;
+}
 
-	// no need to wait for transmit mode to be ready since its handled by the radio
+// internal function: feeds the rest of a frame longer than the FIFO while the transmitter drains it
+// (only DIO0 is wired, so FifoLevel is polled). does nothing for frames that fit in the FIFO
+void writeFrameTail(const void* buffer, uint8_t sent, uint8_t bufferSize)
+{
+	if (bufferSize > frameDataLen() - txExtLen)
+	    bufferSize = frameDataLen() - txExtLen;
+	txExtLen = 0;
+	while (sent < bufferSize)
+	{
+		if (!waitIrqFlags2(RF_IRQFLAGS2_FIFOLEVEL, 0)) // at most RF69_FIFO_THRESH bytes left in there
+		    return; // transmitter stalled, PacketSent or the TX timeout will sort it out
+		uint8_t chunk = bufferSize - sent;
+		if (chunk > RF69_FIFO_SIZE - RF69_FIFO_THRESH - 1)
+		    chunk = RF69_FIFO_SIZE - RF69_FIFO_THRESH - 1;
+		select();
+		spi_fast_shift(REG_FIFO | 0x80);
+		RF69_TRACE_SPI(REG_FIFO);
+		RF69_TRACE_FIFO(chunk);
+		while (chunk--)
+		    spi_fast_shift(((uint8_t*) buffer)[sent++]);
+		unselect();
+	}
+}
+
+// internal function: room for the header extension and the payload of a frame with the current settings
+uint8_t frameDataLen()
+{
+	if (readRegCached(REG_PACKETCONFIG2) & RF_PACKET2_AES_ON)
+	    return RF69_MAX_DATA_LEN;
+	return RF69_DATA_LEN;
+}
+
+// largest payload send() accepts with the current settings
+uint8_t maxDataLen()
+{
+#ifdef RF69_SEQ
+	return frameDataLen() - 1; // the sequence number goes in front of it
+#else
+	return frameDataLen();
+#endif
+}
+
+// non-blocking send: loads the FIFO, starts the transmitter and returns 1 right away
+// returns 0 without sending if a previous frame is still on air or the channel is busy, just try again later
+// on PacketSent the ISR puts the radio in RX if an ACK was requested (standby otherwise) and calls the send-done callback
+// leave the radio alone (setMode(), sleep(), setFrequency() ...) until sendDone() returns 1
+uint8_t sendAsync(uint8_t toAddress, const void* buffer, uint8_t bufferSize, uint8_t requestACK)
+{
+	if (!sendDone())
+		return 0;
+	if (mode != RF69_MODE_RX)
+		receiveBegin();
+	if (!canSend())
+		return 0;
+	updateReg(REG_PACKETCONFIG2, 0xFB, RF_PACKET2_RXRESTART); // avoid RX deadlocks
+	uint8_t sent = loadFrame(toAddress, buffer, bufferSize, requestACK, 0);
+	txAsync = 1;
+	txDoneMode = requestACK ? RF69_MODE_RX : RF69_MODE_STANDBY;
+	txStart = millis();
+	txBusy = 1;
 	setMode(RF69_MODE_TX);
-	millis_current = millis();
-	//_delay_ms(500);
-	// wait for DIO to high
-	// for PINE5
-	//PORTC |= 1<<PC6;
-	while (bit_is_clear(PINE, 5) && millis() - millis_current < RF69_TX_LIMIT_MS); // must change with interrupt pin change
-	//PORTC &= ~(1<<PC6); //temporary for testing
-	setMode(RF69_MODE_STANDBY);
+	writeFrameTail(buffer, sent, bufferSize); // frames longer than the FIFO return once their last byte is in
+	return 1;
+}
+
+// returns 1 when no frame is on air, i.e. the last sendAsync() has completed (or was given up on after RF69_TX_LIMIT_MS)
+uint8_t sendDone()
+{
+	pollInterrupt();
+	if (txBusy && millis() - txStart >= RF69_TX_LIMIT_MS)
+	{
+		txBusy = 0; // clear first so a late PacketSent is ignored by the ISR
+		setMode(RF69_MODE_STANDBY);
+	}
+	return !txBusy;
+}
+
+// callback fired from the interrupt handler when a frame started by sendAsync() has been sent, keep it short
+// pass 0 to remove it
+void setSendDoneCallback(void (*callback)(void))
+{
+	sendDoneHandler = callback;
 }
 
 void rcCalibration()
@@ -466,125 +1573,1810 @@ void rcCalibration()
 	while ((readReg(REG_OSC1) & RF_OSC1_RCCAL_DONE) == 0x00);
 }
 
+// retryWaitTime RF69_RTO_AUTO: the wait follows the round trips measured to toAddress, and doubles with every try that
+// goes unanswered. TXATTEMPTS and TXRTT tell how many frames it took and how long the ACK took after the last one
 uint8_t sendWithRetry(uint8_t toAddress, const void* buffer, uint8_t bufferSize, uint8_t retries, uint8_t retryWaitTime) {
+	RF69_TRACE_BEGIN(sendWithRetry);
+	uint8_t ctl = txCtl; // for every try, the ACKs sent meanwhile would use them up
+	txCtl = 0;
+	TXRTT = 0;
 	for (uint8_t i = 0; i <= retries; i++)
 	{
+		uint16_t wait = retryWaitTime ? retryWaitTime : rtoOf(findPeer(toAddress));
+		TXATTEMPTS = i + 1;
+#ifdef RF69_SEQ
+		txSeqRepeat = i > 0;
+#endif
+		txCtl = ctl;
 		send(toAddress, buffer, bufferSize, 1);
 	    millis_current = millis();
-	    while (millis() - millis_current < retryWaitTime)
+	    while (millis() - millis_current < wait)
 		{
 			if (ACKReceived(toAddress))
 			{
+				TXRTT = millis() - millis_current;
+				rf69_peer_t* peer = findPeer(toAddress); // only after the wait, see findPeer()
+#ifdef RF69_ATPC
+				if (ACK_RSSI)
+					atpcUpdate(peer, ACK_RSSI);
+#endif
+				if (i == 0)
+				{
+					rttSample(peer, TXRTT); // after a repeat it isn't clear which frame the ACK is for (Karn)
+					peer->backoff = 0;
+				}
+				RF69_TRACE_END(sendWithRetry);
 				return 1;
 			}
 		}
+		rf69_peer_t* peer = findPeer(toAddress);
+		if (rtoOf(peer) < RF69_RTO_MAX_MS)
+			peer->backoff++;
+#ifdef RF69_ATPC
+		atpcUpdate(peer, 0);
+#endif
 	}
+	RF69_TRACE_END(sendWithRetry);
 	return 0;
 }
 
-// should be polled immediately after sending a packet with ACK request
-uint8_t ACKReceived(uint8_t fromNodeID) {
-	if (receiveDone())
-		return (SENDERID == fromNodeID || fromNodeID == RF69_BROADCAST_ADDR) && ACK_RECEIVED;
-	return 0;
-}
-
-// checks if a packet was received and/or puts transceiver in receive (ie RX or listen) mode
-uint8_t receiveDone() {
-	cli();
-	if (mode == RF69_MODE_RX && PAYLOADLEN > 0)
-	{
-		setMode(RF69_MODE_STANDBY); // enables interrupts
-		return 1;
-	}
-	else if (mode == RF69_MODE_RX) // already in RX no payload yet
+// sends size bytes to toAddress, split in frames of maxDataLen() - 1 bytes, with up to RF69_ARQ_WINDOW frames in flight.
+// only the last frame of a window asks for an ACK. the ACK says which frames arrived, and only the missing ones go out again.
+// if no ACK comes, just that last frame goes out again to ask for it.
+// the receiving driver acknowledges and drops repeats by itself, the application there just calls receiveDone().
+// returns 1 once everything is acknowledged, 0 after retries waits of retryWaitTime ms in a row without progress.
+// with RF69_RTO_AUTO the waits follow the round trips sendWithRetry() measured, doubling while there is no progress.
+// fragment (sendMessage()): the frames carry message id txMsgId and their offset, for the receiver to put them together
+uint8_t sendWindowed(uint8_t toAddress, const void* buffer, uint16_t size, uint8_t retries, uint8_t retryWaitTime, uint8_t fragment)
+{
+	uint8_t chunk = maxDataLen() - (fragment ? 4 : 1);
+	uint16_t frames = size ? (size + chunk - 1) / chunk : fragment; // an empty message still takes a frame
+	rf69_peer_t* peer = findPeer(toAddress); // looked up again after every wait
+	uint8_t seq = peer->txSeq; // of the first frame
+	peer->txSeq = seq + frames;
+	uint16_t base = 0; // first frame not acknowledged
+	uint8_t acked = 0; // bit i: frame base + i acknowledged
+	uint8_t tries = 0;
+	uint8_t progress = 1;
+	while (base < frames)
 	{
-		sei(); // explicitly re-enable interrupts
-		return 0;
+		uint16_t last = base + RF69_ARQ_WINDOW < frames ? base + RF69_ARQ_WINDOW - 1 : frames - 1;
+		while (acked & 1 << (last - base))
+			last--;
+		for (uint16_t i = base; i <= last; i++)
+		{
+			if ((acked & 1 << (i - base)) || (!progress && i != last))
+				continue;
+			txCtl = RFM69_CTL_ARQ;
+			txExt[0] = seq + i;
+			txExtLen = 1;
+			if (fragment)
+			{
+				uint16_t offset = i * chunk;
+				txCtl |= RFM69_CTL_FRAG;
+				txExt[1] = txMsgId;
+				txExt[2] = offset;
+				txExt[3] = offset >> 8 | (i == frames - 1 ? 0x80 : 0);
+				txExtLen = 4;
+			}
+			send(toAddress, (const uint8_t*) buffer + i * chunk, i == frames - 1 ? size - i * chunk : chunk, i == last);
+		}
+		uint16_t wait = retryWaitTime;
+		if (wait == RF69_RTO_AUTO)
+		{
+			wait = rtoOf(findPeer(toAddress));
+			for (uint8_t i = 0; i < tries && wait < RF69_RTO_MAX_MS; i++)
+				wait <<= 1;
+		}
+		progress = 0;
+		millis_current = millis();
+		while (!progress && millis() - millis_current < wait)
+		{
+			if (!receiveDone() || SENDERID != toAddress || (CTLBYTE & (RFM69_CTL_SENDACK | RFM69_CTL_ARQ)) != (RFM69_CTL_SENDACK | RFM69_CTL_ARQ) || DATALEN < 2)
+				continue;
+#ifdef RF69_ATPC
+			if (ACK_RSSI)
+				atpcUpdate(findPeer(toAddress), ACK_RSSI);
+#endif
+			// DATA[0]: first frame the receiver is missing, DATA[1] bit i: frame DATA[0] + i arrived anyway
+			for (uint8_t i = 0; i < RF69_ARQ_WINDOW && base + i < frames; i++)
+			{
+				uint8_t d = (uint8_t) (seq + base + i) - DATA[0];
+				if ((d >= 128 || (d < 8 && (DATA[1] & 1 << d))) && !(acked & 1 << i))
+				{
+					acked |= 1 << i;
+					progress = 1;
+				}
+			}
+			while (acked & 1)
+			{
+				acked >>= 1;
+				base++;
+			}
+		}
+		if (progress)
+			tries = 0;
+		else if (tries++ == retries)
+			return 0;
+#ifdef RF69_ATPC
+		if (!progress)
+			atpcUpdate(findPeer(toAddress), 0);
+#endif
 	}
-	receiveBegin();
-	return 0;
-}
-
-// internal function
-void receiveBegin() {
-	DATALEN = 0;
-	SENDERID = 0;
-	TARGETID = 0;
-	PAYLOADLEN = 0;
-	ACK_REQUESTED = 0;
-	ACK_RECEIVED = 0;
-	RSSI = 0;
-	if (readReg(REG_IRQFLAGS2) & RF_IRQFLAGS2_PAYLOADREADY)
-	writeReg(REG_PACKETCONFIG2, (readReg(REG_PACKETCONFIG2) & 0xFB) | RF_PACKET2_RXRESTART); // avoid RX deadlocks
-	writeReg(REG_DIOMAPPING1, RF_DIOMAPPING1_DIO0_01); // set DIO0 to "PAYLOADREADY" in receive mode
-	setMode(RF69_MODE_RX);
+	return 1;
 }
 
-// true  = disable filtering to capture all frames on network
-// false = enable node/broadcast filtering to capture only frames sent to this/broadcast address
-void promiscuous(uint8_t onOff) {
-	promiscuousMode = onOff;
-	if(promiscuousMode==0)
-		writeReg(REG_PACKETCONFIG1, (readReg(REG_PACKETCONFIG1) & 0xF9) | RF_PACKET1_ADRSFILTERING_NODEBROADCAST);
-	else
-		writeReg(REG_PACKETCONFIG1, (readReg(REG_PACKETCONFIG1) & 0xF9) | RF_PACKET1_ADRSFILTERING_OFF);	
+#ifdef RF69_AGGREGATE
+// queues a message of up to maxDataLen() - 1 bytes for toAddress. queued messages go out together in one frame, each
+// with a length byte in front, once the next one doesn't fit, is for another node, or the frame reaches RF69_AGGR_LIMIT.
+// call pollAggregated() from the main loop to send them after RF69_AGGR_DEADLINE_MS at the latest.
+// returns 0 if the message is too long, or if a frame this sent wasn't acknowledged
+uint8_t sendAggregated(uint8_t toAddress, const void* buffer, uint8_t size)
+{
+	uint8_t room = maxDataLen() < RF69_AGGR_LIMIT ? maxDataLen() : RF69_AGGR_LIMIT;
+	uint8_t ok = 1;
+	if (size + 1 > maxDataLen())
+		return 0;
+	if (aggrLen && (toAddress != aggrTo || aggrLen + 1 + size > room))
+		ok = flushAggregated();
+	if (!aggrLen)
+	{
+		aggrTo = toAddress;
+		aggrSince = millis();
+	}
+	aggrBuf[aggrLen++] = size;
+	for (uint8_t i = 0; i < size; i++)
+		aggrBuf[aggrLen++] = ((const uint8_t*) buffer)[i];
+	if (aggrLen + 1 >= room) // not even an empty message would fit
+		ok &= flushAggregated();
+	return ok;
 }
 
-void maybeInterrupts()
+// sends what sendAggregated() queued now, returns 0 if the frame wasn't acknowledged
+uint8_t flushAggregated()
 {
-	// Only reenable interrupts if we're not being called from the ISR
-	if (!inISR) sei();
+	if (!aggrLen)
+		return 1;
+	uint8_t len = aggrLen;
+	aggrLen = 0; // the ACK waits call receiveDone(), the application may queue from there
+	txCtl = RFM69_CTL_AGGR;
+	if (RF69_AGGR_RETRIES && aggrTo != RF69_BROADCAST_ADDR)
+		return sendWithRetry(aggrTo, aggrBuf, len, RF69_AGGR_RETRIES, RF69_RTO_AUTO);
+	send(aggrTo, aggrBuf, len);
+	return 1;
 }
 
-void select()
+// sends what sendAggregated() queued if the first message has waited RF69_AGGR_DEADLINE_MS, returns like flushAggregated()
+uint8_t pollAggregated()
 {
-	SS_PORT &= ~(1<<SS_PIN);
-	cli();
+	if (aggrLen && millis() - aggrSince >= RF69_AGGR_DEADLINE_MS)
+		return flushAggregated();
+	return 1;
 }
+#endif
 
-void unselect()
+#ifdef RF69_COMPRESS
+// sendWithRetry() of a payload of up to maxDataLen() - 1 bytes, compressed: as LZ, or as the difference to the last
+// payload to toAddress if both are the same length and no longer than RF69_DELTA_MAX, whichever comes out shortest.
+// the receiver has to know the payload a delta is against: only acknowledged ones count, after a failure the next
+// payload goes out without. the receiving driver puts the payload back together, the application sees no difference.
+// takes RF69_DATA_LEN + RF69_DELTA_MAX bytes of stack for the frame, the LZ coding is written straight into it
+uint8_t sendCompressed(uint8_t toAddress, const void* buffer, uint8_t size, uint8_t retries, uint8_t retryWaitTime)
 {
-	SS_PORT |= 1<<SS_PIN;
-	maybeInterrupts();
+	uint8_t frame[RF69_DATA_LEN];
+	if (size + 1 > maxDataLen())
+		return 0;
+	uint8_t tag = (zTxTag + 1) & 0x0F;
+	uint8_t delta = zTxValid && zTxTo == toAddress && zTxLen == size && toAddress != RF69_BROADCAST_ADDR;
+	uint8_t len = compressFrame(frame, (const uint8_t*) buffer, size, tag, delta ? zTxRef : 0);
+	txCtl = RFM69_CTL_COMPRESSED;
+	zTxValid = 0;
+	if (!sendWithRetry(toAddress, frame, len, retries, retryWaitTime))
+		return 0;
+	zTxTag = tag;
+	if (size <= RF69_DELTA_MAX)
+	{
+		zTxTo = toAddress;
+		zTxLen = size;
+		for (uint8_t i = 0; i < size; i++)
+			zTxRef[i] = ((const uint8_t*) buffer)[i];
+		zTxValid = 1;
+	}
+	return 1;
 }
 
-ISR(INT_VECT) {
-	inISR = 1;
-	if (mode == RF69_MODE_RX && (readReg(REG_IRQFLAGS2) & RF_IRQFLAGS2_PAYLOADREADY))
+// internal function: writes the method / tag byte and the shortest coding of in[0..size) to out, returns its length.
+// ref: the payload to delta code against, size bytes, 0 for none
+uint8_t compressFrame(uint8_t* out, const uint8_t* in, uint8_t size, uint8_t tag, const uint8_t* ref)
+{
+	uint8_t delta[RF69_DELTA_MAX]; // only the short delta needs room of its own, LZ goes straight to out
+	uint8_t method = RF69_Z_STORED;
+	uint8_t len = size, n;
+	if (size > 1 && (n = packLz(out + 1, in, size, len - 1)) != 0)
 	{
-		setMode(RF69_MODE_STANDBY);
-		select();
-		spi_fast_shift(REG_FIFO & 0x7F);
-		PAYLOADLEN = spi_fast_shift(0);
-		if(PAYLOADLEN>66) PAYLOADLEN=66;
-		TARGETID = spi_fast_shift(0);
-		if(!(promiscuousMode || TARGETID == address || TARGETID == RF69_BROADCAST_ADDR) // match this node's address, or broadcast address or anything in promiscuous mode
-		|| PAYLOADLEN < 3) // address situation could receive packets that are malformed and don't fit this libraries extra fields
-		{
-			PAYLOADLEN = 0;
-			unselect();
-			receiveBegin();
-			return;
+		method = RF69_Z_LZ;
+		len = n;
+	}
+	// a delta as short as the LZ coding wins
+	if (size > 1 && ref && size <= RF69_DELTA_MAX
+	 && (n = packDelta(delta, in, ref, size, method == RF69_Z_LZ ? len : len - 1)) != 0)
+	{
+		method = RF69_Z_DELTA;
+		len = n;
+		for (uint8_t i = 0; i < len; i++)
+		{
+			RF69_Z_STEP(BYTE);
+			out[1 + i] = delta[i];
 		}
+	}
+	if (method == RF69_Z_STORED)
+		for (uint8_t i = 0; i < len; i++)
+		{
+			RF69_Z_STEP(BYTE);
+			out[1 + i] = in[i];
+		}
+	out[0] = method | tag;
+	return len + 1;
+}
 
-		DATALEN = PAYLOADLEN - 3;
-		SENDERID = spi_fast_shift(0);
-		uint8_t CTLbyte = spi_fast_shift(0);
-
-		ACK_RECEIVED = CTLbyte & RFM69_CTL_SENDACK; // extract ACK-received flag
-		ACK_REQUESTED = CTLbyte & RFM69_CTL_REQACK; // extract ACK-requested flag
-		
-		//interruptHook(CTLbyte);     // TWS: hook to derived class interrupt function
-
-		for (uint8_t i = 0; i < DATALEN; i++)
+// internal function: puts the payload in[0..len) from peer back together in out, returns its length, 0xFF if it can't.
+// peer 0: no room to keep it. a delta needs the payload before it, a repeat of the last one (its ACK got lost) is that payload again
+uint8_t decompressFrame(rf69_sender_t* peer, uint8_t* out, const uint8_t* in, uint8_t len)
+{
+	uint8_t size = 0xFF;
+	if (!len--)
+		return 0xFF;
+	uint8_t method = *in & 0xF0, tag = *in++ & 0x0F;
+	if (method == RF69_Z_STORED)
+	{
+		size = len;
+		for (uint8_t i = 0; i < len; i++)
 		{
-			DATA[i] = spi_fast_shift(0);
+			RF69_Z_STEP(BYTE);
+			out[i] = in[i];
 		}
-		if (DATALEN < RF69_MAX_DATA_LEN) DATA[DATALEN] = 0; // add null at end of string
-		unselect();
-		setMode(RF69_MODE_RX);
 	}
-	RSSI = readRSSI();
-	inISR = 0;
-}
+	else if (method == RF69_Z_LZ)
+		size = unpackLz(out, in, len, RF69_DATA_LEN);
+	else if (method == RF69_Z_DELTA && peer && (peer->flags & RF69_SENDER_ZREF))
+	{
+		if (tag == peer->zRxTag)
+		{
+			size = peer->zRxLen;
+			for (uint8_t i = 0; i < size; i++)
+			{
+				RF69_Z_STEP(BYTE);
+				out[i] = peer->zRxRef[i];
+			}
+		}
+		else if (tag == ((peer->zRxTag + 1) & 0x0F) && unpackDelta(out, in, len, peer->zRxRef, peer->zRxLen))
+			size = peer->zRxLen;
+	}
+	if (size == 0xFF || !peer)
+		return size;
+	peer->flags &= ~RF69_SENDER_ZREF;
+	if (size <= RF69_DELTA_MAX)
+	{
+		peer->flags |= RF69_SENDER_ZREF;
+		peer->zRxTag = tag;
+		peer->zRxLen = size;
+		for (uint8_t i = 0; i < size; i++)
+		{
+			RF69_Z_STEP(BYTE);
+			peer->zRxRef[i] = out[i];
+		}
+	}
+	return size;
+}
+
+// internal function: LZ codes in[0..size) to out, greedy with the longest match, returns the length or 0 if it
+// would take more than max bytes
+uint8_t packLz(uint8_t* out, const uint8_t* in, uint8_t size, uint8_t max)
+{
+	uint8_t o = 0, run = 0xFF; // run: where the token of the literal run being added to is
+	for (uint8_t i = 0; i < size;)
+	{
+		uint8_t best = 0, distance = 0;
+		for (uint8_t j = 0; j < i; j++)
+		{
+			uint8_t n = 0;
+			RF69_Z_STEP(POS);
+			while (i + n < size && n < 0x7F + 3 && in[j + n] == in[i + n])
+			{
+				RF69_Z_STEP(MATCH);
+				n++;
+			}
+			if (n > best)
+			{
+				best = n;
+				distance = i - j;
+			}
+		}
+		if (best >= 3)
+		{
+			RF69_Z_STEP(TOKEN);
+			if (o + 2 > max)
+				return 0;
+			out[o++] = 0x80 | (best - 3);
+			out[o++] = distance;
+			i += best;
+			run = 0xFF;
+			continue;
+		}
+		RF69_Z_STEP(BYTE);
+		if (run != 0xFF && out[run] < 0x7F)
+			out[run]++;
+		else
+		{
+			RF69_Z_STEP(TOKEN);
+			if (o + 1 > max)
+				return 0;
+			run = o;
+			out[o++] = 0;
+		}
+		if (o + 1 > max)
+			return 0;
+		out[o++] = in[i++];
+	}
+	return o;
+}
+
+// internal function: undoes packLz(), returns the length written to out or 0xFF if in is malformed or longer than max
+uint8_t unpackLz(uint8_t* out, const uint8_t* in, uint8_t len, uint8_t max)
+{
+	uint8_t o = 0;
+	for (uint8_t i = 0; i < len;)
+	{
+		uint8_t token = in[i++];
+		uint8_t n = (token & 0x7F) + (token & 0x80 ? 3 : 1);
+		RF69_Z_STEP(TOKEN);
+		if (o + n > max)
+			return 0xFF;
+		if (token & 0x80)
+		{
+			uint8_t distance = i < len ? in[i++] : 0;
+			if (!distance || distance > o)
+				return 0xFF;
+			for (; n; n--, o++)
+			{
+				RF69_Z_STEP(BYTE);
+				out[o] = out[o - distance];
+			}
+		}
+		else
+		{
+			if (n > len - i)
+				return 0xFF;
+			for (; n; n--)
+			{
+				RF69_Z_STEP(BYTE);
+				out[o++] = in[i++];
+			}
+		}
+	}
+	return o;
+}
+
+// internal function: codes the 16 bit words of in[0..size) minus those of ref as zigzag varints, an odd last byte is
+// a word of its own. returns the length or 0 if it would take more than max bytes
+uint8_t packDelta(uint8_t* out, const uint8_t* in, const uint8_t* ref, uint8_t size, uint8_t max)
+{
+	uint8_t o = 0;
+	for (uint8_t i = 0; i < size; i += 2)
+	{
+		RF69_Z_STEP(WORD);
+		uint16_t d = (in[i] | (i + 1 < size ? in[i + 1] << 8 : 0)) - (ref[i] | (i + 1 < size ? ref[i + 1] << 8 : 0));
+		uint16_t z = d << 1 ^ -(d >> 15); // small differences either way take one byte
+		do
+		{
+			if (o == max)
+				return 0;
+			out[o++] = (z & 0x7F) | (z > 0x7F ? 0x80 : 0);
+			z >>= 7;
+		} while (z);
+	}
+	return o;
+}
+
+// internal function: undoes packDelta() for a payload of size bytes, returns 0 if in[0..len) doesn't fit it
+uint8_t unpackDelta(uint8_t* out, const uint8_t* in, uint8_t len, const uint8_t* ref, uint8_t size)
+{
+	uint8_t o = 0;
+	for (uint8_t i = 0; i < size; i += 2)
+	{
+		RF69_Z_STEP(WORD);
+		uint16_t z = 0;
+		for (uint8_t shift = 0;; shift += 7)
+		{
+			if (o == len || shift > 14)
+				return 0;
+			z |= (uint16_t) (in[o] & 0x7F) << shift;
+			if (!(in[o++] & 0x80))
+				break;
+		}
+		uint16_t w = (ref[i] | (i + 1 < size ? ref[i + 1] << 8 : 0)) + (z >> 1 ^ -(z & 1));
+		out[i] = w;
+		if (i + 1 < size)
+			out[i + 1] = w >> 8;
+	}
+	return o == len;
+}
+#endif
+
+#ifdef RF69_TDMA
+// time division: the gateway sends a beacon every RF69_TDMA_SUPERFRAME_MS, RF69_TDMA_SLOTS slots of RF69_TDMA_SLOT_MS
+// each, the first one for the beacon. the beacon tells which node each of the other slots belongs to. a node sends
+// only in its own slot, without CSMA, or in one of the open ones, and keeps the radio asleep otherwise.
+// gatewayID: the node whose beacons set the schedule, this node's own id makes it the gateway. the gateway hands out
+// slots to the nodes it hears from and takes them back after RF69_TDMA_LEASE superframes without a frame from them
+void tdmaBegin(uint8_t gatewayID)
+{
+	tdmaGateway = gatewayID;
+	tdmaSynced = 0;
+	for (uint8_t s = 0; s < RF69_TDMA_SLOTS; s++)
+	{
+		tdmaOwner[s] = 0;
+		tdmaLease[s] = 0;
+	}
+	tdmaNext = millis();
+}
+
+void tdmaEnd()
+{
+	tdmaGateway = 0;
+}
+
+// gateway: sends the beacon when it is due. call it from the main loop, as often as receiveDone()
+void tdmaPoll()
+{
+	uint8_t beacon[RF69_TDMA_SLOTS];
+	if (!tdmaGateway || tdmaGateway != address || (long) (millis() - tdmaNext) < 0)
+		return;
+	beacon[0] = ++tdmaCounter;
+	for (uint8_t s = 1; s < RF69_TDMA_SLOTS; s++)
+	{
+		if (tdmaLease[s] && !--tdmaLease[s])
+			tdmaOwner[s] = 0; // silent for too long
+		beacon[s] = tdmaOwner[s];
+	}
+	tdmaNext += RF69_TDMA_SUPERFRAME_MS;
+	if ((long) (millis() - tdmaNext) >= 0)
+		tdmaNext = millis() + RF69_TDMA_SUPERFRAME_MS; // fell behind, start over from now
+	while (!sendDone());
+	txCtl = RFM69_CTL_REQACK; // with SENDACK: a beacon. it owns its slot, no CSMA
+	sendFrame(RF69_BROADCAST_ADDR, beacon, sizeof(beacon), 0, 1);
+	tdmaEpoch = millis(); // the nodes take the end of the frame too
+	tdmaSynced = 1;
+	receiveBegin();
+}
+
+// node: sendWithRetry() in this node's next slot, one try per superframe for up to retries + 1 superframes.
+// retryWaitTime is the ACK wait of each try, it has to end within the slot. waits for a beacon first if the
+// schedule is not from the current superframe. without tdmaBegin(): sendWithRetry()
+uint8_t tdmaSend(uint8_t toAddress, const void* buffer, uint8_t bufferSize, uint8_t retries, uint8_t retryWaitTime)
+{
+	if (!tdmaGateway || tdmaGateway == address)
+		return sendWithRetry(toAddress, buffer, bufferSize, retries, retryWaitTime);
+	for (uint8_t i = 0; i <= retries; i++)
+	{
+		uint8_t slot = tdmaNextSlot();
+		if (!slot && (!tdmaSync() || !(slot = tdmaNextSlot())))
+			continue;
+		tdmaWait(tdmaEpoch + (unsigned long) (slot - 1) * RF69_TDMA_SLOT_MS + RF69_TDMA_GUARD_MS);
+		tdmaOwnSlot = tdmaOwner[slot] == address;
+		uint8_t ok = sendWithRetry(toAddress, buffer, bufferSize, 0, retryWaitTime);
+		tdmaOwnSlot = 0;
+		sleep();
+		if (ok)
+			return 1;
+	}
+	return 0;
+}
+
+// internal function: the slot this node sends in next in the current superframe, its own or else a random open one.
+// 0: none left, or the schedule is older than the current superframe
+uint8_t tdmaNextSlot()
+{
+	uint8_t open = 0, pick = 0;
+	unsigned long elapsed = millis() - tdmaEpoch;
+	if (!tdmaSynced || elapsed >= (unsigned long) (RF69_TDMA_SLOTS - 1) * RF69_TDMA_SLOT_MS)
+		return 0;
+	for (uint8_t s = 1; s < RF69_TDMA_SLOTS; s++)
+		if (tdmaOwner[s] == address)
+			return (unsigned long) (s - 1) * RF69_TDMA_SLOT_MS >= elapsed ? s : 0;
+	for (uint8_t s = 1; s < RF69_TDMA_SLOTS; s++)
+		if (!tdmaOwner[s] && (unsigned long) (s - 1) * RF69_TDMA_SLOT_MS >= elapsed && random16() % ++open == 0)
+			pick = s;
+	return pick;
+}
+
+// internal function: waits for the next beacon, with the radio asleep until shortly before it is due if this node
+// knows the schedule. otherwise it listens for up to two superframes. returns 0 if no beacon came
+uint8_t tdmaSync()
+{
+	unsigned long window = 2 * RF69_TDMA_SUPERFRAME_MS;
+	if (tdmaSynced)
+	{
+		// the beacon ends RF69_TDMA_SUPERFRAME_MS after the last one, give or take ~120ppm of clock drift per side
+		unsigned long elapsed = millis() - tdmaEpoch;
+		unsigned long due = tdmaEpoch + (elapsed / RF69_TDMA_SUPERFRAME_MS + 1) * RF69_TDMA_SUPERFRAME_MS;
+		unsigned long margin = RF69_TDMA_GUARD_MS + (due - tdmaEpoch) / 4096;
+		tdmaWait(due - RF69_TDMA_SLOT_MS - margin);
+		window = RF69_TDMA_SLOT_MS + 2 * margin;
+	}
+	uint16_t beacons = tdmaBeacons;
+	unsigned long start = millis();
+	while (tdmaBeacons == beacons && millis() - start < window)
+	{
+		takeBeacons(); // frames for the application stay queued
+		if (tdmaBeacons == beacons)
+			mcuIdle(millis() + 1); // the beacon's timestamp is from the ISR, picking it up a tick later is fine
+	}
+	if (tdmaBeacons != beacons)
+		return 1;
+	tdmaMissed++;
+	tdmaSynced = 0;
+	sleep();
+	return 0;
+}
+
+// internal function: keeps the radio asleep until millis() reaches until
+void tdmaWait(unsigned long until)
+{
+	sleep();
+	mcuIdle(until);
+}
+
+// internal function, gateway: id sent a frame, it keeps its slot or gets a free one
+void tdmaHeard(uint8_t id)
+{
+	uint8_t free = 0;
+	if (!id || id == RF69_BROADCAST_ADDR)
+		return;
+	for (uint8_t s = 1; s < RF69_TDMA_SLOTS; s++)
+	{
+		if (tdmaOwner[s] == id)
+		{
+			tdmaLease[s] = RF69_TDMA_LEASE;
+			return;
+		}
+		if (!free && !tdmaOwner[s] && s < RF69_TDMA_SLOTS - RF69_TDMA_OPEN)
+			free = s;
+	}
+	if (free)
+	{
+		tdmaOwner[free] = id;
+		tdmaLease[free] = RF69_TDMA_LEASE;
+	}
+}
+#endif
+
+#ifdef RF69_FHSS
+// frequency hopping: the network moves over the RF69_FHSS_CHANNELS every dwellMs (RF69_FHSS_DWELL_MS if 0), in an
+// order shuffled from the network id, so a narrowband interferer only takes out the hops on its channel. the gateway
+// keeps the time and sends a beacon at the start of every dwell with the hop number and the blacklist.
+// gatewayID: the node whose beacons set the hops, this node's own id makes it the gateway.
+// nodes stay on the last beacon's timing and only listen when they send, see fhssSend()
+void fhssBegin(uint8_t gatewayID, uint16_t dwellMs)
+{
+	uint16_t x = (uint16_t) readRegCached(REG_SYNCVALUE2) << 8 | 0xA5; // never 0
+	for (uint8_t i = 0; i < RF69_FHSS_COUNT; i++)
+	{
+		fhssSeq[i] = i;
+		fhssSent[i] = 0;
+		fhssLost[i] = 0;
+		fhssAvoid[i] = 0;
+	}
+	for (uint8_t i = RF69_FHSS_COUNT - 1; i; i--) // Fisher-Yates
+	{
+		x = xorshift16(x);
+		uint8_t j = x % (i + 1), c = fhssSeq[i];
+		fhssSeq[i] = fhssSeq[j];
+		fhssSeq[j] = c;
+	}
+	for (uint8_t i = 0; i < RF69_FHSS_MAP_LEN; i++)
+		fhssBanned[i] = 0;
+	fhssGateway = gatewayID;
+	fhssDwell = dwellMs ? dwellMs : RF69_FHSS_DWELL_MS;
+	fhssSynced = gatewayID == address;
+	fhssTuned = 0xFF;
+	fhssScan = 0;
+	fhssHop = 0xFFFF; // the gateway's first fhssPoll() starts hop 0
+	fhssEpoch = millis() - fhssDwell;
+}
+
+// stays on the channel it is on
+void fhssEnd()
+{
+	fhssGateway = 0;
+}
+
+// call it from the main loop, as often as receiveDone(). the gateway moves to the next channel once the dwell is up
+// and sends the beacon there, without CSMA. a node follows the hops it knows of, so it can listen between sends
+void fhssPoll()
+{
+	uint8_t beacon[RF69_FHSS_BEACON_LEN];
+	if (!fhssGateway || !fhssSynced)
+		return;
+	if (fhssGateway != address)
+	{
+		fhssTune(fhssChannel(fhssNow()));
+		return;
+	}
+	unsigned long elapsed = millis() - fhssEpoch;
+	if (elapsed < fhssDwell)
+		return;
+	uint16_t hops = elapsed / fhssDwell;
+	fhssHop += hops;
+	fhssEpoch += (unsigned long) hops * fhssDwell;
+	while (!sendDone());
+	fhssTune(fhssChannel(fhssHop));
+	elapsed = millis() - fhssEpoch;
+	beacon[0] = fhssHop;
+	beacon[1] = fhssHop >> 8;
+	beacon[2] = fhssDwell;
+	beacon[3] = fhssDwell >> 8;
+	beacon[4] = elapsed < 0xFF ? elapsed : 0xFF;
+	for (uint8_t i = 0; i < RF69_FHSS_MAP_LEN; i++)
+		beacon[5 + i] = fhssBanned[i];
+	txCtl = RFM69_CTL_REQACK | RFM69_CTL_FRAG; // with SENDACK: a hop beacon
+	sendFrame(RF69_BROADCAST_ADDR, beacon, sizeof(beacon), 0, 1);
+	fhssHeard = millis();
+	receiveBegin();
+}
+
+// sendWithRetry() over the hops: one try per dwell, so every retry goes out on another channel. a node waits for
+// the beacon of the next dwell before each retry, and before the first try if it has none from the last
+// RF69_FHSS_HOLD_MS. it skips the channels it is avoiding for their packet error rate (fhssSent[], fhssLost[]).
+// a try starts where the rest of the dwell holds the frame and retryWaitTime. without fhssBegin(): sendWithRetry()
+uint8_t fhssSend(uint8_t toAddress, const void* buffer, uint8_t bufferSize, uint8_t retries, uint8_t retryWaitTime)
+{
+	if (!fhssGateway)
+		return sendWithRetry(toAddress, buffer, bufferSize, retries, retryWaitTime);
+	uint16_t need = (uint16_t) ((11ul + RF69_EXT_MAX + bufferSize) * byteAirUs() / 1000) + RF69_CSMA_CW_MIN * RF69_CSMA_SLOT_MS
+	              + (retryWaitTime ? retryWaitTime : rtoOf(findPeer(toAddress))) + 1;
+	uint16_t hop = 0;
+	for (uint8_t i = 0; i <= retries; i++)
+	{
+		if (fhssGateway != address && (i || !fhssSynced || millis() - fhssHeard >= RF69_FHSS_HOLD_MS) && !fhssSync())
+			continue;
+		hop = fhssWindow(need, !i, hop);
+		uint8_t channel = fhssChannel(hop);
+		fhssTune(channel);
+		uint8_t ok = sendWithRetry(toAddress, buffer, bufferSize, 0, retryWaitTime);
+		fhssResult(channel, ok);
+		if (ok)
+			return 1;
+	}
+	return 0;
+}
+
+// gateway: takes channel (0 for the first of RF69_FHSS_CHANNELS) out of the hops, or puts it back. the beacons tell
+// the nodes, its hops go to the other channels. 0 if that would leave none
+uint8_t fhssBlacklist(uint8_t channel, uint8_t onOff)
+{
+	uint8_t good = 0;
+	if (channel >= RF69_FHSS_COUNT)
+		return 0;
+	for (uint8_t c = 0; c < RF69_FHSS_COUNT; c++)
+		good += c != channel && !fhssIsBanned(c);
+	if (onOff && !good)
+		return 0;
+	if (onOff)
+		fhssBanned[channel >> 3] |= 1 << (channel & 7);
+	else
+		fhssBanned[channel >> 3] &= ~(1 << (channel & 7));
+	return 1;
+}
+
+// internal function: the channel of hop. a blacklisted one is replaced by one of the others, picked by the hop
+// number so the replacements move around as well
+uint8_t fhssChannel(uint16_t hop)
+{
+	uint8_t channel = fhssSeq[hop % RF69_FHSS_COUNT], good = 0;
+	if (!fhssIsBanned(channel))
+		return channel;
+	for (uint8_t i = 0; i < RF69_FHSS_COUNT; i++)
+		good += !fhssIsBanned(fhssSeq[i]);
+	if (!good)
+		return channel;
+	good = hop % good;
+	for (uint8_t i = 0; i < RF69_FHSS_COUNT; i++)
+		if (!fhssIsBanned(fhssSeq[i]) && !good--)
+			return fhssSeq[i];
+	return channel;
+}
+
+// internal function: channel is blacklisted
+uint8_t fhssIsBanned(uint8_t channel)
+{
+	return fhssBanned[channel >> 3] & 1 << (channel & 7);
+}
+
+// internal function: this node doesn't send on channel for now, it lost too many frames there
+uint8_t fhssAvoiding(uint8_t channel)
+{
+	return fhssAvoid[channel] && (long) (millis() - fhssAvoid[channel]) < 0;
+}
+
+// internal function: the hop it is now, by the last beacon's timing
+uint16_t fhssNow()
+{
+	return fhssHop + (uint16_t) ((millis() - fhssEpoch) / fhssDwell);
+}
+
+// internal function: puts the radio on channel, only writing the FRF bytes that change
+void fhssTune(uint8_t channel)
+{
+	if (channel == fhssTuned)
+		return;
+	setFrf(pgm_read_dword(&RF69_FHSS_FRF[channel]));
+	fhssTuned = channel;
+}
+
+// internal function, node: waits for the next beacon. if this node knows the timing it sleeps until shortly before
+// the next hop and listens on that hop's channel, otherwise it stays on one channel for as many dwells as there are
+// channels, plus one, and the next time on the next one. returns 0 if no beacon came
+uint8_t fhssSync()
+{
+	uint16_t beacons = fhssBeacons;
+	unsigned long window = (RF69_FHSS_COUNT + 1ul) * fhssDwell;
+	if (fhssSynced)
+	{
+		// ~120ppm of clock drift per side since the last beacon
+		uint16_t hop = fhssNow() + 1;
+		unsigned long due = fhssEpoch + (uint16_t) (hop - fhssHop) * (unsigned long) fhssDwell;
+		unsigned long margin = RF69_FHSS_GUARD_MS + (due - fhssHeard) / 4096;
+		sleep();
+		mcuIdle(due - margin);
+		fhssTune(fhssChannel(hop));
+		window = 3 * margin + (RF69_FHSS_BEACON_LEN + 11ul) * byteAirUs() / 1000 + 1;
+	}
+	else
+		fhssTune(fhssSeq[fhssScan++ % RF69_FHSS_COUNT]);
+	unsigned long start = millis();
+	while (fhssBeacons == beacons && millis() - start < window)
+	{
+		takeBeacons();
+		if (fhssBeacons == beacons)
+			mcuIdle(millis() + 1);
+	}
+	if (fhssBeacons != beacons)
+		return 1;
+	fhssMissed++;
+	if (millis() - fhssHeard >= RF69_FHSS_HOLD_MS)
+		fhssSynced = 0; // the next hop may just be jammed, but not every one for that long
+	sleep();
+	return 0;
+}
+
+// internal function: waits for the first dwell, after hop unless any, with need ms left for a try and returns its hop.
+// a node keeps its margin from both ends and sleeps meanwhile, the gateway keeps hopping. channels this node is
+// avoiding are skipped for two rounds of hops, then it takes what comes
+uint16_t fhssWindow(uint16_t need, uint8_t any, uint16_t after)
+{
+	uint8_t gateway = fhssGateway == address;
+	unsigned long margin = gateway ? 0 : RF69_FHSS_GUARD_MS + (millis() - fhssHeard) / 4096;
+	uint16_t hop = fhssNow();
+	for (uint8_t i = 0; i < 2 * RF69_FHSS_COUNT; i++, hop++)
+	{
+		unsigned long start = fhssEpoch + (uint16_t) (hop - fhssHop) * (unsigned long) fhssDwell + margin;
+		unsigned long from = (long) (millis() - start) > 0 ? millis() : start;
+		if ((!any && hop == after) || fhssAvoiding(fhssChannel(hop)) || (long) (start + fhssDwell - 2 * margin - need - from) < 0)
+			continue;
+		if (gateway)
+		{
+			while (fhssNow() != hop || (long) (millis() - from) < 0)
+			{
+				fhssPoll();
+				mcuIdle(millis() + 1);
+			}
+			fhssPoll();
+		}
+		else if ((long) (millis() - from) < 0)
+		{
+			sleep();
+			mcuIdle(from);
+		}
+		return hop;
+	}
+	if (gateway)
+		fhssPoll();
+	return fhssNow();
+}
+
+// internal function: counts a try on channel. a node that lost RF69_FHSS_PER_LIMIT percent of its frames there
+// avoids the channel for RF69_FHSS_AVOID_MS
+void fhssResult(uint8_t channel, uint8_t ok)
+{
+	if (fhssSent[channel] >= 32)
+	{
+		fhssSent[channel] >>= 1;
+		fhssLost[channel] >>= 1;
+	}
+	fhssSent[channel]++;
+	if (ok)
+		return;
+	fhssLost[channel]++;
+	if (fhssSent[channel] >= RF69_FHSS_PER_MIN && fhssLost[channel] * 100ul >= fhssSent[channel] * (unsigned long) RF69_FHSS_PER_LIMIT)
+		fhssAvoid[channel] = millis() + RF69_FHSS_AVOID_MS;
+}
+#endif
+
+#ifdef RF69_MESSAGES
+// sends a message of up to RF69_MSG_MAX (of the receiver) bytes to toAddress, like sendWindowed(). the receiving
+// driver puts it together: receiveDone() returns 1 once it is complete, with the message in MESSAGE and MESSAGELEN
+uint8_t sendMessage(uint8_t toAddress, const void* buffer, uint16_t size, uint8_t retries, uint8_t retryWaitTime)
+{
+	if (size > 0x7FFF)
+		return 0;
+	txMsgId++;
+	return sendWindowed(toAddress, buffer, size, retries, retryWaitTime, 1);
+}
+
+// internal function: the slot that message id from sender is put together in. claim: if there is none, take a free one,
+// one whose message timed out, or the one of an older message from the same sender (it has moved on)
+rf69_msg_t* msgFind(uint8_t sender, uint8_t id, uint8_t claim)
+{
+	rf69_msg_t* spare = 0;
+	for (uint8_t i = 0; i < RF69_MSG_SLOTS; i++)
+	{
+		rf69_msg_t* m = &msgPool[i];
+		if (m->state == RF69_MSG_BUSY && m->sender == sender && m->id == id)
+			return m;
+		if (claim && (m->state == RF69_MSG_FREE || (m->state == RF69_MSG_BUSY && (m->sender == sender
+		    || (uint16_t) ((uint16_t) irqTime - m->time) >= RF69_MSG_TIMEOUT_MS))))
+			spare = m;
+	}
+	if (spare)
+	{
+		spare->state = RF69_MSG_BUSY;
+		spare->sender = sender;
+		spare->id = id;
+		spare->size = 0xFFFF;
+		spare->received = 0;
+		for (uint8_t i = 0; i < sizeof(spare->have); i++)
+			spare->have[i] = 0;
+	}
+	return spare;
+}
+
+// internal function, from the ISR: 1 if the fragment (header frag, len bytes) has a slot to go to
+uint8_t msgClaim(uint8_t sender, volatile uint8_t* frag, uint8_t len)
+{
+	rf69_msg_t* m = msgFind(sender, frag[0], 1);
+	if (!m || (frag[1] | (frag[2] & 0x7F) << 8) + len > RF69_MSG_MAX)
+		return 0;
+	m->time = irqTime;
+	return 1;
+}
+
+// internal function: puts the fragment in DATA in its message, returns 1 once that is complete (MESSAGE, MESSAGELEN)
+uint8_t msgFragment(const uint8_t* frag)
+{
+	uint16_t offset = frag[1] | (frag[2] & 0x7F) << 8;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) // the ISR hands out the slots
+	{
+		rf69_msg_t* m = msgFind(SENDERID, frag[0], 0);
+		if (!m || offset + DATALEN > RF69_MSG_MAX)
+			return 0; // timed out and taken over meanwhile
+		for (uint8_t i = 0; i < DATALEN; i++)
+			m->data[offset + i] = DATA[i];
+		uint8_t bit = 1 << (offset / RF69_MSG_FRAG_MIN & 7);
+		if (!(m->have[offset / RF69_MSG_FRAG_MIN / 8] & bit)) // a repeat the ARQ window didn't catch only rewrites the same bytes
+		{
+			m->have[offset / RF69_MSG_FRAG_MIN / 8] |= bit;
+			m->received += DATALEN;
+		}
+		if (frag[2] & 0x80)
+			m->size = offset + DATALEN;
+		if (m->received < m->size)
+			return 0;
+		m->state = RF69_MSG_DONE;
+		msgDelivered = m;
+		MESSAGE = m->data;
+		MESSAGELEN = m->size;
+	}
+	return 1;
+}
+#endif
+
+// internal function, not from the ISR: the peers[] entry of node id, a new node takes over the entry that was handed
+// out longest ago. another node's lookup can take the entry over, so don't hold on to it across a receiveDone()
+rf69_peer_t* findPeer(uint8_t id)
+{
+	for (uint8_t i = 0; i < RF69_PEERS; i++)
+		if (peers[i].used && peers[i].id == id)
+			return &peers[i];
+	rf69_peer_t* peer = &peers[peerNext];
+	peerNext = (peerNext + 1) % RF69_PEERS;
+	*peer = rf69_peer_t();
+	peer->used = 1;
+	peer->id = id;
+	peer->txSeq = random16(); // the node may still hold the numbers of an earlier entry's frames
+	return peer;
+}
+
+// internal function: the senders[] entry of node id, a new node takes a free one. 0 if none is free, the frame then
+// can't be told from a repeat. the ISR never takes an entry over, so one looked up outside it stays put
+rf69_sender_t* findSender(uint8_t id)
+{
+	rf69_sender_t* spare = 0;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		for (uint8_t i = 0; i < RF69_SENDERS; i++)
+		{
+			if (senders[i].used && senders[i].id == id)
+			{
+				senders[i].heard = irqTime;
+				return &senders[i];
+			}
+			if (!senders[i].used)
+				spare = &senders[i];
+		}
+		if (spare)
+		{
+			*spare = rf69_sender_t();
+			spare->used = 1;
+			spare->id = id;
+			spare->heard = irqTime;
+		}
+	}
+	return spare;
+}
+
+// internal function, not from the ISR: frees the senders[] entry heard from longest ago if none is free
+void senderRoom()
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		rf69_sender_t* oldest = &senders[0];
+		for (uint8_t i = 0; i < RF69_SENDERS; i++)
+		{
+			if (!senders[i].used)
+				return;
+			if ((uint16_t) ((uint16_t) irqTime - senders[i].heard) > (uint16_t) ((uint16_t) irqTime - oldest->heard))
+				oldest = &senders[i];
+		}
+		oldest->used = 0;
+	}
+}
+
+// internal function, from the ISR: returns 0 if sendWindowed() frame seq from sender was received before, book: 1 if not
+// and it is taken, 0 to only check
+uint8_t arqAccept(uint8_t sender, uint8_t seq, uint8_t book)
+{
+	rf69_sender_t* peer = findSender(sender);
+	if (!peer)
+		return 1;
+	uint16_t now = irqTime;
+	uint8_t d = seq - peer->rxNext;
+	if (!(peer->flags & RF69_SENDER_ARQ) || (d >= RF69_ARQ_WINDOW && d < (uint8_t) -RF69_ARQ_WINDOW) // first frame from it, or the sender started over
+	    || (uint16_t) (now - peer->rxArqTime) >= RF69_ARQ_HOLD_MS) // or restarted with numbers close to the old ones
+	{
+		if (!book)
+			return 1;
+		peer->flags |= RF69_SENDER_ARQ;
+		peer->rxNext = seq;
+		peer->rxMask = 0;
+		d = 0;
+	}
+	else if (d >= RF69_ARQ_WINDOW || (peer->rxMask & 1 << d)) // before rxNext or already here
+		return 0;
+	if (!book)
+		return 1;
+	peer->rxArqTime = now;
+	peer->rxMask |= 1 << d;
+	while (peer->rxMask & 1)
+	{
+		peer->rxMask >>= 1;
+		peer->rxNext++;
+	}
+	return 1;
+}
+
+// internal function, from the ISR: returns 0 if the frame with RFM69_CTL_SEQ number seq from sender is a repeat,
+// book: like arqAccept()
+uint8_t seqAccept(uint8_t sender, uint8_t seq, uint8_t book)
+{
+	rf69_sender_t* peer = findSender(sender);
+	if (!peer)
+		return 1;
+	uint16_t now = irqTime;
+	uint8_t repeat = (peer->flags & RF69_SENDER_SEQ) && peer->rxSeq == seq && (uint16_t) (now - peer->rxSeqTime) < RF69_SEQ_HOLD_MS;
+	if (!book)
+		return !repeat;
+	peer->flags |= RF69_SENDER_SEQ;
+	peer->rxSeq = seq;
+	peer->rxSeqTime = now;
+	return !repeat;
+}
+
+// internal function: how long to wait for an ACK from peer, in ms
+uint16_t rtoOf(rf69_peer_t* peer)
+{
+	uint16_t rto = RF69_RTO_INIT_MS;
+	if (peer->flags & RF69_PEER_RTT)
+		rto = (peer->srtt8 >> 3) + peer->rttvar4;
+	if (rto < RF69_RTO_MIN_MS)
+		rto = RF69_RTO_MIN_MS;
+	for (uint8_t i = 0; i < peer->backoff && rto < RF69_RTO_MAX_MS; i++)
+		rto <<= 1;
+	return rto < RF69_RTO_MAX_MS ? rto : RF69_RTO_MAX_MS;
+}
+
+// internal function: folds an ACK round trip of rtt ms into the estimate for peer
+void rttSample(rf69_peer_t* peer, uint16_t rtt)
+{
+	if (rtt > RF69_RTO_MAX_MS)
+		rtt = RF69_RTO_MAX_MS;
+	if (!(peer->flags & RF69_PEER_RTT))
+	{
+		peer->flags |= RF69_PEER_RTT;
+		peer->srtt8 = rtt << 3;
+		peer->rttvar4 = rtt << 1; // rttvar = rtt / 2
+		return;
+	}
+	int16_t err = rtt - (peer->srtt8 >> 3);
+	peer->srtt8 += err; // srtt += err / 8
+	if (err < 0)
+		err = -err;
+	peer->rttvar4 += err - (peer->rttvar4 >> 2); // rttvar += (|err| - rttvar) / 4
+}
+
+#ifdef RF69_ATPC
+// internal function: moves the power level for peer towards RF69_ATPC_TARGET, given the RSSI its ACK reported.
+// rssi 0: no ACK came, half the way up to RF69_ATPC_MAX at once
+void atpcUpdate(rf69_peer_t* peer, int16_t rssi)
+{
+	int16_t level = peer->flags & RF69_PEER_POWER ? peer->txPower : RF69_ATPC_MAX;
+	if (!rssi)
+		level += (RF69_ATPC_MAX + 1 - level) / 2;
+	else if (rssi < RF69_ATPC_TARGET - RF69_ATPC_HYSTERESIS)
+		level += (RF69_ATPC_TARGET - rssi) << isRFM69HW; // make up for all of it, a level is 1dB (RFM69HW: 0.5dB)
+	else if (rssi > RF69_ATPC_TARGET + RF69_ATPC_HYSTERESIS)
+		level -= ((rssi - RF69_ATPC_TARGET) << isRFM69HW) / 2; // half of it per ACK, coming down is not urgent
+	if (level > RF69_ATPC_MAX)
+		level = RF69_ATPC_MAX;
+	if (level < RF69_ATPC_MIN)
+		level = RF69_ATPC_MIN;
+	peer->flags |= RF69_PEER_POWER;
+	peer->txPower = level;
+}
+#endif
+
+// internal function: header extension bytes a frame with this CTL byte carries, they come in this order
+uint8_t extLen(uint8_t ctl)
+{
+	uint8_t len = 0;
+	if ((ctl & (RFM69_CTL_SENDACK | RFM69_CTL_ARQ)) == RFM69_CTL_ARQ)
+		len++; // sendWindowed() sequence number
+	if (ctl & RFM69_CTL_SEQ)
+		len++; // sequence number
+	if ((ctl & (RFM69_CTL_SENDACK | RFM69_CTL_RSSI)) == (RFM69_CTL_SENDACK | RFM69_CTL_RSSI))
+		len++; // RSSI of the acknowledged frame
+	if ((ctl & (RFM69_CTL_SENDACK | RFM69_CTL_FRAG)) == RFM69_CTL_FRAG)
+		len += 3; // message id and offset
+	return len;
+}
+
+// internal function: xorshift (7, 9, 8), the next of x. never 0 unless x is
+uint16_t xorshift16(uint16_t x)
+{
+	x ^= x << 7;
+	x ^= x >> 9;
+	x ^= x << 8;
+	return x;
+}
+
+// internal function: for picking TDMA slots and CSMA backoffs
+uint16_t random16()
+{
+	return randomState = xorshift16(randomState);
+}
+
+// internal function: µs a byte takes on air at the current bitrate, 32MHz / BR per bit
+uint16_t byteAirUs()
+{
+	return ((uint16_t) readRegCached(REG_BITRATEMSB) << 8 | readRegCached(REG_BITRATELSB)) / 4;
+}
+
+// internal function: CSMA/CA in front of a frame. listens for 1 to RF69_CSMA_CW_MIN slots, picked at random so nodes
+// waiting for the same channel don't all go at once when it clears, then samples the RSSI once. every busy sample
+// doubles the window, up to RF69_CSMA_CW_MAX, and draws another backoff. the MCU sleeps in between instead of
+// polling the radio, see csmaBackoff(). after csmaTries busy samples, or RF69_CSMA_LIMIT_MS, the frame goes out anyway.
+// TXBACKOFF and TXBUSY tell how long it took
+void csmaWait()
+{
+	unsigned long start = millis();
+	uint16_t window = RF69_CSMA_CW_MIN;
+	TXBUSY = 0;
+	for (;;)
+	{
+		if (mode != RF69_MODE_RX) receiveBegin(); // listen without consuming queued frames
+		csmaBackoff(random16() % window + 1);
+		if (canSend())
+			break;
+		if (++TXBUSY >= csmaTries || millis() - start >= RF69_CSMA_LIMIT_MS)
+		{
+			csmaGiveUps++;
+			break;
+		}
+		if (window < RF69_CSMA_CW_MAX)
+			window <<= 1;
+	}
+	TXBACKOFF = millis() - start;
+}
+
+// dBm at or above which the channel counts as busy (CSMA_LIMIT to begin with), and how many busy samples a frame
+// waits for before it goes out anyway (RF69_CSMA_TRIES). at least 1
+void setCSMA(int8_t thresholdDbm, uint8_t tries)
+{
+	csmaThreshold = thresholdDbm;
+	csmaTries = tries ? tries : 1;
+}
+
+// internal function: sleeps the MCU in idle mode until millis() reaches until. Timer1 wakes it every millisecond,
+// DIO0 in between. the sleep mode the application set is back afterwards
+void mcuIdle(unsigned long until)
+{
+	uint8_t sleepMode = _SLEEP_CONTROL_REG & _SLEEP_MODE_MASK;
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	while ((long) (millis() - until) < 0)
+		sleep_mode();
+	set_sleep_mode(sleepMode);
+}
+
+// internal function: waits slots * RF69_CSMA_SLOT_MS from now. millis() only counts whole milliseconds, so the MCU
+// sleeps to the last millisecond boundary and spins on Timer1 for the fraction left, the first slot is a whole one too
+void csmaBackoff(uint16_t slots)
+{
+	unsigned long from;
+	uint16_t phase;
+	do
+	{
+		from = millis();
+		phase = TCNT1;
+	} while (from != millis()); // the millisecond ticked over in between
+	unsigned long until = from + (unsigned long) slots * RF69_CSMA_SLOT_MS;
+	mcuIdle(until);
+	while (millis() == until && TCNT1 < phase);
+}
+
+// internal function: tells toAddress which of its sendWindowed() frames arrived, rssi like sendACKTo()
+void sendArqAck(uint8_t toAddress, int16_t rssi)
+{
+	uint8_t ack[2];
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		rf69_sender_t* peer = findSender(toAddress);
+		if (!peer)
+			return; // no room to book its frames, it sends them again
+		ack[0] = peer->rxNext;
+		ack[1] = peer->rxMask;
+	}
+	txCtl = RFM69_CTL_ARQ;
+	sendACKTo(toAddress, ack, sizeof(ack), rssi);
+}
+
+// internal function, from the ISR: queues an ACK for receiveDone() to send. a node already waiting for one gets just
+// that one, updated. if the queue is full the ACK is dropped, the sender asks again
+void oweAck(uint8_t to, uint8_t arq, int16_t rssi)
+{
+	uint8_t i = ackOwedTail;
+	while (i != ackOwedHead && ackOwed[i & (RF69_ACK_OWED - 1)].to != to)
+		i++;
+	if (i == ackOwedHead && (uint8_t) (ackOwedHead - ackOwedTail) >= RF69_ACK_OWED)
+		return;
+	volatile rf69_ack_t* ack = &ackOwed[i & (RF69_ACK_OWED - 1)];
+	ack->to = to;
+	ack->arq = arq;
+	ack->rssi = rssi;
+	if (i == ackOwedHead)
+		ackOwedHead++;
+}
+
+// should be polled immediately after sending a packet with ACK request
+uint8_t ACKReceived(uint8_t fromNodeID) {
+	if (receiveDone())
+		return (SENDERID == fromNodeID || fromNodeID == RF69_BROADCAST_ADDR) && ACK_RECEIVED;
+	return 0;
+}
+
+// checks if a packet was received and/or puts transceiver in receive (ie RX or listen) mode
+// each call hands the oldest queued frame to DATA, DATALEN, SENDERID, TARGETID, PAYLOADLEN, ACK_* and RSSI
+uint8_t receiveDone() {
+	RF69_TRACE_BEGIN(receiveDone);
+	pollInterrupt();
+#ifdef RF69_MESSAGES
+	if (msgDelivered)
+	{
+		msgDelivered->state = RF69_MSG_FREE;
+		msgDelivered = 0;
+	}
+	MESSAGE = 0;
+	MESSAGELEN = 0;
+#endif
+	senderRoom();
+	while (ackOwedTail != ackOwedHead)
+	{
+		rf69_ack_t ack;
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) // the ISR may still update it
+		{
+			volatile rf69_ack_t* owed = &ackOwed[ackOwedTail & (RF69_ACK_OWED - 1)];
+			ack.to = owed->to;
+			ack.arq = owed->arq;
+			ack.rssi = owed->rssi;
+			ackOwedTail++;
+		}
+		if (ack.arq)
+			sendArqAck(ack.to, ack.rssi); // the sender missed the last ACK
+		else
+			sendACKTo(ack.to, "", 0, ack.rssi);
+	}
+	if (mode != RF69_MODE_RX && mode != RF69_MODE_LISTEN && !txBusy) // don't cut off a frame started by sendAsync()
+		receiveBegin();
+	if (rxHead == rxTail)
+	{
+		DATALEN = 0;
+		SENDERID = 0;
+		TARGETID = 0;
+		PAYLOADLEN = 0;
+		ACK_REQUESTED = 0;
+		ACK_RECEIVED = 0;
+		ACK_RSSI = 0;
+		RSSI = 0;
+		RF69_TRACE_END(receiveDone);
+		return 0;
+	}
+	volatile rf69_packet_t* packet = &rxQueue[rxTail & (RF69_RX_QUEUE_LEN - 1)];
+	if ((packet->ctl & RFM69_CTL_BEACON) == RFM69_CTL_BEACON)
+	{
+		takeBeacon(packet); // for the driver only, dropped on a node that doesn't follow that gateway
+		rxTail++;
+		DATALEN = 0;
+		ACK_REQUESTED = 0;
+		ACK_RECEIVED = 0;
+		RF69_TRACE_END(receiveDone);
+		return 0;
+	}
+#ifdef RF69_TDMA
+	if (tdmaGateway == address && !(packet->ctl & RFM69_CTL_SENDACK))
+		tdmaHeard(packet->senderID);
+#endif
+	uint8_t ext = extLen(packet->ctl);
+	uint8_t last = 1; // of the frame, then it goes back to the ISR
+	DATALEN = packet->dataLen - ext;
+	if ((packet->ctl & (RFM69_CTL_SENDACK | RFM69_CTL_AGGR)) == RFM69_CTL_AGGR)
+	{
+		// one message per call, the frame stays in the queue until the last one
+		if (!aggrRxPos)
+			aggrRxPos = ext;
+		uint8_t len = aggrRxPos < packet->dataLen ? packet->data[aggrRxPos++] : 0;
+		if (len > packet->dataLen - aggrRxPos)
+			len = packet->dataLen - aggrRxPos; // cut short
+		ext = aggrRxPos;
+		DATALEN = len;
+		aggrRxPos += len;
+		last = aggrRxPos >= packet->dataLen;
+		if (last)
+			aggrRxPos = 0;
+	}
+	SENDERID = packet->senderID;
+	TARGETID = packet->targetID;
+	PAYLOADLEN = packet->dataLen + 3;
+	CTLBYTE = packet->ctl;
+	// extract the ACK flags
+	ACK_RECEIVED = (packet->ctl & RFM69_CTL_SENDACK) != 0;
+	ACK_REQUESTED = last && (packet->ctl & RFM69_CTL_REQACK); // aggregated: with the last message
+	ACK_RSSI = 0;
+	if ((packet->ctl & (RFM69_CTL_SENDACK | RFM69_CTL_RSSI)) == (RFM69_CTL_SENDACK | RFM69_CTL_RSSI))
+		ACK_RSSI = (int8_t) packet->data[extLen(packet->ctl & ~RFM69_CTL_RSSI)]; // after the extension bytes before it
+	ARQSEQ = packet->data[0]; // only meaningful for sendWindowed() frames
+	RSSI = packet->rssi;
+#ifdef RF69_COMPRESS
+	if ((packet->ctl & (RFM69_CTL_SENDACK | RFM69_CTL_AGGR | RFM69_CTL_COMPRESSED)) == RFM69_CTL_COMPRESSED)
+	{
+		// the slot isn't the ISR's until rxTail moves on
+		DATALEN = decompressFrame(findSender(SENDERID), (uint8_t*) DATA, (const uint8_t*) packet->data + ext, DATALEN);
+		if (DATALEN == 0xFF)
+		{
+			rxUndecodable++;
+			rxTail++; // not acknowledged, the sender sends the next payload whole
+			DATALEN = 0;
+			DATA[0] = 0;
+			ACK_REQUESTED = 0;
+			RF69_TRACE_END(receiveDone);
+			return 0;
+		}
+	}
+	else
+#endif
+	for (uint8_t i = 0; i < DATALEN; i++)
+		DATA[i] = packet->data[ext + i];
+	if (DATALEN < RF69_DATA_LEN) DATA[DATALEN] = 0; // add null at end of string
+#ifdef RF69_MESSAGES
+	uint8_t frag[3];
+	uint8_t fragment = (packet->ctl & (RFM69_CTL_SENDACK | RFM69_CTL_FRAG)) == RFM69_CTL_FRAG;
+	for (uint8_t i = 0; fragment && i < 3; i++)
+		frag[i] = packet->data[extLen(packet->ctl & ~RFM69_CTL_FRAG) + i];
+#endif
+	if (last)
+		rxTail++; // hand the slot back to the ISR only after it has been copied out
+	if ((packet->ctl & (RFM69_CTL_SENDACK | RFM69_CTL_ARQ)) == RFM69_CTL_ARQ && ACK_REQUESTED)
+	{
+		ACK_REQUESTED = 0; // sendWindowed() frames are acknowledged by the driver
+		sendArqAck(SENDERID, (CTLBYTE & RFM69_CTL_RSSI) ? RSSI : 0);
+	}
+#ifdef RF69_MESSAGES
+	if (fragment)
+	{
+		uint8_t complete = msgFragment(frag);
+		DATALEN = 0; // the application only gets to see whole messages
+		DATA[0] = 0;
+		RF69_TRACE_END(receiveDone);
+		return complete;
+	}
+#endif
+	RF69_TRACE_END(receiveDone);
+	return 1;
+}
+
+// internal function: a TDMA or FHSS beacon out of the receive queue. the schedule or the hop timing is taken from it
+// if it comes from the gateway this node follows
+void takeBeacon(volatile rf69_packet_t* packet)
+{
+#ifdef RF69_TDMA
+	if (tdmaGateway && tdmaGateway != address && packet->senderID == tdmaGateway
+	 && (packet->ctl & RFM69_CTL_HOP) == RFM69_CTL_BEACON && packet->dataLen == RF69_TDMA_SLOTS)
+	{
+		tdmaEpoch = packet->timestamp;
+		for (uint8_t s = 0; s < RF69_TDMA_SLOTS; s++)
+			tdmaOwner[s] = packet->data[s];
+		tdmaSynced = 1;
+		tdmaBeacons++;
+	}
+#endif
+#ifdef RF69_FHSS
+	if (fhssGateway && fhssGateway != address && packet->senderID == fhssGateway
+	 && (packet->ctl & RFM69_CTL_HOP) == RFM69_CTL_HOP && packet->dataLen == RF69_FHSS_BEACON_LEN
+	 && (packet->data[2] | packet->data[3]))
+	{
+		uint32_t air = (11ul + RF69_FHSS_BEACON_LEN) * byteAirUs(); // preamble, sync, header, CRC and the beacon
+		fhssHop = packet->data[0] | (uint16_t) packet->data[1] << 8;
+		fhssDwell = packet->data[2] | (uint16_t) packet->data[3] << 8;
+		fhssEpoch = packet->timestamp - (air + 500) / 1000 - packet->data[4];
+		fhssHeard = packet->timestamp;
+		for (uint8_t i = 0; i < RF69_FHSS_MAP_LEN; i++)
+			fhssBanned[i] = packet->data[5 + i];
+		fhssSynced = 1;
+		fhssBeacons++;
+	}
+#endif
+}
+
+#if defined(RF69_TDMA) || defined(RF69_FHSS)
+// internal function: listens and takes the beacons out of the receive queue, like receiveDone() would. the frames in
+// between stay queued for the application, a beacon behind them stays there too, spent (no payload)
+void takeBeacons()
+{
+	pollInterrupt();
+	if (mode != RF69_MODE_RX && mode != RF69_MODE_LISTEN && !txBusy)
+		receiveBegin();
+	for (uint8_t i = rxTail; i != rxHead; i++)
+	{
+		volatile rf69_packet_t* packet = &rxQueue[i & (RF69_RX_QUEUE_LEN - 1)];
+		if ((packet->ctl & RFM69_CTL_BEACON) == RFM69_CTL_BEACON && packet->dataLen)
+		{
+			takeBeacon(packet);
+			packet->dataLen = 0;
+		}
+	}
+}
+#endif
+
+// number of received frames waiting in the queue
+uint8_t rxQueueCount() {
+	return (uint8_t) (rxHead - rxTail);
+}
+
+// internal function
+void receiveBegin() {
+	if (readReg(REG_IRQFLAGS2) & RF_IRQFLAGS2_PAYLOADREADY)
+	updateReg(REG_PACKETCONFIG2, 0xFB, RF_PACKET2_RXRESTART); // avoid RX deadlocks
+	writeReg(REG_DIOMAPPING1, RF69_DIO0_RX); // set DIO0 to "PAYLOADREADY" (or "SYNCADDRESS" for large packets) in receive mode
+#ifdef RF69_LARGE_PACKETS
+	rxFrameLen = 0;
+#endif
+	setMode(RF69_MODE_RX);
+}
+
+// true  = disable filtering to capture all frames on network
+// false = enable node/broadcast filtering to capture only frames sent to this/broadcast address
+void promiscuous(uint8_t onOff) {
+	promiscuousMode = onOff;
+	if(promiscuousMode==0)
+		updateReg(REG_PACKETCONFIG1, 0xF9, RF_PACKET1_ADRSFILTERING_NODEBROADCAST);
+	else
+		updateReg(REG_PACKETCONFIG1, 0xF9, RF_PACKET1_ADRSFILTERING_OFF);	
+}
+
+void maybeInterrupts()
+{
+	// Only reenable interrupts if we're not being called from the ISR
+	if (!inISR)
+	{
+		irqOffDone();
+		sei();
+	}
+}
+
+void select()
+{
+	SS_PORT &= ~(1<<SS_PIN);
+	cli();
+	if (!inISR) irqOffStart = TCNT1;
+	RF69_TRACE_SELECT();
+}
+
+// internal function, called with interrupts still off: updates irqOffMax with the time since irqOffStart
+void irqOffDone()
+{
+	uint16_t now = TCNT1;
+	uint16_t ticks = now - irqOffStart;
+	if (now < irqOffStart)
+		ticks += (uint16_t) CTC_MATCH_OVERFLOW + 1; // Timer1 restarted at a millisecond boundary
+	if (ticks > irqOffMax)
+		irqOffMax = ticks;
+}
+
+#ifdef RF69_TRACE
+// internal function, called with interrupts off: books the time since select() on rf69Trace.spiTicks
+void traceUnselect()
+{
+	uint16_t now = TCNT1;
+	uint16_t ticks = now - traceSelectStart;
+	if (now < traceSelectStart)
+		ticks += (uint16_t) CTC_MATCH_OVERFLOW + 1;
+	rf69Trace.spiTicks += ticks;
+}
+
+// internal function: Timer1 ticks since millis_init(), wraps after about an hour at 8MHz
+uint32_t traceTicks()
+{
+	unsigned long ms;
+	uint16_t ticks;
+	do
+	{
+		ms = timer1_millis;
+		ticks = TCNT1;
+	} while (ms != timer1_millis); // the millisecond ticked over in between
+	return ms * ((uint16_t) CTC_MATCH_OVERFLOW + 1) + ticks;
+}
+
+// internal function: books the time since start (a traceTicks() value) on timing
+void traceAdd(rf69_timing_t* timing, uint32_t start)
+{
+	uint32_t ticks = traceTicks() - start;
+	if ((int32_t) ticks < 0)
+		ticks = 0; // called with interrupts off across a millisecond boundary, the clock went back
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) // interruptHandler() may book on the same timing
+	{
+		timing->calls++;
+		timing->ticks += ticks;
+		if (ticks > timing->maxTicks)
+			timing->maxTicks = ticks;
+	}
+}
+
+// clears rf69Trace, e.g. after it has been dumped
+void traceReset()
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		uint8_t* p = (uint8_t*) &rf69Trace;
+		for (uint16_t i = 0; i < sizeof(rf69Trace); i++)
+			p[i] = 0;
+	}
+}
+#endif
+
+void unselect()
+{
+	SS_PORT |= 1<<SS_PIN;
+	RF69_TRACE_UNSELECT();
+	maybeInterrupts();
+}
+
+// top half: only latches the event and masks INTn, then runs interruptHandler() with interrupts back on
+// (or leaves it to the main loop with RF69_RX_POLLED), so other ISRs never wait longer than one SPI burst
+ISR(INT_VECT) {
+	inISR = 1;
+	irqOffStart = TCNT1;
+	EIMSK &= ~(1<<INTn); // a DIO0 edge meanwhile stays latched in EIFR and fires once INTn is unmasked
+	irqTime = timer1_millis;
+	rxPending = 1;
+	irqOffDone();
+	inISR = 0;
+#ifndef RF69_RX_POLLED
+	sei();
+	interruptHandler();
+	cli();
+	EIMSK |= 1<<INTn; // with interrupts off, so a pending edge runs after reti instead of nesting in here
+#endif
+}
+
+#ifdef RF69_RX_POLLED
+// runs the bottom half left by the ISR, from receiveDone(), sendDone() and the send() wait loop
+void pollInterrupt()
+{
+	if (!rxPending)
+		return;
+	interruptHandler();
+	ATOMIC_BLOCK(ATOMIC_FORCEON)
+	{
+		EIMSK |= 1<<INTn;
+	}
+}
+#else
+void pollInterrupt()
+{
+	// interruptHandler() already ran from the ISR
+}
+#endif
+
+// internal function: bottom half, deals with whatever made DIO0 rise. interrupts are on except during SPI bursts
+void interruptHandler() {
+	RF69_TRACE_BEGIN(interruptHandler);
+	rxPending = 0;
+	if (mode == RF69_MODE_TX)
+	{
+		if (txBusy && (readReg(REG_IRQFLAGS2) & RF_IRQFLAGS2_PACKETSENT))
+		{
+			if (txDoneMode == RF69_MODE_RX)
+				receiveBegin(); // an ACK is on its way, listen for it straight away
+			else
+				setMode(RF69_MODE_STANDBY);
+			txBusy = 0;
+			if (txAsync && sendDoneHandler) sendDoneHandler();
+		}
+	}
+	else if (mode == RF69_MODE_LISTEN)
+	{
+		// woken by a frame while duty cycling, the next RX period would wipe the FIFO so read it now
+		uint8_t flags = readReg(REG_IRQFLAGS2);
+		if (flags & RF_IRQFLAGS2_PAYLOADREADY)
+		{
+			int16_t rssi = readRSSI();
+			select();
+			spi_fast_shift(REG_FIFO & 0x7F);
+			RF69_TRACE_SPI(REG_FIFO);
+			uint8_t payloadLen = spi_fast_shift(0);
+			RF69_TRACE_FIFO(1);
+#ifdef RF69_LARGE_PACKETS
+			fifoError = !(flags & RF_IRQFLAGS2_CRCOK) || payloadLen >= RF69_FIFO_SIZE; // nothing streams the FIFO while listening
+#endif
+			if (payloadLen > RF69_FIFO_SIZE - 1) payloadLen = RF69_FIFO_SIZE - 1; // as in RX mode
+#ifdef RF69_LARGE_PACKETS
+			fifoAvail = fifoRemaining = payloadLen;
+#endif
+			readFrame(payloadLen, rssi);
+			listenWoken();
+		}
+	}
+#ifdef RF69_LARGE_PACKETS
+	else if (mode == RF69_MODE_RX && rxFrameLen == 0)
+	{
+		// DIO0 is SyncAddress: a frame is coming in, grab the length byte as soon as it lands
+		rxRssi = readRSSI();
+		if (waitRxByte())
+		{
+			rxFrameLen = readReg(REG_FIFO);
+			RF69_TRACE_FIFO(1);
+			// the address byte only lands if the radio's address filter let the frame through. if it didn't,
+			// no PayloadReady is coming and DIO0 has to stay on SyncAddress for the next frame
+			if (waitRxByte())
+			{
+				if (rxFrameLen < RF69_FIFO_SIZE)
+				{
+					writeReg(REG_DIOMAPPING1, RF_DIOMAPPING1_DIO0_01); // fits in the FIFO: finish it on PayloadReady like a normal frame
+					RF69_TRACE_END(interruptHandler);
+					return;
+				}
+				fifoAvail = 0; // longer than the FIFO: drain it while it is still coming in
+				fifoRemaining = rxFrameLen;
+				fifoError = 0;
+				select();
+				spi_fast_shift(REG_FIFO & 0x7F);
+				RF69_TRACE_SPI(REG_FIFO);
+				readFrame(rxFrameLen, rxRssi);
+			}
+		}
+		rxFrameLen = 0;
+	}
+	else if (mode == RF69_MODE_RX && ((irqFlags2 = readReg(REG_IRQFLAGS2)) & RF_IRQFLAGS2_PAYLOADREADY))
+	{
+		fifoAvail = fifoRemaining = rxFrameLen; // the length byte is already out, the rest is all in the FIFO
+		fifoError = !(irqFlags2 & RF_IRQFLAGS2_CRCOK); // CrcAutoClear is off in this mode, CrcOk goes away with the FIFO
+		select();
+		spi_fast_shift(REG_FIFO & 0x7F);
+		RF69_TRACE_SPI(REG_FIFO);
+		readFrame(rxFrameLen, rxRssi);
+		rxFrameLen = 0;
+		writeReg(REG_DIOMAPPING1, RF69_DIO0_RX); // back to waiting for a sync word
+	}
+#else
+	else if (mode == RF69_MODE_RX && (readReg(REG_IRQFLAGS2) & RF_IRQFLAGS2_PAYLOADREADY))
+	{
+		// the receiver is left running: with AutoRxRestart on it re-arms by itself once the FIFO is empty,
+		// so frames that arrive before the main loop gets around to receiveDone() are queued, not lost
+		int16_t rssi = readRSSI(); // still the level of the frame that was just received
+		select();
+		spi_fast_shift(REG_FIFO & 0x7F);
+		RF69_TRACE_SPI(REG_FIFO);
+		uint8_t payloadLen = spi_fast_shift(0);
+		RF69_TRACE_FIFO(1);
+		if (payloadLen > RF69_FIFO_SIZE - 1) payloadLen = RF69_FIFO_SIZE - 1; // all the FIFO can hold after the length byte
+		readFrame(payloadLen, rssi);
+	}
+#endif
+	RF69_TRACE_END(interruptHandler);
+}
+
+// internal function, called from interruptHandler() with the FIFO selected and its length byte already read.
+// queues the frame (or drops it) and leaves the FIFO empty and unselected so the receiver restarts
+void readFrame(uint8_t payloadLen, int16_t rssi)
+{
+	fifoBurst = RF69_RX_BURST - 1; // the length byte went out in this burst
+	uint8_t targetID = readFifoByte();
+	uint8_t remaining = payloadLen > 1 ? payloadLen - 1 : 0; // FIFO bytes left after target id
+	uint8_t queued = 0;
+	volatile rf69_packet_t* packet = &rxQueue[rxHead & (RF69_RX_QUEUE_LEN - 1)];
+	uint8_t foreign = targetID != address && targetID != RF69_BROADCAST_ADDR;
+	rxWakeups++;
+	if (foreign)
+		rxForeign++;
+	if ((foreign && !promiscuousMode) // normally caught by the radio's address filter, kept as a safety net
+	|| payloadLen < 3 // address situation could receive packets that are malformed and don't fit this libraries extra fields
+	|| payloadLen - 3 > frameDataLen()) // longer than any frame this driver sends, whichever way it came in
+	{
+		rxRejected++;
+	}
+	else if ((uint8_t) (rxHead - rxTail) >= RF69_RX_QUEUE_LEN)
+	{
+		rxDropped++;
+	}
+	else
+	{
+		uint8_t dataLen = payloadLen - 3;
+		packet->targetID = targetID;
+		packet->senderID = readFifoByte();
+		packet->ctl = readFifoByte();
+		//interruptHook(CTLbyte);     // TWS: hook to derived class interrupt function
+		for (uint8_t i = 0; i < dataLen; i++)
+			packet->data[i] = readFifoByte();
+		packet->dataLen = dataLen;
+		packet->rssi = rssi;
+		packet->timestamp = irqTime; // when DIO0 rose, not when the bottom half got around to it
+		remaining -= dataLen + 2;
+		queued = 1;
+	}
+	while (remaining--) readFifoByte(); // drain what is left so the receiver restarts
+	unselect();
+#ifdef RF69_LARGE_PACKETS
+	if (queued && fifoError)
+	{
+		queued = 0;
+		rxRejected++;
+	}
+#endif
+	if (queued)
+	{
+		uint8_t ctl = packet->ctl;
+		uint8_t arq = (ctl & (RFM69_CTL_SENDACK | RFM69_CTL_ARQ)) == RFM69_CTL_ARQ;
+		if (packet->dataLen < extLen(ctl))
+		{
+			queued = 0; // header extension cut short
+			rxRejected++;
+		}
+		else if ((arq && !arqAccept(packet->senderID, packet->data[0], 0))
+		      || ((ctl & RFM69_CTL_SEQ) && !seqAccept(packet->senderID, packet->data[arq], 0)))
+		{
+			queued = 0;
+			rxDuplicates++;
+			if (ctl & RFM69_CTL_REQACK)
+				oweAck(packet->senderID, arq, (ctl & (RFM69_CTL_SENDACK | RFM69_CTL_RSSI)) == RFM69_CTL_RSSI ? rssi : 0);
+		}
+#ifdef RF69_MESSAGES
+		else if ((ctl & (RFM69_CTL_SENDACK | RFM69_CTL_FRAG)) == RFM69_CTL_FRAG
+		      && !msgClaim(packet->senderID, &packet->data[extLen(ctl & ~RFM69_CTL_FRAG)], packet->dataLen - extLen(ctl)))
+		{
+			queued = 0; // nowhere to put it together. not acknowledged or booked either, the sender tries again later
+			rxDropped++;
+		}
+#endif
+		else
+		{
+			if (arq)
+				arqAccept(packet->senderID, packet->data[0], 1);
+			if (ctl & RFM69_CTL_SEQ)
+				seqAccept(packet->senderID, packet->data[arq], 1);
+		}
+	}
+	if (queued)
+		rxHead++; // publish the slot only once it is complete
+}
+
+// internal function: polls IRQFLAGS2 until flag is set (set=1) or cleared (set=0), returns 0 if that never happens
+uint8_t waitIrqFlags2(uint8_t flag, uint8_t set)
+{
+	for (uint16_t i = 0; i < RF69_FIFO_SPIN_LIMIT; i++)
+	{
+		uint8_t flags = readReg(REG_IRQFLAGS2);
+		if (((flags & flag) != 0) == set)
+		{
+#ifdef RF69_LARGE_PACKETS
+			irqFlags2 = flags;
+#endif
+			return 1;
+		}
+	}
+	return 0;
+}
+
+#ifdef RF69_LARGE_PACKETS
+// internal function: waits for the next byte of the frame the radio locked onto. 0 if the radio dropped the frame
+// instead (its length or address didn't pass the filter), that clears the FIFO and SyncAddressMatch
+uint8_t waitRxByte()
+{
+	for (uint16_t i = 0; i < RF69_FIFO_SPIN_LIMIT; i++)
+	{
+		if (readReg(REG_IRQFLAGS2) & RF_IRQFLAGS2_FIFONOTEMPTY)
+			return 1;
+		if (!(readReg(REG_IRQFLAGS1) & RF_IRQFLAGS1_SYNCADDRESSMATCH))
+			return 0;
+	}
+	return 0;
+}
+#endif
+
+// internal function: next byte of the frame readFrame() is reading, called with the FIFO selected.
+// every RF69_RX_BURST bytes it lets go of the chip select for a moment, so other ISRs get their turn during long frames.
+// in large packet mode it also waits for FifoLevel (or PayloadReady for the tail) whenever the FIFO runs dry
+uint8_t readFifoByte()
+{
+#ifdef RF69_LARGE_PACKETS
+	if (fifoAvail == 0)
+	{
+		unselect();
+		if (fifoRemaining > RF69_FIFO_THRESH + 1)
+		{
+			fifoAvail = RF69_FIFO_THRESH + 1;
+			fifoError |= !waitIrqFlags2(RF_IRQFLAGS2_FIFOLEVEL, 1);
+		}
+		else
+		{
+			fifoAvail = fifoRemaining;
+			fifoError |= !waitIrqFlags2(RF_IRQFLAGS2_PAYLOADREADY, 1) || !(irqFlags2 & RF_IRQFLAGS2_CRCOK);
+		}
+		select();
+		spi_fast_shift(REG_FIFO & 0x7F);
+		RF69_TRACE_SPI(REG_FIFO);
+		fifoBurst = RF69_RX_BURST;
+	}
+	fifoAvail--;
+	fifoRemaining--;
+#endif
+	if (fifoBurst == 0)
+	{
+		unselect();
+		select();
+		spi_fast_shift(REG_FIFO & 0x7F); // reading carries on where it left off
+		RF69_TRACE_SPI(REG_FIFO);
+		fifoBurst = RF69_RX_BURST;
+	}
+	fifoBurst--;
+	RF69_TRACE_FIFO(1);
+	return spi_fast_shift(0);
+}
+
@@ -0,0 +1,150 @@
+// host simulator: AES-128 (FIPS-197) and the packet handler CRC, see aes.h
+#include "aes.h"
+#include <string.h>
+
+namespace sim {
+
+static uint8_t sbox[256], invSbox[256];
+
+static uint8_t xtime(uint8_t x)
+{
+	return (uint8_t) ((x << 1) ^ ((x & 0x80) ? 0x1B : 0));
+}
+
+static uint8_t mul(uint8_t a, uint8_t b)
+{
+	uint8_t r = 0;
+	while (b)
+	{
+		if (b & 1) r ^= a;
+		a = xtime(a);
+		b >>= 1;
+	}
+	return r;
+}
+
+// builds the S-boxes from the GF(2^8) inverse and the affine transform, once
+static void initTables()
+{
+	if (sbox[0] == 0x63)
+		return;
+	for (int i = 0; i < 256; i++)
+	{
+		uint8_t inv = 0;
+		for (int j = 1; j < 256 && i; j++)
+			if (mul((uint8_t) i, (uint8_t) j) == 1) { inv = (uint8_t) j; break; }
+		uint8_t s = inv;
+		for (int k = 1; k < 5; k++)
+			s ^= (uint8_t) ((inv << k) | (inv >> (8 - k)));
+		s ^= 0x63;
+		sbox[i] = s;
+		invSbox[s] = (uint8_t) i;
+	}
+}
+
+static void expandKey(const uint8_t key[16], uint8_t roundKeys[176])
+{
+	memcpy(roundKeys, key, 16);
+	uint8_t rcon = 1;
+	for (int i = 16; i < 176; i += 4)
+	{
+		uint8_t t[4];
+		memcpy(t, roundKeys + i - 4, 4);
+		if (i % 16 == 0)
+		{
+			uint8_t first = t[0];
+			t[0] = sbox[t[1]] ^ rcon;
+			t[1] = sbox[t[2]];
+			t[2] = sbox[t[3]];
+			t[3] = sbox[first];
+			rcon = xtime(rcon);
+		}
+		for (int j = 0; j < 4; j++)
+			roundKeys[i + j] = roundKeys[i - 16 + j] ^ t[j];
+	}
+}
+
+static void addRoundKey(uint8_t s[16], const uint8_t* k)
+{
+	for (int i = 0; i < 16; i++) s[i] ^= k[i];
+}
+
+static void shiftRows(uint8_t s[16], bool inverse)
+{
+	uint8_t t[16];
+	for (int c = 0; c < 4; c++)
+		for (int r = 0; r < 4; r++)
+			t[r + 4 * c] = inverse ? s[r + 4 * ((c - r + 4) % 4)] : s[r + 4 * ((c + r) % 4)];
+	memcpy(s, t, 16);
+}
+
+static void mixColumns(uint8_t s[16], bool inverse)
+{
+	for (int c = 0; c < 4; c++)
+	{
+		uint8_t* col = s + 4 * c;
+		uint8_t a0 = col[0], a1 = col[1], a2 = col[2], a3 = col[3];
+		if (!inverse)
+		{
+			col[0] = mul(a0, 2) ^ mul(a1, 3) ^ a2 ^ a3;
+			col[1] = a0 ^ mul(a1, 2) ^ mul(a2, 3) ^ a3;
+			col[2] = a0 ^ a1 ^ mul(a2, 2) ^ mul(a3, 3);
+			col[3] = mul(a0, 3) ^ a1 ^ a2 ^ mul(a3, 2);
+		}
+		else
+		{
+			col[0] = mul(a0, 14) ^ mul(a1, 11) ^ mul(a2, 13) ^ mul(a3, 9);
+			col[1] = mul(a0, 9) ^ mul(a1, 14) ^ mul(a2, 11) ^ mul(a3, 13);
+			col[2] = mul(a0, 13) ^ mul(a1, 9) ^ mul(a2, 14) ^ mul(a3, 11);
+			col[3] = mul(a0, 11) ^ mul(a1, 13) ^ mul(a2, 9) ^ mul(a3, 14);
+		}
+	}
+}
+
+void aesEncrypt(const uint8_t key[16], const uint8_t in[16], uint8_t out[16])
+{
+	initTables();
+	uint8_t k[176], s[16];
+	expandKey(key, k);
+	memcpy(s, in, 16);
+	addRoundKey(s, k);
+	for (int round = 1; round <= 10; round++)
+	{
+		for (int i = 0; i < 16; i++) s[i] = sbox[s[i]];
+		shiftRows(s, false);
+		if (round != 10) mixColumns(s, false);
+		addRoundKey(s, k + 16 * round);
+	}
+	memcpy(out, s, 16);
+}
+
+void aesDecrypt(const uint8_t key[16], const uint8_t in[16], uint8_t out[16])
+{
+	initTables();
+	uint8_t k[176], s[16];
+	expandKey(key, k);
+	memcpy(s, in, 16);
+	addRoundKey(s, k + 160);
+	for (int round = 9; round >= 0; round--)
+	{
+		shiftRows(s, true);
+		for (int i = 0; i < 16; i++) s[i] = invSbox[s[i]];
+		addRoundKey(s, k + 16 * round);
+		if (round) mixColumns(s, true);
+	}
+	memcpy(out, s, 16);
+}
+
+uint16_t crc16(const uint8_t* data, unsigned length)
+{
+	uint16_t crc = 0x1D0F;
+	for (unsigned i = 0; i < length; i++)
+	{
+		crc ^= (uint16_t) data[i] << 8;
+		for (int b = 0; b < 8; b++)
+			crc = (crc & 0x8000) ? (uint16_t) ((crc << 1) ^ 0x1021) : (uint16_t) (crc << 1);
+	}
+	return (uint16_t) ~crc;
+}
+
+} // namespace sim
@@ -0,0 +1,17 @@
+// host simulator: AES-128 (ECB blocks) as used by the SX1231 packet engine, and its CRC-16
+#ifndef SIM_AES_H
+#define SIM_AES_H
+
+#include <stdint.h>
+
+namespace sim {
+
+void aesEncrypt(const uint8_t key[16], const uint8_t in[16], uint8_t out[16]);
+void aesDecrypt(const uint8_t key[16], const uint8_t in[16], uint8_t out[16]);
+
+// CRC-16 CCITT as computed by the packet handler: polynomial 0x1021, initial value 0x1D0F, result inverted
+uint16_t crc16(const uint8_t* data, unsigned length);
+
+} // namespace sim
+
+#endif
@@ -0,0 +1,95 @@
+// host simulator: the scripted single radio channel, see air.h
+#include "air.h"
+#include "sx1231.h"
+#include <math.h>
+#include <algorithm>
+
+namespace sim {
+
+double addDbm(double a, double b)
+{
+	return 10 * log10(pow(10, a / 10) + pow(10, b / 10));
+}
+
+ScriptedAir::ScriptedAir(double noiseDbm, double levelDbm)
+	: radio(0), noise(noiseDbm), signal(levelDbm), nextId(1)
+{
+}
+
+void ScriptedAir::attach(Sx1231* device)
+{
+	radio = device;
+	radio->setAir(this);
+}
+
+AirFramePtr ScriptedAir::frame(uint64_t start, const uint8_t* payload, uint8_t length, const uint8_t* aesKey) const
+{
+	uint8_t packet[256];
+	packet[0] = length;
+	std::copy(payload, payload + length, packet + 1);
+	AirFramePtr f = radio->makeFrame(start, packet, aesKey);
+	f->source = -1;
+	f->powerDbm = signal;
+	f->end = f->syncEnd + f->data.size() * f->byteNs;
+	f->ended = true;
+	return f;
+}
+
+AirFramePtr ScriptedAir::packet(uint64_t start, uint8_t target, uint8_t sender, uint8_t ctl, const void* data, uint8_t length,
+                                const uint8_t* aesKey) const
+{
+	uint8_t payload[255] = { target, sender, ctl };
+	std::copy((const uint8_t*) data, (const uint8_t*) data + length, payload + 3);
+	return frame(start, payload, length + 3, aesKey);
+}
+
+void ScriptedAir::inject(const AirFramePtr& f, bool intactFrame)
+{
+	f->id = nextId++;
+	if (!intactFrame)
+		corrupted.push_back(f->id);
+	injected.push_back(f);
+	radio->airFrame(f);
+}
+
+void ScriptedAir::transmit(Sx1231*, const AirFramePtr& f)
+{
+	f->id = nextId++;
+}
+
+void ScriptedAir::transmitEnd(Sx1231*, const AirFramePtr& f)
+{
+	sent.push_back(f);
+	if (onTransmit)
+		onTransmit(f);
+}
+
+double ScriptedAir::rssi(const Sx1231* at, uint64_t ns)
+{
+	double dbm = noise;
+	for (size_t i = 0; i < injected.size();)
+	{
+		const AirFrame& f = *injected[i];
+		if (f.end <= ns && f.end + 1000000000ull < ns)
+		{
+			injected.erase(injected.begin() + i); // long gone
+			continue;
+		}
+		if (f.start <= ns && ns < f.end && f.frf == at->frf())
+			dbm = addDbm(dbm, signal);
+		i++;
+	}
+	return dbm;
+}
+
+double ScriptedAir::level(const Sx1231*, const AirFrame&)
+{
+	return signal;
+}
+
+bool ScriptedAir::intact(const Sx1231*, const AirFrame& f)
+{
+	return std::find(corrupted.begin(), corrupted.end(), f.id) == corrupted.end();
+}
+
+} // namespace sim
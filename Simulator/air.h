@@ -0,0 +1,89 @@
+// host simulator: what is on the air. a frame is the bytes after the sync word (length byte, payload as sent,
+// CRC) plus enough timing to place every bit. transmitters append bytes while they send them, so a receiver
+// only ever looks at bytes that have already left the antenna
+#ifndef SIM_AIR_H
+#define SIM_AIR_H
+
+#include <stdint.h>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace sim {
+
+class Sx1231;
+
+struct AirFrame
+{
+	uint64_t id;
+	int source; // Sx1231::id() of the transmitter, -1 for injected frames
+	uint32_t frf; // carrier, in FRF steps
+	uint32_t bitrate; // bits/s
+	double powerDbm; // at the transmitter antenna
+	uint64_t start; // ns, first preamble bit
+	uint64_t syncEnd; // ns, first bit after the sync word
+	uint64_t byteNs;
+	uint64_t end; // ns, valid once ended
+	bool ended;
+	bool truncated; // the transmitter stopped mid frame (mode change, FIFO underrun)
+	uint8_t syncLen;
+	uint8_t sync[8];
+	std::vector<uint8_t> data; // after the sync word, as sent so far
+
+	uint64_t byteEnd(size_t i) const { return syncEnd + (i + 1) * byteNs; } // when byte i has been received
+};
+
+typedef std::shared_ptr<AirFrame> AirFramePtr;
+
+// the channel between radios. implementations decide who hears what, how loud, and what collides
+class Air
+{
+public:
+	virtual ~Air() {}
+	virtual void transmit(Sx1231* from, const AirFramePtr& frame) = 0; // preamble starts now
+	virtual void transmitEnd(Sx1231* from, const AirFramePtr& frame) = 0; // last bit (or truncated)
+	virtual double rssi(const Sx1231* at, uint64_t ns) = 0; // dBm in the receiver's channel, noise floor if quiet
+	virtual double level(const Sx1231* at, const AirFrame& frame) = 0; // dBm of one frame at a receiver
+	virtual bool intact(const Sx1231* at, const AirFrame& frame) = 0; // received without a destructive collision
+	virtual void sync(const Sx1231* at, uint64_t ns) {} // until what went on air before ns is visible at this radio
+};
+
+// a single radio talking to a script: frames it sends are recorded (and can be answered from onTransmit),
+// frames for it are injected at a fixed level
+class ScriptedAir : public Air
+{
+public:
+	explicit ScriptedAir(double noiseDbm = -110, double levelDbm = -60);
+	void attach(Sx1231* radio);
+
+	// a frame as the radio would send it with its current settings (sync word, preamble, bitrate, CRC, AES key)
+	AirFramePtr frame(uint64_t start, const uint8_t* payload, uint8_t length, const uint8_t* aesKey = 0) const;
+	// RFM69.h frame: length, target, sender, CTL, data
+	AirFramePtr packet(uint64_t start, uint8_t target, uint8_t sender, uint8_t ctl, const void* data, uint8_t length,
+	                   const uint8_t* aesKey = 0) const;
+	void inject(const AirFramePtr& frame, bool intact = true);
+
+	std::vector<AirFramePtr> sent;
+	std::function<void(const AirFramePtr&)> onTransmit; // called when a frame sent by the radio ends
+
+	// Air
+	void transmit(Sx1231* from, const AirFramePtr& frame);
+	void transmitEnd(Sx1231* from, const AirFramePtr& frame);
+	double rssi(const Sx1231* at, uint64_t ns);
+	double level(const Sx1231* at, const AirFrame& frame);
+	bool intact(const Sx1231* at, const AirFrame& frame);
+
+private:
+	Sx1231* radio;
+	double noise, signal;
+	uint64_t nextId;
+	std::vector<AirFramePtr> injected;
+	std::vector<uint64_t> corrupted;
+};
+
+// dBm sum of two levels
+double addDbm(double a, double b);
+
+} // namespace sim
+
+#endif
@@ -0,0 +1,282 @@
+// host simulator: simulated AVR, see mcu.h
+#include "mcu.h"
+#include <avr/io.h>
+#include <string.h>
+
+namespace sim {
+
+static const uint64_t NEVER = ~(uint64_t) 0;
+
+Mcu::Mcu(uint32_t fcpu)
+	: clock(fcpu), cycle(0), iflag(false), irqOffSince(NEVER), isrDepth(0), spi(0), selected(false), dio0(false),
+	  spdrIn(0xFF), ocr1aHigh(0), ocr1a(0), timerStart(0), timerNextMatch(NEVER), timerRunning(false),
+	  horizon(NEVER), horizonHook(0), horizonContext(0)
+{
+	memset(&stats, 0, sizeof(stats));
+	memset(io, 0, sizeof(io));
+	memset(vectors, 0, sizeof(vectors));
+}
+
+uint64_t Mcu::ns() const
+{
+	return (uint64_t) ((unsigned __int128) cycle * 1000000000u / clock);
+}
+
+uint64_t Mcu::cyclesFor(uint64_t ns) const
+{
+	return (uint64_t) (((unsigned __int128) ns * clock + 999999999u) / 1000000000u);
+}
+
+void Mcu::setHorizon(uint64_t ns, void (*hook)(void*), void* context)
+{
+	horizon = ns == NEVER ? NEVER : cyclesFor(ns);
+	horizonHook = hook;
+	horizonContext = context;
+}
+
+void Mcu::charge(uint32_t cycles)
+{
+	cycle += cycles;
+	service();
+}
+
+// brings the radio and Timer1 up to the current cycle and runs whatever interrupt became due
+void Mcu::service()
+{
+	if (horizonHook && cycle >= horizon)
+		horizonHook(horizonContext);
+	if (spi)
+	{
+		spi->update(ns());
+		pinsChanged();
+	}
+	updateTimer();
+	dispatch();
+}
+
+// INT5 edge detection on DIO0 (PE5), as configured by ISC51:ISC50
+void Mcu::pinsChanged()
+{
+	bool level = spi->dio0();
+	if (level == dio0)
+		return;
+	uint8_t sense = (io[IO_EICRB] >> ISC50) & 3;
+	if (sense == 1 || (sense == 2 && !level) || (sense == 3 && level))
+		io[IO_EIFR] |= 1 << INTF5;
+	dio0 = level;
+}
+
+static const uint16_t prescalers[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+
+void Mcu::updateTimer()
+{
+	while (timerRunning && cycle >= timerNextMatch)
+	{
+		io[IO_TIFR] |= 1 << OCF1A;
+		uint64_t top = (io[IO_TCCR1B] & (1 << WGM12)) ? ocr1a : 0xFFFF;
+		timerNextMatch += (top + 1) * prescalers[io[IO_TCCR1B] & 7];
+	}
+}
+
+uint64_t Mcu::nextTimerCycle() const
+{
+	return timerRunning && (io[IO_TIMSK] & (1 << OCIE1A)) ? timerNextMatch : NEVER;
+}
+
+void Mcu::dispatch()
+{
+	while (iflag)
+	{
+		int vector;
+		if ((io[IO_EIMSK] & (1 << INT5)) && ((io[IO_EIFR] & (1 << INTF5)) || (((io[IO_EICRB] >> ISC50) & 3) == 0 && !dio0)))
+		{
+			vector = VEC_INT5;
+			io[IO_EIFR] &= ~(1 << INTF5);
+		}
+		else if ((io[IO_TIMSK] & (1 << OCIE1A)) && (io[IO_TIFR] & (1 << OCF1A)))
+		{
+			vector = VEC_TIMER1_COMPA;
+			io[IO_TIFR] &= ~(1 << OCF1A);
+		}
+		else
+			return;
+		if (!vectors[vector])
+			continue;
+		uint64_t start = cycle;
+		iflag = false; // cleared by the hardware on the way in
+		irqOffSince = cycle;
+		isrDepth++;
+		charge(CYCLES_ISR_ENTRY);
+		vectors[vector]();
+		charge(CYCLES_ISR_EXIT);
+		isrDepth--;
+		uint64_t spent = cycle - start;
+		stats.isrCalls[vector]++;
+		stats.isrCycles[vector] += spent;
+		if (spent > stats.isrMaxCycles[vector])
+			stats.isrMaxCycles[vector] = (uint32_t) spent;
+		if (!iflag) // reti
+			setInterrupts(true);
+	}
+}
+
+void Mcu::setInterrupts(bool on)
+{
+	if (on == iflag)
+		return;
+	iflag = on;
+	if (!on)
+	{
+		irqOffSince = cycle;
+		return;
+	}
+	if (irqOffSince != NEVER)
+	{
+		uint64_t off = cycle - irqOffSince;
+		stats.irqOffCycles += off;
+		if (off > stats.irqOffMaxCycles)
+			stats.irqOffMaxCycles = (uint32_t) off;
+	}
+	dispatch();
+}
+
+// the first of limit, the horizon, the next Timer1 match and the next thing the radio does by itself
+uint64_t Mcu::nextEventCycle(uint64_t limit) const
+{
+	uint64_t next = limit;
+	if (horizonHook && horizon > cycle && horizon < next)
+		next = horizon;
+	uint64_t timer = nextTimerCycle();
+	if (timer < next)
+		next = timer;
+	if (spi)
+	{
+		uint64_t event = spi->nextEventNs();
+		if (event != NEVER)
+		{
+			uint64_t eventCycle = cyclesFor(event);
+			if (eventCycle < next)
+				next = eventCycle;
+		}
+	}
+	return next;
+}
+
+void Mcu::delayNs(uint64_t ns)
+{
+	uint64_t target = cycle + cyclesFor(ns);
+	while (cycle < target)
+	{
+		uint64_t next = nextEventCycle(target);
+		cycle = next > cycle ? next : cycle + 1;
+		service();
+	}
+}
+
+// a radio event that doesn't raise DIO0 wakes it as well, the caller checks and goes back to sleep like it would
+// after any other interrupt
+void Mcu::idle()
+{
+	uint64_t from = cycle;
+	uint64_t next = nextEventCycle(NEVER);
+	cycle = next != NEVER && next > cycle ? next : cycle + 1;
+	stats.sleepCycles += cycle - from;
+	service();
+}
+
+uint16_t Mcu::ioRead(int id)
+{
+	charge(CYCLES_IO);
+	switch (id)
+	{
+		case IO_SPDR:
+			io[IO_SPSR] &= ~(1 << SPIF);
+			return spdrIn;
+		case IO_PINB:
+			return io[IO_PORTB];
+		case IO_PIND:
+			return io[IO_PORTD];
+		case IO_PINE:
+			return (io[IO_PORTE] & ~(1 << PE5)) | (dio0 ? 1 << PE5 : 0);
+		case IO_OCR1A:
+			return ocr1a;
+		case IO_TCNT1:
+		{
+			uint16_t prescale = prescalers[io[IO_TCCR1B] & 7];
+			if (!timerRunning || !prescale)
+				return 0;
+			uint64_t ticks = (cycle - timerStart) / prescale;
+			uint64_t top = (io[IO_TCCR1B] & (1 << WGM12)) ? ocr1a : 0xFFFF;
+			return (uint16_t) (ticks % (top + 1));
+		}
+		case IO_SREG:
+			return iflag ? 1 << SREG_I : 0;
+		default:
+			return io[id];
+	}
+}
+
+void Mcu::ioWrite(int id, uint16_t value)
+{
+	charge(CYCLES_IO);
+	switch (id)
+	{
+		case IO_SPDR:
+			if ((io[IO_SPCR] & (1 << SPE)) && (io[IO_SPCR] & (1 << MSTR)))
+			{
+				stats.spiBytes++;
+				charge(CYCLES_SPI_SHIFT); // the slave sees the byte once it has been shifted out
+				spdrIn = (selected && spi) ? spi->spiTransfer((uint8_t) value) : 0xFF;
+				io[IO_SPSR] |= 1 << SPIF;
+			}
+			return;
+		case IO_SPSR:
+			io[IO_SPSR] = (io[IO_SPSR] & (1 << SPIF)) | (value & (1 << SPI2X));
+			return;
+		case IO_PORTB:
+		{
+			io[IO_PORTB] = (uint8_t) value;
+			bool select = !(value & (1 << PB0)); // SS_PIN
+			if (select != selected)
+			{
+				selected = select;
+				if (select)
+					stats.spiTransactions++;
+				if (spi)
+					spi->spiSelect(select);
+			}
+			return;
+		}
+		case IO_EIFR:
+		case IO_TIFR:
+			io[id] &= ~value; // flags are cleared by writing a one
+			return;
+		case IO_OCR1AH:
+			ocr1aHigh = (uint8_t) value;
+			return;
+		case IO_OCR1AL:
+			value = (uint16_t) (ocr1aHigh << 8 | (value & 0xFF));
+			// fall through
+		case IO_OCR1A:
+			ocr1a = value;
+			break;
+		case IO_TCCR1B:
+			io[IO_TCCR1B] = (uint8_t) value;
+			break;
+		case IO_SREG:
+			setInterrupts(value & (1 << SREG_I));
+			return;
+		default:
+			io[id] = (uint8_t) value;
+			return;
+	}
+	// Timer1 reconfigured: count again from 0
+	uint16_t prescale = prescalers[io[IO_TCCR1B] & 7];
+	timerRunning = prescale != 0;
+	timerStart = cycle;
+	uint64_t top = (io[IO_TCCR1B] & (1 << WGM12)) ? ocr1a : 0xFFFF;
+	timerNextMatch = timerRunning ? cycle + (top + 1) * prescale : NEVER;
+	updateTimer();
+}
+
+} // namespace sim
@@ -0,0 +1,109 @@
+// host simulator: the AVR the driver runs on. I/O registers, SPI master, INT5 and Timer1, interrupt dispatch
+// and a cycle counter. time only moves when the driver touches the hardware (every access is charged the
+// cycles it would take on the chip), when it idles through delayNs() and in the interrupt handlers
+#ifndef SIM_MCU_H
+#define SIM_MCU_H
+
+#include "shim/hal.h"
+
+namespace sim {
+
+// anything hanging off the SPI bus with an interrupt line (the SX1231 model)
+class SpiDevice
+{
+public:
+	virtual ~SpiDevice() {}
+	virtual void spiSelect(bool selected) = 0;
+	virtual uint8_t spiTransfer(uint8_t mosi) = 0;
+	virtual void update(uint64_t ns) = 0; // catch up with the MCU clock
+	virtual uint64_t nextEventNs() = 0; // when the device next changes state by itself, ~0 if never
+	virtual bool dio0() = 0; // level of the interrupt line
+};
+
+// estimated cost of what the driver does, in CPU cycles
+enum
+{
+	CYCLES_IO = 1, // in/out, sbi/cbi
+	CYCLES_SPI_SHIFT = 16, // one byte at SCK = F_CPU/2 (SPI2X), on top of the SPDR/SPSR accesses
+	CYCLES_ISR_ENTRY = 24, // vector jump + prologue (register pushes)
+	CYCLES_ISR_EXIT = 24, // epilogue + reti
+	// the compression loops, C code the I/O accesses don't show (RF69_Z_STEP(), counted by rfm69zbench only)
+	CYCLES_Z_POS = 16, // packLz(): an earlier position tried, the first compare and keeping the longest match
+	CYCLES_Z_MATCH = 14, // packLz(): one more byte of a match, two indexed loads, compare, the two bound checks
+	CYCLES_Z_TOKEN = 10, // an LZ token written or read, with its bound check
+	CYCLES_Z_BYTE = 7, // a byte copied or taken into a literal run: ld, st, loop
+	CYCLES_Z_WORD = 40 // a delta coded word: 16 bit subtract or add, zigzag and the varint bytes
+};
+
+class Mcu : public Hal
+{
+public:
+	enum Vector { VEC_INT5, VEC_TIMER1_COMPA, VEC_COUNT }; // in priority order
+
+	struct Stats
+	{
+		uint64_t spiBytes;
+		uint64_t spiTransactions; // chip select assertions
+		uint64_t isrCalls[VEC_COUNT];
+		uint64_t isrCycles[VEC_COUNT]; // including anything nested
+		uint32_t isrMaxCycles[VEC_COUNT];
+		uint32_t irqOffMaxCycles; // longest stretch with the I flag clear
+		uint64_t irqOffCycles;
+		uint64_t sleepCycles; // in sleep_cpu()
+	};
+
+	explicit Mcu(uint32_t fcpu = F_CPU);
+
+	void attach(SpiDevice* device) { spi = device; }
+	void setVector(Vector vector, void (*handler)(void)) { vectors[vector] = handler; }
+
+	uint32_t fcpu() const { return clock; }
+	uint64_t cycles() const { return cycle; }
+	uint64_t ns() const;
+	uint64_t cyclesFor(uint64_t ns) const;
+	Stats stats;
+
+	// Hal
+	uint16_t ioRead(int id);
+	void ioWrite(int id, uint16_t value);
+	void setInterrupts(bool on);
+	bool interrupts() { return iflag; }
+	void delayNs(uint64_t ns); // busy wait / idle: interrupts are served meanwhile
+	void idle();
+	void charge(uint32_t cycles);
+	uint64_t timeNs() { return ns(); }
+
+	// multi-node runs: hook() is called (and may switch to another node) once the clock reaches ns
+	void setHorizon(uint64_t ns, void (*hook)(void*), void* context);
+
+private:
+	void service();
+	void updateTimer();
+	void dispatch();
+	void pinsChanged();
+	uint64_t nextTimerCycle() const;
+	uint64_t nextEventCycle(uint64_t limit) const;
+
+	uint32_t clock;
+	uint64_t cycle;
+	bool iflag;
+	uint64_t irqOffSince;
+	int isrDepth;
+	uint8_t io[IO_COUNT];
+	SpiDevice* spi;
+	void (*vectors[VEC_COUNT])(void);
+	bool selected, dio0;
+	uint8_t spdrIn;
+	uint8_t ocr1aHigh; // 16 bit register TEMP byte
+	uint16_t ocr1a;
+	uint64_t timerStart; // cycle Timer1 was last (re)started at, 0 based count from there
+	uint64_t timerNextMatch;
+	bool timerRunning;
+	uint64_t horizon; // cycle
+	void (*horizonHook)(void*);
+	void* horizonContext;
+};
+
+} // namespace sim
+
+#endif
@@ -0,0 +1,182 @@
+// host simulator: the shared channel, see medium.h
+#include "medium.h"
+#include "sx1231.h"
+#include <math.h>
+
+namespace sim {
+
+Medium::Medium(const Params& p)
+	: params(p), collisions(0), deliveries(0), frames(0), airNs(0), nextId(1), longest(0)
+{
+}
+
+void Medium::place(Sx1231* radio, double x, double y, int partition)
+{
+	if ((size_t) radio->id() >= radios.size())
+		radios.resize(radio->id() + 1);
+	Radio r = { radio, x, y, partition };
+	radios[radio->id()] = r;
+	radio->setAir(this);
+}
+
+void Medium::setPartitions(int count)
+{
+	started.resize(count);
+}
+
+// the shadowing of a link is a fixed draw, the same both ways
+static double gaussian(uint32_t a, uint32_t b, uint32_t seed)
+{
+	uint64_t h = ((uint64_t) (a < b ? a : b) << 32 | (a < b ? b : a)) ^ ((uint64_t) seed * 0x9E3779B97F4A7C15ull);
+	h ^= h >> 33; h *= 0xFF51AFD7ED558CCDull; h ^= h >> 33; h *= 0xC4CEB9FE1A85EC53ull; h ^= h >> 33;
+	double u1 = ((h >> 11) + 1) / 9007199254740994.0, u2 = (h & 0x7FF) / 2048.0;
+	return sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+double Medium::pathLoss(int from, int to) const
+{
+	const Radio &a = radios[from], &b = radios[to];
+	double d = hypot(a.x - b.x, a.y - b.y);
+	if (d < 1)
+		d = 1;
+	return params.lossAt1m + 10 * params.exponent * log10(d) + params.shadowingDb * gaussian(from, to, params.seed);
+}
+
+double Medium::noiseDbm(const Sx1231* at) const
+{
+	return -174 + 10 * log10((double) at->rxBandwidth()) + params.noiseFigureDb;
+}
+
+bool Medium::sameChannel(const Sx1231* at, const AirFrame& f) const
+{
+	uint64_t offsetHz = (uint64_t) (f.frf > at->frf() ? f.frf - at->frf() : at->frf() - f.frf) * 32000000 >> 19;
+	return offsetHz <= at->rxBandwidth() / 2;
+}
+
+const AirFrame& Medium::copy(const Transmission& t, const Sx1231* at) const
+{
+	return *t.copies[radios[at->id()].partition];
+}
+
+Medium::Stats Medium::stats() const
+{
+	Stats s = { frames, airNs, collisions, deliveries };
+	return s;
+}
+
+// during a round: only the transmitter's partition knows about the frame
+void Medium::transmit(Sx1231* from, const AirFramePtr& frame)
+{
+	started[radios[from->id()].partition].push_back(frame);
+}
+
+void Medium::transmitEnd(Sx1231*, const AirFramePtr&)
+{
+}
+
+void Medium::publish(uint64_t epoch)
+{
+	for (size_t i = 0; i < onAir.size(); i++)
+	{
+		Transmission& t = onAir[i];
+		const AirFrame& f = *t.frame;
+		if (t.published == f.data.size() && t.copies[0]->ended == f.ended)
+			continue;
+		for (size_t p = 0; p < t.copies.size(); p++)
+		{
+			AirFrame& c = *t.copies[p];
+			c.data.insert(c.data.end(), f.data.begin() + t.published, f.data.end());
+			c.end = f.end;
+			c.ended = f.ended;
+			c.truncated = f.truncated;
+		}
+		t.published = f.data.size();
+		if (f.ended)
+		{
+			airNs += f.end - f.start;
+			if (f.end - f.start > longest)
+				longest = f.end - f.start;
+		}
+	}
+	for (size_t p = 0; p < started.size(); p++)
+	{
+		for (size_t i = 0; i < started[p].size(); i++)
+		{
+			Transmission t;
+			t.frame = started[p][i];
+			t.frame->id = nextId++;
+			t.published = t.frame->data.size();
+			for (size_t q = 0; q < started.size(); q++)
+				t.copies.push_back(AirFramePtr(new AirFrame(*t.frame)));
+			onAir.push_back(t);
+			frames++;
+			for (size_t r = 0; r < radios.size(); r++)
+			{
+				Sx1231* radio = radios[r].radio;
+				if (radio && (int) r != t.frame->source && level(radio, *t.frame) > noiseDbm(radio) - 10)
+					radio->airFrame(t.copies[radios[r].partition]);
+			}
+		}
+		started[p].clear();
+	}
+	// a frame still being received may have started up to the longest airtime ago, keep what could overlap it
+	for (size_t i = 0; i < onAir.size();)
+	{
+		const AirFrame& f = *onAir[i].frame;
+		if (f.ended && f.end + longest < epoch)
+			onAir.erase(onAir.begin() + i);
+		else
+			i++;
+	}
+}
+
+void Medium::sync(const Sx1231*, uint64_t ns)
+{
+	if (wait)
+		wait(ns);
+}
+
+double Medium::rssi(const Sx1231* at, uint64_t ns)
+{
+	// RSSI averages over 2 bits, a carrier that came up less than that ago isn't in it yet
+	uint64_t lag = at->byteNs() / 4;
+	if (ns > lag)
+		sync(at, ns - lag);
+	double dbm = noiseDbm(at);
+	for (size_t i = 0; i < onAir.size(); i++)
+	{
+		const AirFrame& f = copy(onAir[i], at);
+		if (f.source != at->id() && f.start + lag <= ns && (!f.ended || f.end > ns) && sameChannel(at, f))
+			dbm = addDbm(dbm, level(at, f));
+	}
+	return dbm;
+}
+
+double Medium::level(const Sx1231* at, const AirFrame& frame)
+{
+	return frame.powerDbm - pathLoss(frame.source, at->id());
+}
+
+// whatever overlapped the frame from its sync word on adds up as interference, the frame survives it with
+// captureDb to spare. a stronger frame that started during the preamble simply wasn't locked onto
+bool Medium::intact(const Sx1231* at, const AirFrame& frame)
+{
+	uint64_t now = at->timeNs();
+	sync(at, now);
+	uint64_t from = frame.syncEnd - frame.syncLen * frame.byteNs;
+	double interference = noiseDbm(at);
+	for (size_t i = 0; i < onAir.size(); i++)
+	{
+		const AirFrame& f = copy(onAir[i], at);
+		if (f.id != frame.id && f.source != at->id() && f.start < now && (!f.ended || f.end > from) && sameChannel(at, f))
+			interference = addDbm(interference, level(at, f));
+	}
+	bool ok = level(at, frame) - interference >= params.captureDb;
+	if (ok)
+		deliveries++;
+	else
+		collisions++;
+	return ok;
+}
+
+} // namespace sim
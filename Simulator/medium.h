@@ -0,0 +1,86 @@
+// host simulator: a shared radio channel for many nodes. log-distance path loss with per link shadowing, RSSI
+// as the power sum of everything on air in the receiver's channel, collisions decided by the signal to
+// interference ratio (capture) over the whole frame. frames are timed at each transmitter's own bitrate.
+// the nodes run in partitions (one thread each, see network.h). within a round a partition only reads what
+// was published at the end of the last one, a frame and its bytes reach the others at the round barrier
+#ifndef SIM_MEDIUM_H
+#define SIM_MEDIUM_H
+
+#include "air.h"
+#include <atomic>
+
+namespace sim {
+
+class Medium : public Air
+{
+public:
+	struct Params
+	{
+		double lossAt1m; // dB, 31.2 is free space at 868MHz
+		double exponent; // path loss exponent, 2 free space, 2.7-3.5 urban
+		double shadowingDb; // standard deviation of the per link (symmetric, constant) shadowing
+		double noiseFigureDb;
+		double captureDb; // a frame survives interference this much weaker than itself
+		uint32_t seed;
+		Params() : lossAt1m(31.2), exponent(3.0), shadowingDb(4), noiseFigureDb(7), captureDb(6), seed(1) {}
+	};
+
+	struct Stats
+	{
+		uint64_t frames; // transmissions
+		uint64_t airNs; // sum of their airtime
+		uint64_t collisions; // receptions lost to interference
+		uint64_t deliveries; // receptions that survived it
+	};
+
+	explicit Medium(const Params& params = Params());
+	Params params;
+
+	// radios take their index as Sx1231::id(); partition is the thread that runs it
+	void place(Sx1231* radio, double x, double y, int partition);
+	void setPartitions(int count);
+	// between rounds: whatever every node sent until now becomes visible to every other node
+	void publish(uint64_t epoch);
+	// called by a node that needs everything sent before ns, blocks it until all the others got there
+	std::function<void(uint64_t)> wait;
+
+	double pathLoss(int from, int to) const; // dB
+	double noiseDbm(const Sx1231* at) const;
+	Stats stats() const;
+
+	// Air
+	void transmit(Sx1231* from, const AirFramePtr& frame);
+	void transmitEnd(Sx1231* from, const AirFramePtr& frame);
+	double rssi(const Sx1231* at, uint64_t ns);
+	double level(const Sx1231* at, const AirFrame& frame);
+	bool intact(const Sx1231* at, const AirFrame& frame);
+	void sync(const Sx1231* at, uint64_t ns);
+
+private:
+	struct Radio
+	{
+		Sx1231* radio;
+		double x, y;
+		int partition;
+	};
+	struct Transmission
+	{
+		AirFramePtr frame; // the transmitter's, only its own partition touches it during a round
+		std::vector<AirFramePtr> copies; // one per partition, updated at the barrier
+		size_t published; // bytes
+	};
+
+	bool sameChannel(const Sx1231* at, const AirFrame& frame) const;
+	const AirFrame& copy(const Transmission& t, const Sx1231* at) const; // as the receiver's partition sees it
+
+	std::vector<Radio> radios;
+	std::vector<Transmission> onAir; // published, kept a while after they ended for intact()
+	std::vector<std::vector<AirFramePtr> > started; // per partition, since the last barrier
+	std::atomic<uint64_t> collisions, deliveries;
+	uint64_t frames, airNs, nextId;
+	uint64_t longest; // airtime of the longest frame so far
+};
+
+} // namespace sim
+
+#endif
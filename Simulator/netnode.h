@@ -0,0 +1,44 @@
+// host simulator: what network.cpp hands the firmware of one node (node.cpp) and what it gets back
+#ifndef SIM_NETNODE_H
+#define SIM_NETNODE_H
+
+#include <stdint.h>
+#include "shim/hal.h"
+
+namespace sim {
+
+enum { NODE_GATEWAY, NODE_SENSOR, NODE_JAMMER };
+
+struct NodeResults
+{
+	// sensor
+	uint32_t sent; // sendWithRetry() calls
+	uint32_t acked;
+	uint64_t ackedNs; // summed time of the sendWithRetry() calls that got their ACK
+	// gateway
+	uint32_t received; // frames out of receiveDone()
+	uint32_t unique; // not a retry of one that was already received
+	uint32_t acksSent;
+};
+
+struct NodeConfig
+{
+	Hal* hal;
+	uint8_t role;
+	uint8_t nodeId, networkId, gatewayId;
+	uint16_t band;
+	uint8_t powerLevel; // 0-31
+	uint8_t payload; // bytes, sensor readings
+	uint8_t retries, retryWaitMs; // sendWithRetry()
+	uint32_t periodMs; // mean time between readings, exponentially distributed
+	uint32_t jamHz; // jammer: where it sends
+	uint32_t seed;
+	NodeResults results;
+};
+
+// the entry point node.cpp exports
+typedef void (*NodeMain)(NodeConfig* config);
+
+} // namespace sim
+
+#endif
@@ -0,0 +1,299 @@
+// host simulator: the multi-node scheduler, see network.h
+#include "network.h"
+#include <dlfcn.h>
+#include <link.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <thread>
+
+namespace sim {
+
+enum { STACK_SIZE = 128 * 1024 };
+
+struct Network::Node
+{
+	NodeConfig config;
+	Mcu mcu;
+	Sx1231 radio;
+	Partition* partition;
+	std::vector<uint8_t> data; // the driver's globals while another node of the partition runs
+	char* stack;
+	ucontext_t context;
+	uint64_t blockedUntil; // waiting for the others to reach this time, 0 if not
+	bool started, done;
+
+	Node(int id) : radio(0, id), partition(0), stack(0), blockedUntil(0), started(false), done(false) {}
+	~Node() { delete[] stack; }
+};
+
+struct Network::Partition
+{
+	std::string path;
+	void* lib;
+	NodeMain entry;
+	void (*int5)(void);
+	void (*timer1)(void);
+	uint8_t* data; // writable data of this copy of the firmware
+	size_t dataSize;
+	std::vector<Node*> nodes;
+	Node* loaded; // whose globals are in data
+	Node* current;
+	ucontext_t scheduler;
+	std::thread thread;
+};
+
+static thread_local Network::Partition* running;
+
+Network::Network(Medium& m, const char* file, int count, uint64_t lookaheadNs)
+	: rounds(0), medium(m), firmware(file), lookahead(lookaheadNs), epoch(0), horizon(0), generation(0), pending(0),
+	  stopping(false)
+{
+	if (count < 1)
+		count = 1;
+	for (int i = 0; i < count; i++)
+	{
+		partitions.push_back(new Partition());
+		load(*partitions.back());
+	}
+	medium.setPartitions(count);
+	medium.wait = [this](uint64_t ns) { wait(ns); };
+}
+
+Network::~Network()
+{
+	medium.wait = nullptr;
+	for (size_t i = 0; i < nodes.size(); i++)
+		delete nodes[i];
+	for (size_t i = 0; i < partitions.size(); i++)
+	{
+		dlclose(partitions[i]->lib);
+		delete partitions[i];
+	}
+}
+
+static int findData(struct dl_phdr_info* info, size_t, void* arg)
+{
+	Network::Partition& p = *(Network::Partition*) arg;
+	if (!info->dlpi_name || p.path != info->dlpi_name)
+		return 0;
+	uintptr_t start = 0, end = 0, relro = 0;
+	for (int i = 0; i < info->dlpi_phnum; i++)
+	{
+		const ElfW(Phdr)& h = info->dlpi_phdr[i];
+		if (h.p_type == PT_LOAD && (h.p_flags & PF_W))
+		{
+			start = info->dlpi_addr + h.p_vaddr;
+			end = start + h.p_memsz;
+		}
+		if (h.p_type == PT_GNU_RELRO)
+			relro = info->dlpi_addr + h.p_vaddr + h.p_memsz;
+	}
+	// the read-only after relocation part (GOT, vtables) is the same for every node and can't be written anyway
+	if (relro > start && relro <= end)
+		start = relro;
+	p.data = (uint8_t*) start;
+	p.dataSize = end - start;
+	return 1;
+}
+
+// dlopen() hands out the same instance for the same file, every partition gets a copy of its own
+void Network::load(Partition& p)
+{
+	char path[] = "/tmp/rfm69node-XXXXXX";
+	int fd = mkstemp(path);
+	FILE* in = fopen(firmware.c_str(), "rb");
+	if (fd < 0 || !in)
+	{
+		fprintf(stderr, "can't copy %s\n", firmware.c_str());
+		exit(1);
+	}
+	char buffer[65536];
+	size_t n;
+	while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0)
+		if (write(fd, buffer, n) != (ssize_t) n)
+			break;
+	fclose(in);
+	close(fd);
+	p.path = path;
+	p.lib = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	unlink(path);
+	if (!p.lib)
+	{
+		fprintf(stderr, "%s\n", dlerror());
+		exit(1);
+	}
+	p.entry = (NodeMain) dlsym(p.lib, "nodeMain");
+	p.int5 = (void (*)(void)) dlsym(p.lib, "INT5_vect");
+	p.timer1 = (void (*)(void)) dlsym(p.lib, "TIMER1_COMPA_vect");
+	p.data = 0;
+	dl_iterate_phdr(findData, &p);
+	if (!p.entry || !p.int5 || !p.timer1 || !p.data)
+	{
+		fprintf(stderr, "%s: not a node firmware\n", firmware.c_str());
+		exit(1);
+	}
+	p.loaded = p.current = 0;
+}
+
+int Network::add(const NodeConfig& config, double x, double y)
+{
+	int id = (int) nodes.size();
+	Partition& p = *partitions[id % partitions.size()];
+	Node* n = new Node(id);
+	n->config = config;
+	n->config.hal = &n->mcu;
+	n->partition = &p;
+	n->data.assign(p.data, p.data + p.dataSize); // as loaded, nothing ran yet
+	n->mcu.attach(&n->radio);
+	n->mcu.setVector(Mcu::VEC_INT5, p.int5);
+	n->mcu.setVector(Mcu::VEC_TIMER1_COMPA, p.timer1);
+	medium.place(&n->radio, x, y, (int) (id % partitions.size()));
+	nodes.push_back(n);
+	p.nodes.push_back(n);
+	return id;
+}
+
+NodeConfig& Network::config(int i)
+{
+	return nodes[i]->config;
+}
+
+Mcu& Network::mcu(int i)
+{
+	return nodes[i]->mcu;
+}
+
+Sx1231& Network::radio(int i)
+{
+	return nodes[i]->radio;
+}
+
+bool Network::peek(int i, const char* symbol, void* value, size_t size)
+{
+	Node* n = nodes[i];
+	Partition& p = *n->partition;
+	uint8_t* at = (uint8_t*) dlsym(p.lib, symbol);
+	if (!at || at < p.data || at + size > p.data + p.dataSize)
+		return false;
+	memcpy(value, p.loaded == n ? at : &n->data[at - p.data], size);
+	return true;
+}
+
+void Network::nodeStart()
+{
+	Node* n = running->current;
+	running->entry(&n->config);
+	n->done = true;
+	swapcontext(&n->context, &running->scheduler); // not coming back
+}
+
+void Network::horizonReached(void* node)
+{
+	Node* n = (Node*) node;
+	n->blockedUntil = 0;
+	swapcontext(&n->context, &n->partition->scheduler);
+}
+
+void Network::wait(uint64_t ns)
+{
+	Partition* p = running;
+	if (!p || !p->current)
+		return;
+	Node* n = p->current;
+	while (epoch < ns)
+	{
+		n->blockedUntil = ns;
+		swapcontext(&n->context, &p->scheduler);
+	}
+	n->blockedUntil = 0;
+}
+
+void Network::round(Partition& p)
+{
+	running = &p;
+	for (size_t i = 0; i < p.nodes.size(); i++)
+	{
+		Node* n = p.nodes[i];
+		if (!n->done && (n->blockedUntil ? n->blockedUntil <= epoch : n->mcu.ns() < horizon))
+			resume(p, n);
+	}
+	running = 0;
+}
+
+// runs the node until it reaches the horizon or has to wait for the others
+void Network::resume(Partition& p, Node* n)
+{
+	n->mcu.setHorizon(horizon, horizonReached, n);
+	if (p.loaded != n)
+	{
+		if (p.loaded)
+			memcpy(&p.loaded->data[0], p.data, p.dataSize);
+		memcpy(p.data, &n->data[0], p.dataSize);
+		p.loaded = n;
+	}
+	p.current = n;
+	if (!n->started)
+	{
+		n->started = true;
+		n->stack = new char[STACK_SIZE];
+		getcontext(&n->context);
+		n->context.uc_stack.ss_sp = n->stack;
+		n->context.uc_stack.ss_size = STACK_SIZE;
+		n->context.uc_link = 0;
+		makecontext(&n->context, nodeStart, 0);
+	}
+	swapcontext(&p.scheduler, &n->context);
+	p.current = 0;
+}
+
+void Network::worker(int index, uint64_t seen)
+{
+	for (;;)
+	{
+		while (generation.load(std::memory_order_acquire) == seen)
+			std::this_thread::yield();
+		seen++;
+		if (stopping)
+			return;
+		round(*partitions[index]);
+		pending.fetch_sub(1, std::memory_order_release);
+	}
+}
+
+void Network::run(uint64_t untilNs)
+{
+	for (size_t i = 1; i < partitions.size(); i++)
+		partitions[i]->thread = std::thread(&Network::worker, this, (int) i, generation.load());
+	for (;;)
+	{
+		uint64_t oldest = untilNs;
+		for (size_t i = 0; i < nodes.size(); i++)
+			if (!nodes[i]->done && nodes[i]->mcu.ns() < oldest)
+				oldest = nodes[i]->mcu.ns();
+		if (oldest >= untilNs)
+			break;
+		uint64_t ahead = lookahead;
+		for (size_t i = 0; !lookahead && i < nodes.size(); i++)
+			if (!ahead || nodes[i]->radio.preambleNs() * 9 / 10 < ahead)
+				ahead = nodes[i]->radio.preambleNs() * 9 / 10;
+		epoch = oldest;
+		horizon = epoch + ahead < untilNs ? epoch + ahead : untilNs;
+		pending.store((int) partitions.size() - 1, std::memory_order_relaxed);
+		generation.fetch_add(1, std::memory_order_release);
+		round(*partitions[0]);
+		while (pending.load(std::memory_order_acquire))
+			std::this_thread::yield();
+		medium.publish(epoch);
+		rounds++;
+	}
+	stopping = true;
+	generation.fetch_add(1, std::memory_order_release);
+	for (size_t i = 1; i < partitions.size(); i++)
+		partitions[i]->thread.join();
+	stopping = false;
+}
+
+} // namespace sim
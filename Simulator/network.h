@@ -0,0 +1,67 @@
+// host simulator: many nodes running the driver at once on a shared Medium.
+// every node has its own Mcu and Sx1231 and runs the firmware in node.cpp as a coroutine. the firmware is a
+// shared object loaded once per partition; a partition is a thread, and switching between its nodes swaps the
+// driver's globals (the object's writable data) in and out.
+// time advances in rounds: all nodes run up to the oldest node's time plus a lookahead, then what they sent is
+// published (Medium::publish()). a frame can't make a difference at a receiver before its preamble and sync
+// word went by, so the lookahead stays below that: by default it is taken from the radios' settings at the
+// start of each round. RSSI, frame bytes and the collision check are exact, a node that asks the medium about
+// a time the others haven't reached yet waits for them. results don't depend on the thread count or lookahead
+#ifndef SIM_NETWORK_H
+#define SIM_NETWORK_H
+
+#include "mcu.h"
+#include "sx1231.h"
+#include "medium.h"
+#include "netnode.h"
+#include <atomic>
+#include <string>
+
+namespace sim {
+
+class Network
+{
+public:
+	// lookaheadNs 0: the shortest preamble and sync word on air, less 10%
+	Network(Medium& medium, const char* firmware, int partitions, uint64_t lookaheadNs = 0);
+	~Network();
+
+	// a node running the firmware with this configuration, its radio gets the index as Sx1231::id()
+	int add(const NodeConfig& config, double x, double y);
+	int size() const { return (int) nodes.size(); }
+	NodeConfig& config(int i);
+	Mcu& mcu(int i);
+	Sx1231& radio(int i);
+	// a global of the firmware as node i has it, false if there is no such symbol
+	bool peek(int i, const char* symbol, void* value, size_t size);
+
+	void run(uint64_t untilNs);
+	uint64_t rounds;
+
+	struct Node;
+	struct Partition;
+
+private:
+	void load(Partition& p);
+	void round(Partition& p);
+	void resume(Partition& p, Node* n);
+	void worker(int index, uint64_t seen);
+	void wait(uint64_t ns);
+	static void nodeStart();
+	static void horizonReached(void* node);
+
+	Medium& medium;
+	std::string firmware;
+	uint64_t lookahead;
+	std::vector<Node*> nodes;
+	std::vector<Partition*> partitions;
+	uint64_t epoch; // every node got at least this far
+	uint64_t horizon; // and runs up to here in the current round
+	std::atomic<uint64_t> generation; // round count the worker threads follow
+	std::atomic<int> pending; // workers still in the current round
+	bool stopping;
+};
+
+} // namespace sim
+
+#endif
@@ -0,0 +1,127 @@
+// host simulator: firmware of one node in a network run (rfm69net). built as a shared object, network.cpp loads
+// a copy per partition and swaps the driver's globals in and out as it switches between the nodes of one copy
+#include <math.h>
+#include "netnode.h"
+
+namespace sim { Hal* hal; }
+
+#define RF69_FHSS_CHANNELS RF69_FHSS_CHANNELS_868 // 868.0-869.4MHz, around where rfm69net puts the network
+#include "../RFM69.h"
+
+static sim::NodeConfig* config;
+static uint32_t rng;
+static uint16_t lastSeq[256]; // gateway: last reading of each sensor, 0 = none yet
+
+static uint32_t random32()
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng;
+}
+
+static void idle(uint64_t ns)
+{
+	sim::hal->delayNs(ns);
+}
+
+// receives, acknowledges and counts, forever. with RF69_TDMA it sends the beacons and hands out the slots, with
+// RF69_FHSS it sets the hops
+static void gateway()
+{
+#ifdef RF69_TDMA
+	tdmaBegin(config->nodeId);
+#endif
+#ifdef RF69_FHSS
+	fhssBegin(config->nodeId);
+#endif
+	for (;;)
+	{
+#ifdef RF69_TDMA
+		tdmaPoll();
+#endif
+#ifdef RF69_FHSS
+		fhssPoll();
+#endif
+		if (!receiveDone())
+		{
+			idle(50000);
+			continue;
+		}
+		config->results.received++;
+		uint16_t seq = DATALEN >= 2 ? DATA[0] | DATA[1] << 8 : 0;
+		if (seq != lastSeq[SENDERID])
+			config->results.unique++;
+		lastSeq[SENDERID] = seq;
+		if (ACKRequested())
+		{
+			sendACK();
+			config->results.acksSent++;
+		}
+	}
+}
+
+// sleeps an exponentially distributed while, wakes up and sends a reading with sendWithRetry(), or with RF69_TDMA
+// in its slot with tdmaSend(), or with RF69_FHSS over the hops with fhssSend()
+static void sensor()
+{
+	uint8_t reading[RF69_MAX_DATA_LEN] = { 0 };
+	uint16_t seq = 0;
+#ifdef RF69_TDMA
+	tdmaBegin(config->gatewayId);
+#endif
+#ifdef RF69_FHSS
+	fhssBegin(config->gatewayId);
+#endif
+	for (;;)
+	{
+		sleep();
+		double u = (random32() + 1.0) / 4294967297.0;
+		idle((uint64_t) (-log(u) * config->periodMs * 1000000.0));
+		if (++seq == 0)
+			seq = 1;
+		reading[0] = seq;
+		reading[1] = seq >> 8;
+		uint64_t start = sim::hal->timeNs();
+		config->results.sent++;
+#ifdef RF69_TDMA
+		if (tdmaSend(config->gatewayId, reading, config->payload, config->retries, config->retryWaitMs))
+#elif defined(RF69_FHSS)
+		if (fhssSend(config->gatewayId, reading, config->payload, config->retries, config->retryWaitMs))
+#else
+		if (sendWithRetry(config->gatewayId, reading, config->payload, config->retries, config->retryWaitMs))
+#endif
+		{
+			config->results.acked++;
+			config->results.ackedNs += sim::hal->timeNs() - start;
+		}
+	}
+}
+
+// another system's transmitter next to the gateway: 61 byte frames back to back on config->jamHz, on a network
+// id of its own and without CSMA
+static void jammer()
+{
+	uint8_t noise[RF69_MAX_DATA_LEN] = { 0 };
+	setFrequency(config->jamHz);
+	for (;;)
+	{
+		sendFrame(RF69_BROADCAST_ADDR, noise, sizeof(noise));
+		idle(1000000);
+	}
+}
+
+extern "C" void nodeMain(sim::NodeConfig* c)
+{
+	config = c;
+	sim::hal = c->hal;
+	rng = c->seed | 1;
+	rfm69_init(c->band, c->nodeId, c->networkId);
+	setPowerLevel(c->powerLevel);
+	if (c->role == sim::NODE_GATEWAY)
+		gateway();
+	else if (c->role == sim::NODE_JAMMER)
+		jammer();
+	else
+		sensor();
+}
@@ -0,0 +1,132 @@
+// host simulator: throughput and latency of the driver for every modem profile and payload size, as CSV on stdout.
+// one row per profile and payload (1..61 bytes): airtime of the frame, send() latency, CPU cycles and SPI bytes,
+// sendWithRetry() round trip against a peer that answers PEER_TURNAROUND_US after the frame ended, goodput over
+// that round trip, and what receiving the same frame costs (DIO0 interrupt cycles, SPI bytes, frame end to
+// receiveDone()). deterministic, so two driver versions can be compared with diff. see README.md, "Host simulator"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mcu.h"
+#include "sx1231.h"
+#include "air.h"
+
+namespace sim { Hal* hal; }
+
+#include "../RFM69.h"
+
+#define PEER 2
+#define PEER_TURNAROUND_US 1000 // frame received to ACK on air, a node answering from its main loop
+#define POLL_US 10 // receive loop granularity
+
+static sim::Mcu simMcu;
+static sim::ScriptedAir simAir;
+static sim::Sx1231 simRadio;
+
+struct Snapshot
+{
+	uint64_t ns, cycles, spiBytes, isrCycles, airNs;
+};
+
+static Snapshot snapshot()
+{
+	Snapshot s;
+	s.ns = simMcu.ns();
+	s.cycles = simMcu.cycles();
+	s.spiBytes = simMcu.stats.spiBytes;
+	s.isrCycles = simMcu.stats.isrCycles[sim::Mcu::VEC_INT5];
+	s.airNs = simRadio.stats.txAirNs;
+	return s;
+}
+
+static void idle(uint32_t us)
+{
+	simMcu.delayNs(us * 1000ull);
+}
+
+static void peerAck(const sim::AirFramePtr& frame)
+{
+	const std::vector<uint8_t>& d = frame->data;
+	if (frame->truncated || d.size() < 4 || d[1] != PEER || !(d[3] & RFM69_CTL_REQACK))
+		return;
+	simAir.inject(simAir.packet(frame->end + PEER_TURNAROUND_US * 1000ull, d[2], PEER, RFM69_CTL_SENDACK, "", 0));
+}
+
+struct Profile
+{
+	uint8_t id;
+	uint32_t bitrate, fdev;
+};
+
+#define BENCH_PROFILE(br, fdev) { RF69_MODEM_##br, br, fdev },
+static const Profile profiles[] = { RF69_MODEM_PROFILES(BENCH_PROFILE) };
+
+static uint8_t run(const Profile& p)
+{
+	uint8_t payload[RF69_MAX_DATA_LEN];
+	uint8_t failures = 0;
+	for (uint8_t i = 0; i < sizeof(payload); i++)
+		payload[i] = 'a' + i % 26;
+	setModemProfile(p.id);
+	send(PEER, payload, 1); // the first frame after a profile change writes a few more registers
+	idle(1000);
+	for (uint8_t len = 1; len <= RF69_MAX_DATA_LEN; len++)
+	{
+		Snapshot s0 = snapshot();
+		send(PEER, payload, len);
+		Snapshot s1 = snapshot();
+		idle(1000);
+
+		Snapshot s2 = snapshot();
+		if (!sendWithRetry(PEER, payload, len, 0, 255))
+			failures++;
+		Snapshot s3 = snapshot();
+
+		receiveDone();
+		idle(2000); // receiver up
+		sim::AirFramePtr f = simAir.packet(simMcu.ns() + 500000, 1, PEER, 0, payload, len);
+		simAir.inject(f);
+		Snapshot s4 = snapshot();
+		uint8_t got = 0;
+		while (!got && simMcu.ns() < f->end + 100000000ull)
+			if (!(got = receiveDone()))
+				idle(POLL_US);
+		Snapshot s5 = snapshot();
+		if (!got || DATALEN != len || memcmp((const void*) DATA, payload, len))
+			failures++;
+
+		printf("%lu,%lu,%u,%.1f,%.1f,%llu,%llu,%.1f,%.0f,%llu,%llu,%.1f\n", (unsigned long) p.bitrate,
+		       (unsigned long) p.fdev, len, (s1.airNs - s0.airNs) / 1000.0, (s1.ns - s0.ns) / 1000.0,
+		       (unsigned long long) (s1.cycles - s0.cycles), (unsigned long long) (s1.spiBytes - s0.spiBytes),
+		       (s3.ns - s2.ns) / 1000.0, len * 8e9 / (s3.ns - s2.ns), (unsigned long long) (s5.isrCycles - s4.isrCycles),
+		       (unsigned long long) (s5.spiBytes - s4.spiBytes), s5.ns > f->end ? (s5.ns - f->end) / 1000.0 : 0.0);
+		idle(1000);
+	}
+	return failures;
+}
+
+// rfm69bench [bitrate ...]: all profiles, or just these
+int main(int argc, char** argv)
+{
+	sim::hal = &simMcu;
+	simMcu.attach(&simRadio);
+	simMcu.setVector(sim::Mcu::VEC_INT5, INT5_vect);
+	simMcu.setVector(sim::Mcu::VEC_TIMER1_COMPA, TIMER1_COMPA_vect);
+	simAir.attach(&simRadio);
+	simAir.onTransmit = peerAck;
+	rfm69_init(RF_868MHZ, 1, 100);
+
+	printf("bitrate,fdev,payload,airtime_us,send_us,send_cycles,send_spi_bytes,rtt_us,goodput_bps,rx_isr_cycles,"
+	       "rx_spi_bytes,rx_latency_us\n");
+	unsigned failures = 0;
+	for (size_t i = 0; i < sizeof(profiles) / sizeof(profiles[0]); i++)
+	{
+		bool selected = argc < 2;
+		for (int a = 1; a < argc; a++)
+			selected |= strtoul(argv[a], 0, 10) == profiles[i].bitrate;
+		if (selected)
+			failures += run(profiles[i]);
+	}
+	if (failures)
+		fprintf(stderr, "%u frames not sent, acknowledged or received\n", failures);
+	return failures ? 1 : 0;
+}
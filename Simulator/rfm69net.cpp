@@ -0,0 +1,153 @@
+// host simulator: a star network. sensors spread over a disc send readings with sendWithRetry() to a gateway in
+// the middle, which acknowledges them. reports what got through, what it cost in retries and airtime, and where
+// the frames went (collisions, CSMA, queue). see README.md, "Host simulator"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <chrono>
+#include <thread>
+#include "network.h"
+#include "../RFM69registers.h" // RF_868MHZ, the driver itself is in node.cpp
+
+#define GATEWAY 1
+
+static void usage()
+{
+	fprintf(stderr, "usage: rfm69net [-n sensors] [-t seconds] [-p period ms] [-r radius m] [-l payload] [-R retries]\n"
+	                "                [-w retry wait ms, 0 adapts] [-P power 0-31] [-J jammer Hz] [-j threads] [-L lookahead us] [-s seed]\n"
+	                "                [firmware.so]\n");
+	exit(2);
+}
+
+int main(int argc, char** argv)
+{
+	int sensors = 400, seconds = 60, periodMs = 30000, payload = 20, retries = 2, retryWaitMs = 40, power = 31;
+	int threads = (int) std::thread::hardware_concurrency(), lookaheadUs = 0;
+	double radius = 500;
+	uint32_t seed = 1, jamHz = 0;
+	int opt;
+	while ((opt = getopt(argc, argv, "n:t:p:r:l:R:w:P:J:j:L:s:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'n': sensors = atoi(optarg); break;
+			case 't': seconds = atoi(optarg); break;
+			case 'p': periodMs = atoi(optarg); break;
+			case 'r': radius = atof(optarg); break;
+			case 'l': payload = atoi(optarg); break;
+			case 'R': retries = atoi(optarg); break;
+			case 'w': retryWaitMs = atoi(optarg); break;
+			case 'P': power = atoi(optarg); break;
+			case 'J': jamHz = (uint32_t) atol(optarg); break;
+			case 'j': threads = atoi(optarg); break;
+			case 'L': lookaheadUs = atoi(optarg); break;
+			case 's': seed = (uint32_t) atol(optarg); break;
+			default: usage();
+		}
+	}
+	if (sensors < 1 || sensors > 253 * 256 || payload < 2 || payload > 61 || retryWaitMs > 255 || threads < 1)
+		usage();
+	const char* firmware = optind < argc ? argv[optind] : "./rfm69node.so";
+
+	sim::Medium::Params params;
+	params.seed = seed;
+	sim::Medium medium(params);
+	if (threads > sensors + 1 + !!jamHz)
+		threads = sensors + 1 + !!jamHz;
+	sim::Network net(medium, firmware, threads, lookaheadUs * 1000ull);
+
+	// node ids are 8 bit: beyond 253 sensors the network ids tell the gateways apart, one gateway per 253
+	int gateways = (sensors + 252) / 253;
+	srand(seed);
+	for (int g = 0; g < gateways; g++)
+	{
+		sim::NodeConfig c = sim::NodeConfig();
+		c.role = sim::NODE_GATEWAY;
+		c.nodeId = GATEWAY;
+		c.networkId = 100 + g;
+		c.band = RF_868MHZ;
+		c.powerLevel = power;
+		c.seed = rand();
+		net.add(c, g * 0.5, 0); // colocated
+	}
+	for (int i = 0; i < sensors; i++)
+	{
+		sim::NodeConfig c = sim::NodeConfig();
+		c.role = sim::NODE_SENSOR;
+		c.nodeId = 2 + i % 253;
+		c.networkId = 100 + i / 253;
+		c.gatewayId = GATEWAY;
+		c.band = RF_868MHZ;
+		c.powerLevel = power;
+		c.payload = payload;
+		c.retries = retries;
+		c.retryWaitMs = retryWaitMs;
+		c.periodMs = periodMs;
+		c.seed = rand();
+		double r = radius * sqrt(rand() / (RAND_MAX + 1.0)), a = 2 * M_PI * rand() / (RAND_MAX + 1.0);
+		net.add(c, r * cos(a), r * sin(a));
+	}
+	// -J: another system sending all the time on one channel, 20m from the gateway
+	if (jamHz)
+	{
+		sim::NodeConfig c = sim::NodeConfig();
+		c.role = sim::NODE_JAMMER;
+		c.nodeId = 1;
+		c.networkId = 99;
+		c.band = RF_868MHZ;
+		c.powerLevel = power;
+		c.jamHz = jamHz;
+		c.seed = rand();
+		net.add(c, 20, 0);
+	}
+
+	std::chrono::steady_clock::time_point wall = std::chrono::steady_clock::now();
+	net.run(seconds * 1000000000ull);
+	double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall).count();
+
+	uint64_t sent = 0, acked = 0, ackedNs = 0, txFrames = 0, received = 0, unique = 0, acksSent = 0;
+	uint64_t crcErrors = 0, filtered = 0, dropped = 0;
+	double txDbm = 0, rxOnNs = 0;
+	for (int i = 0; i < net.size(); i++)
+	{
+		const sim::NodeResults& r = net.config(i).results;
+		const sim::Sx1231::Stats& s = net.radio(i).stats;
+		sent += r.sent;
+		acked += r.acked;
+		ackedNs += r.ackedNs;
+		received += r.received;
+		unique += r.unique;
+		acksSent += r.acksSent;
+		if (net.config(i).role == sim::NODE_GATEWAY)
+		{
+			crcErrors += s.rxCrcErrors;
+			filtered += s.rxFiltered;
+			uint16_t rxDropped = 0;
+			net.peek(i, "rxDropped", &rxDropped, sizeof(rxDropped));
+			dropped += rxDropped;
+		}
+		else if (net.config(i).role == sim::NODE_SENSOR)
+		{
+			txFrames += s.txFrames;
+			txDbm += s.txDbmSum;
+			rxOnNs += net.radio(i).receiverOnNs();
+		}
+	}
+	sim::Medium::Stats m = medium.stats();
+	printf("%d sensors, %d gateway(s), %d s, reading every %d ms, %d bytes, %d retries %d ms apart\n", sensors, gateways,
+	       seconds, periodMs, payload, retries, retryWaitMs);
+	printf("simulated in %.1f s on %d thread(s), %llu rounds\n", wallSeconds, threads, (unsigned long long) net.rounds);
+	printf("sensors: %llu readings, %llu acknowledged (%.1f%%), %.2f frames per reading, %.1f ms to the ACK, "
+	       "%.1f dBm average, receiver on %.2f%% of the time\n", (unsigned long long) sent, (unsigned long long) acked,
+	       sent ? 100.0 * acked / sent : 0.0, sent ? (double) txFrames / sent : 0.0, acked ? ackedNs / 1e6 / acked : 0.0,
+	       txFrames ? txDbm / txFrames : 0.0, 100.0 * rxOnNs / sensors / (seconds * 1e9));
+	printf("gateway: %llu frames received, %llu unique readings (%.1f%%), %llu ACKs, %llu CRC errors, %llu filtered, "
+	       "%llu receive queue overflows\n", (unsigned long long) received, (unsigned long long) unique,
+	       sent ? 100.0 * unique / sent : 0.0, (unsigned long long) acksSent, (unsigned long long) crcErrors,
+	       (unsigned long long) filtered, (unsigned long long) dropped);
+	printf("air: %llu frames, airtime %.1f%% of the run, %llu receptions lost to collisions, %llu survived\n",
+	       (unsigned long long) m.frames, 100.0 * m.airNs / (seconds * 1e9), (unsigned long long) m.collisions,
+	       (unsigned long long) m.deliveries);
+	return 0;
+}
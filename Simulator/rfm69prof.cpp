@@ -0,0 +1,185 @@
+// host simulator: per function CPU cycles and stack depth of the driver, as a regression table on stdout. the driver
+// runs a fixed script (init, send(), sendWithRetry() against a peer that sends the ACKs, receiving, readRSSI(),
+// sleep()) and every function of it is timed by -finstrument-functions, see the Makefile.
+// see README.md, "Host simulator"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <dlfcn.h>
+#include <cxxabi.h>
+#include <map>
+#include <string>
+#include "mcu.h"
+#include "sx1231.h"
+#include "air.h"
+
+namespace sim { Hal* hal; }
+
+#include "../RFM69.h"
+
+#define PEER 2
+#define FRAMES 4 // per phase
+
+static sim::Mcu simMcu;
+static sim::ScriptedAir simAir;
+static sim::Sx1231 simRadio;
+
+// what one function cost over all its calls. cycles leave out the interrupt handlers that ran meanwhile (they have
+// rows of their own) and the time the MCU slept, stack is the deepest point below the caller's stack pointer
+struct Cost
+{
+	uint64_t calls, cycles;
+	uint32_t minCycles, maxCycles, stack;
+};
+
+// a call in progress
+struct Frame
+{
+	void* fn;
+	uint64_t cycle, sleep; // at the entry
+	uint64_t excluded; // cycles of the interrupt handlers that ran inside it
+	uintptr_t base, deepest; // caller's stack pointer, lowest one a callee was entered with
+	bool vector;
+};
+
+static std::map<void*, Cost> costs;
+static Frame frames[64];
+static int depth = 0;
+static bool profiling = false;
+
+extern "C" void __cyg_profile_func_enter(void* fn, void* site)
+{
+	if (!profiling || depth == (int) (sizeof(frames) / sizeof(frames[0])))
+		return;
+	// the frame pointer of the instrumented function sits just below its caller's stack pointer (return address,
+	// saved frame pointer), this hook's one just below the function's own frame
+	uintptr_t here = (uintptr_t) __builtin_frame_address(0);
+	for (int i = depth - 1; i >= 0; i--)
+	{
+		if (here < frames[i].deepest)
+			frames[i].deepest = here;
+		if (frames[i].vector)
+			break; // an interrupt handler's stack is its own row, not the function it interrupted
+	}
+	Frame& f = frames[depth++];
+	f.fn = fn;
+	f.cycle = simMcu.cycles();
+	f.sleep = simMcu.stats.sleepCycles;
+	f.excluded = 0;
+	f.base = (uintptr_t) __builtin_frame_address(1) + 2 * sizeof(void*);
+	f.deepest = here;
+	f.vector = fn == (void*) INT5_vect || fn == (void*) TIMER1_COMPA_vect;
+}
+
+extern "C" void __cyg_profile_func_exit(void* fn, void* site)
+{
+	if (!profiling || !depth || frames[depth - 1].fn != fn)
+		return;
+	Frame& f = frames[--depth];
+	uint64_t spent = simMcu.cycles() - f.cycle;
+	uint64_t cycles = spent - f.excluded - (simMcu.stats.sleepCycles - f.sleep);
+	if (f.vector) // with the entry and exit the MCU charges around it
+	{
+		spent += sim::CYCLES_ISR_ENTRY + sim::CYCLES_ISR_EXIT;
+		cycles += sim::CYCLES_ISR_ENTRY + sim::CYCLES_ISR_EXIT;
+	}
+	if (depth)
+		frames[depth - 1].excluded += f.vector ? spent : f.excluded; // the whole handler, or the ones inside
+	Cost& c = costs[fn];
+	if (!c.calls)
+		c.minCycles = ~0u;
+	c.calls++;
+	c.cycles += cycles;
+	if (cycles < c.minCycles)
+		c.minCycles = (uint32_t) cycles;
+	if (cycles > c.maxCycles)
+		c.maxCycles = (uint32_t) cycles;
+	if (f.base - f.deepest > c.stack)
+		c.stack = (uint32_t) (f.base - f.deepest);
+}
+
+// the plain name of the function at fn, without its parameter list
+static std::string nameOf(void* fn)
+{
+	Dl_info info;
+	if (!dladdr(fn, &info) || !info.dli_sname)
+	{
+		char buf[32];
+		snprintf(buf, sizeof(buf), "%p", fn);
+		return buf;
+	}
+	int status;
+	char* plain = abi::__cxa_demangle(info.dli_sname, 0, 0, &status);
+	std::string name = status == 0 ? plain : info.dli_sname;
+	free(plain);
+	return name.substr(0, name.find('('));
+}
+
+// PEER acknowledges what it is sent, 1ms after the frame ends
+static void peerAck(const sim::AirFramePtr& frame)
+{
+	const std::vector<uint8_t>& d = frame->data;
+	if (!frame->truncated && d.size() >= 4 && d[1] == PEER && (d[3] & RFM69_CTL_REQACK))
+		simAir.inject(simAir.packet(frame->end + 1000000, d[2], PEER, RFM69_CTL_SENDACK, "", 0));
+}
+
+int main()
+{
+	sim::hal = &simMcu;
+	simMcu.attach(&simRadio);
+	simMcu.setVector(sim::Mcu::VEC_INT5, INT5_vect);
+	simMcu.setVector(sim::Mcu::VEC_TIMER1_COMPA, TIMER1_COMPA_vect);
+	simAir.attach(&simRadio);
+	simAir.onTransmit = peerAck;
+
+	static const char hello[] = "hello from the profiler";
+	profiling = true;
+	rfm69_init(RF_868MHZ, 1, 100);
+	for (uint8_t i = 0; i < FRAMES; i++)
+		send(PEER, hello, sizeof(hello) - 1);
+	for (uint8_t i = 0; i < FRAMES; i++)
+		sendWithRetry(PEER, hello, sizeof(hello) - 1, 2, 40);
+	receiveDone();
+	uint64_t next = simMcu.ns() + 2000000;
+	for (uint8_t i = 0; i < FRAMES; i++)
+	{
+		sim::AirFramePtr f = simAir.packet(next, 1, PEER, RFM69_CTL_REQACK, hello, sizeof(hello) - 1);
+		simAir.inject(f);
+		next = f->end + 20000000; // room for the ACK
+	}
+	uint8_t received = 0;
+	unsigned long start = millis();
+	while (received < FRAMES && millis() - start < 2000)
+	{
+		if (receiveDone())
+			received++;
+		else
+			simMcu.delayNs(100000);
+	}
+	readRSSI();
+	sleep();
+	profiling = false;
+
+	std::map<std::string, Cost> table; // by name, so two runs diff line by line
+	for (std::map<void*, Cost>::iterator i = costs.begin(); i != costs.end(); i++)
+		table[nameOf(i->first)] = i->second;
+	printf("%-24s %7s %10s %8s %8s %8s %6s\n", "function", "calls", "cycles", "min", "avg", "max", "stack");
+	uint32_t mainStack = 0, isrStack = 0;
+	for (std::map<std::string, Cost>::iterator i = table.begin(); i != table.end(); i++)
+	{
+		const Cost& c = i->second;
+		printf("%-24s %7llu %10llu %8u %8llu %8u %6u\n", i->first.c_str(), (unsigned long long) c.calls,
+		       (unsigned long long) c.cycles, c.minCycles, (unsigned long long) (c.cycles / c.calls), c.maxCycles,
+		       c.stack);
+		uint32_t& deepest = i->first == "INT5_vect" || i->first == "TIMER1_COMPA_vect" ? isrStack : mainStack;
+		if (c.stack > deepest)
+			deepest = c.stack;
+	}
+	printf("stack: %u bytes below main, %u more in an interrupt handler (host frames)\n", mainStack, isrStack);
+	if (received != FRAMES)
+	{
+		printf("FAILED: received %u of %u frames\n", received, FRAMES);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,675 @@
+// host simulator: runs the unmodified driver against the SX1231 model and reports, per API call, the simulated
+// time, CPU cycles, SPI traffic, time spent in interrupt handlers and airtime. see README.md, "Host simulator"
+#include <stdio.h>
+#include <string.h>
+#include "mcu.h"
+#include "sx1231.h"
+#include "air.h"
+#include "aes.h"
+
+namespace sim { Hal* hal; }
+
+#define RF69_MESSAGES
+#define RF69_AGGREGATE
+#define RF69_COMPRESS
+#define RF69_TDMA
+#define RF69_FHSS
+#define RF69_FHSS_CHANNELS RF69_FHSS_CHANNELS_868
+#define RF69_MSG_MAX 2048
+#include "../RFM69.h"
+
+static sim::Mcu simMcu;
+static sim::ScriptedAir simAir;
+static sim::Sx1231 simRadio;
+static const uint8_t PEER = 2; // the scripted node on the other end
+static const char KEY[] = "sampleEncryptKey";
+static uint8_t autoAck = 1; // answer REQACK frames from PEER
+static uint8_t arqLoss = 0; // PEER misses every arqLoss-th sendWindowed() frame, 0 = none
+static uint32_t arqFrames = 0;
+static uint8_t arqNext, arqMask; // PEER's receive window, as the driver keeps it
+static uint8_t arqFirst; // sequence number of the first frame of the transfer
+static std::vector<uint8_t> arqData; // what PEER got, by sequence number
+static std::vector<uint8_t> lastAck; // payload of the last ACK the driver sent
+static uint8_t acksTo[256]; // ACKs the driver sent, per node
+static unsigned rssiAcks = 0; // and the ones with the RSSI in front
+static unsigned aggrMessages = 0; // messages PEER found in sendAggregated() frames
+static uint8_t zMethod, zLen; // RF69_Z_* and length of the last sendCompressed() frame PEER got
+static uint64_t lastStart; // when the last frame the driver sent started
+static uint32_t lastFrf; // and its carrier
+static std::vector<uint8_t> lastBeacon; // payload of the last TDMA or hop beacon the driver sent
+static uint32_t deafFrf = 0; // PEER doesn't hear frames on this carrier, as if it were jammed there
+
+struct Snapshot
+{
+	uint64_t ns, cycles, spiBytes, spiTransactions, isrCalls, isrCycles, airNs;
+};
+
+static Snapshot snapshot()
+{
+	Snapshot s;
+	s.ns = simMcu.ns();
+	s.cycles = simMcu.cycles();
+	s.spiBytes = simMcu.stats.spiBytes;
+	s.spiTransactions = simMcu.stats.spiTransactions;
+	s.isrCalls = simMcu.stats.isrCalls[sim::Mcu::VEC_INT5];
+	s.isrCycles = simMcu.stats.isrCycles[sim::Mcu::VEC_INT5];
+	s.airNs = simRadio.stats.txAirNs;
+	return s;
+}
+
+static void report(const char* call, const Snapshot& before)
+{
+	Snapshot after = snapshot();
+	printf("%-28s %10.1f %10llu %7llu %9llu %5llu %10llu %10.1f\n", call, (after.ns - before.ns) / 1000.0,
+	       (unsigned long long) (after.cycles - before.cycles),
+	       (unsigned long long) (after.spiTransactions - before.spiTransactions),
+	       (unsigned long long) (after.spiBytes - before.spiBytes),
+	       (unsigned long long) (after.isrCalls - before.isrCalls),
+	       (unsigned long long) (after.isrCycles - before.isrCycles), (after.airNs - before.airNs) / 1000.0);
+}
+
+#define MEASURE(name, code) do { Snapshot before_ = snapshot(); code; report(name, before_); } while (0)
+
+// the application doing something else for a while
+static void idle(uint32_t us)
+{
+#ifdef RF69_RX_POLLED
+	// the main loop of a RF69_RX_POLLED sketch runs the bottom half between its other work
+	for (; us > 100; us -= 100)
+	{
+		simMcu.delayNs(100000);
+		pollInterrupt();
+	}
+#endif
+	simMcu.delayNs(us * 1000ull);
+}
+
+static uint8_t waitFrame(uint32_t timeoutMs)
+{
+	for (uint32_t us = 0; us < timeoutMs * 1000; us += 100)
+	{
+		if (receiveDone())
+			return 1;
+		idle(100);
+	}
+	return 0;
+}
+
+// PEER as the receiving end of sendWindowed(): frames go to arqData by sequence number, each chunk maxDataLen() - 1 bytes.
+// sendMessage() fragments by their offset
+static void peerArq(const sim::AirFramePtr& frame)
+{
+	const std::vector<uint8_t>& d = frame->data;
+	uint8_t ext = d[3] & RFM69_CTL_FRAG ? 4 : 1;
+	if (d[0] < 3 + ext || (arqLoss && ++arqFrames % arqLoss == 0))
+		return;
+	uint8_t seq = d[4] - arqFirst, at = d[4] - arqNext, length = d[0] - 3 - ext;
+	size_t offset = ext == 4 ? d[6] | (d[7] & 0x7F) << 8 : seq * (maxDataLen() - 1u);
+	if (at < RF69_ARQ_WINDOW)
+	{
+		arqMask |= 1 << at;
+		if (arqData.size() < offset + length)
+			arqData.resize(offset + length);
+		std::copy(d.begin() + 4 + ext, d.begin() + 4 + ext + length, arqData.begin() + offset);
+		while (arqMask & 1)
+		{
+			arqMask >>= 1;
+			arqNext++;
+		}
+	}
+	uint8_t ack[2] = { arqNext, arqMask };
+	if (d[3] & RFM69_CTL_REQACK)
+		simAir.inject(simAir.packet(frame->end + 1000000, d[2], PEER, RFM69_CTL_SENDACK | RFM69_CTL_ARQ, ack, 2));
+}
+
+// PEER acknowledges what it is sent, 1ms after the frame ends
+static void peerAck(const sim::AirFramePtr& frame)
+{
+	const std::vector<uint8_t>& d = frame->data;
+	lastStart = frame->start;
+	lastFrf = frame->frf;
+	if (!frame->truncated && d.size() >= 4 && (d[3] & RFM69_CTL_BEACON) == RFM69_CTL_BEACON)
+		lastBeacon.assign(d.begin() + 4, d.begin() + 1 + d[0]);
+	else if (!frame->truncated && d.size() >= 4 && (d[3] & RFM69_CTL_SENDACK))
+	{
+		acksTo[d[1]]++;
+		rssiAcks += (d[3] & RFM69_CTL_RSSI) != 0;
+		if (d[1] == PEER)
+			lastAck.assign(d.begin() + 4, d.begin() + 1 + d[0]);
+	}
+	if (!autoAck || frame->truncated || d.size() < 4 || d[1] != PEER || frame->frf == deafFrf)
+		return;
+	uint8_t sender = d[2], ctl = d[3];
+	if (readRegCached(REG_PACKETCONFIG2) & RF_PACKET2_AES_ON)
+	{
+		uint8_t plain[16];
+		sim::aesDecrypt((const uint8_t*) KEY, &d[2], plain);
+		sender = plain[0];
+		ctl = plain[1];
+	}
+	uint8_t ext = extLen(ctl);
+	for (size_t i = 4 + ext; (ctl & RFM69_CTL_AGGR) && i + d[i] < 1u + d[0]; i += 1 + d[i])
+		aggrMessages++; // only whole ones
+	if ((ctl & RFM69_CTL_COMPRESSED) && d[0] > 3 + ext)
+	{
+		zMethod = d[4 + ext] & 0xF0;
+		zLen = d[0] - 3 - ext;
+	}
+	if ((ctl & (RFM69_CTL_ARQ | RFM69_CTL_SENDACK)) == RFM69_CTL_ARQ)
+	{
+		peerArq(frame);
+		return;
+	}
+	if (ctl & RFM69_CTL_REQACK)
+		simAir.inject(simAir.packet(frame->end + 1000000, sender, PEER, RFM69_CTL_SENDACK, "", 0,
+		              (readRegCached(REG_PACKETCONFIG2) & RF_PACKET2_AES_ON) ? (const uint8_t*) KEY : 0));
+}
+
+int main()
+{
+	sim::hal = &simMcu;
+	simMcu.attach(&simRadio);
+	simMcu.setVector(sim::Mcu::VEC_INT5, INT5_vect);
+	simMcu.setVector(sim::Mcu::VEC_TIMER1_COMPA, TIMER1_COMPA_vect);
+	simAir.attach(&simRadio);
+	simAir.onTransmit = peerAck;
+
+	const char* hello = "hello from the simulator";
+	char long61[RF69_MAX_DATA_LEN];
+	memset(long61, 'x', sizeof(long61));
+	uint8_t failures = 0;
+
+	printf("%-28s %10s %10s %7s %9s %5s %10s %10s\n", "call", "us", "cycles", "spi tx", "spi bytes", "isr", "isr cycles",
+	       "airtime us");
+	MEASURE("rfm69_init", rfm69_init(RF_868MHZ, 1, 100));
+	MEASURE("readRSSI", readRSSI());
+	MEASURE("readTemperature", readTemperature());
+	MEASURE("send 24 bytes", send(PEER, hello, strlen(hello)));
+	MEASURE("send 61 bytes", send(PEER, long61, sizeof(long61)));
+	// the first backoff is a whole slot at least, wherever in the millisecond send() is called
+	for (int i = 0; i < 16; i++)
+	{
+		idle(1370);
+		uint64_t called = simMcu.ns();
+		send(PEER, hello, strlen(hello));
+		failures += lastStart - called < RF69_CSMA_SLOT_MS * 1000000ull;
+	}
+	// another node's frame is on the air: send() backs off with the MCU asleep, samples the channel a few times
+	// and goes once the frame has ended
+	sim::AirFramePtr busy = simAir.packet(simMcu.ns() + 1000000, 3, PEER, 0, long61, sizeof(long61));
+	simAir.inject(busy);
+	idle(3000);
+	uint64_t slept = simMcu.stats.sleepCycles;
+	MEASURE("send, busy channel", send(PEER, hello, strlen(hello)));
+	failures += lastStart < busy->end || !TXBUSY || TXBACKOFF < (busy->end - busy->start) / 2000000
+	         || (simMcu.stats.sleepCycles - slept) * 2 < simMcu.cyclesFor(TXBACKOFF * 1000000ull);
+	MEASURE("sendWithRetry 24 bytes", failures += !sendWithRetry(PEER, hello, strlen(hello), 2, 40));
+	autoAck = 0;
+	MEASURE("sendWithRetry, no ACK", failures += sendWithRetry(PEER, hello, strlen(hello), 2, 40));
+	autoAck = 1;
+	for (int i = 0; i < 8; i++) // learn the round trip to PEER
+		failures += !sendWithRetry(PEER, hello, strlen(hello), 2, RF69_RTO_AUTO);
+	MEASURE("sendWithRetry, auto RTO", failures += !sendWithRetry(PEER, hello, strlen(hello), 2, RF69_RTO_AUTO));
+	failures += TXATTEMPTS != 1 || !TXRTT || rtoOf(findPeer(PEER)) >= RF69_RTO_INIT_MS;
+	autoAck = 0;
+	MEASURE("sendWithRetry auto, no ACK", failures += sendWithRetry(PEER, hello, strlen(hello), 2, RF69_RTO_AUTO));
+	failures += TXATTEMPTS != 3 || TXRTT;
+	autoAck = 1;
+	MEASURE("sendWithRetry auto, backoff", failures += !sendWithRetry(PEER, hello, strlen(hello), 2, RF69_RTO_AUTO));
+	failures += TXATTEMPTS != 1 || findPeer(PEER)->backoff;
+	// the CSMA backoff idles the MCU, the sleep mode the application picked is back afterwards
+	set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+	MEASURE("sendWithRetry, app sleep mode", failures += !sendWithRetry(PEER, hello, strlen(hello), 2, 40));
+	failures += (MCUCR & _SLEEP_MODE_MASK) != SLEEP_MODE_PWR_DOWN;
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	uint64_t frames = simRadio.stats.txFrames;
+	for (int i = 0; i < 10; i++)
+		failures += !sendAggregated(PEER, "6bytes", 6);
+	idle((RF69_AGGR_DEADLINE_MS + 10) * 1000);
+	MEASURE("pollAggregated, 2 queued", failures += !pollAggregated());
+	failures += simRadio.stats.txFrames - frames != 2 || aggrMessages != 10;
+#ifdef RF69_LARGE_PACKETS
+	// a message longer than RF69_AGGR_LIMIT sends the queued one and then goes out alone
+	char longMsg[120];
+	memset(longMsg, 'x', sizeof(longMsg));
+	frames = simRadio.stats.txFrames;
+	failures += !sendAggregated(PEER, "6bytes", 6);
+	MEASURE("sendAggregated 120 bytes", failures += !sendAggregated(PEER, longMsg, sizeof(longMsg)));
+	failures += simRadio.stats.txFrames - frames != 2 || aggrMessages != 12;
+#endif
+	// the longest message fills the frame to the last byte, with RF69_SEQ the sequence number too
+	char fullMsg[RF69_DATA_LEN];
+	memset(fullMsg, 'x', sizeof(fullMsg));
+	unsigned messages = aggrMessages;
+	failures += !sendAggregated(PEER, fullMsg, maxDataLen() - 1);
+	MEASURE("flushAggregated, full frame", failures += !flushAggregated());
+	failures += aggrMessages != messages + 1;
+
+	// sensor records: the second one goes out as the difference to the first, after a lost ACK the next one doesn't
+	uint16_t record[6] = { 2150, 4520, 10132, 3010, 100, 870 };
+	MEASURE("sendCompressed, record", failures += !sendCompressed(PEER, record, sizeof(record), 2, 40));
+	record[0] += 3;
+	record[4]++;
+	MEASURE("sendCompressed, delta", failures += !sendCompressed(PEER, record, sizeof(record), 2, 40));
+	failures += zMethod != RF69_Z_DELTA || zLen != 7;
+	autoAck = 0;
+	failures += sendCompressed(PEER, record, sizeof(record), 0, 40);
+	autoAck = 1;
+	MEASURE("sendCompressed, after a loss", failures += !sendCompressed(PEER, record, sizeof(record), 2, 40));
+	failures += zMethod == RF69_Z_DELTA;
+	const char* text = "temp=21.5C temp=21.6C temp=21.6C temp=21.7C";
+	MEASURE("sendCompressed, 43 bytes text", failures += !sendCompressed(PEER, text, strlen(text), 2, 40));
+	failures += zMethod != RF69_Z_LZ || zLen >= strlen(text);
+	MEASURE("sendAsync + sendDone", sendAsync(PEER, hello, strlen(hello)); while (!sendDone()) idle(100));
+
+	char bulk[600];
+	for (size_t i = 0; i < sizeof(bulk); i++)
+		bulk[i] = 'a' + i % 23;
+	arqFirst = arqNext = findPeer(PEER)->txSeq; // starts at random
+	MEASURE("sendWindowed 600 bytes", failures += !sendWindowed(PEER, bulk, sizeof(bulk), 2, 40));
+	failures += arqData.size() != sizeof(bulk) || memcmp(&arqData[0], bulk, sizeof(bulk));
+	arqData.clear();
+	arqFirst = arqNext;
+	arqLoss = 3;
+	MEASURE("sendWindowed, 1 in 3 lost", failures += !sendWindowed(PEER, bulk, sizeof(bulk), 2, 40));
+	failures += arqData.size() != sizeof(bulk) || memcmp(&arqData[0], bulk, sizeof(bulk));
+	arqData.clear();
+	MEASURE("sendMessage 600 bytes, lossy", failures += !sendMessage(PEER, bulk, sizeof(bulk), 2, 40));
+	failures += arqData.size() != sizeof(bulk) || memcmp(&arqData[0], bulk, sizeof(bulk));
+	arqLoss = 0;
+
+	receiveDone();
+	idle(2000); // receiver up
+	simAir.inject(simAir.packet(simMcu.ns() + 500000, 1, PEER, 0, hello, strlen(hello)));
+	MEASURE("receive 24 bytes", failures += !waitFrame(100));
+	failures += DATALEN != strlen(hello) || memcmp((const char*) DATA, hello, DATALEN) || SENDERID != PEER;
+	simAir.inject(simAir.packet(simMcu.ns() + 500000, 1, PEER, 0, hello, strlen(hello)), false);
+	MEASURE("receive, bad CRC", failures += waitFrame(100));
+	simAir.inject(simAir.packet(simMcu.ns() + 500000, 3, PEER, 0, hello, strlen(hello)));
+	uint64_t next;
+	MEASURE("receive, other node", failures += waitFrame(100));
+	// the radio's address filter dropped that one: the frames after it still have to come through
+	uint16_t rejected = rxRejected;
+	next = simMcu.ns() + 500000;
+	for (int i = 0; i < 3; i++)
+	{
+		sim::AirFramePtr f = simAir.packet(next, 1, PEER, 0, hello, strlen(hello));
+		simAir.inject(f);
+		next = f->end + 3000000;
+	}
+	uint8_t own = 0;
+	MEASURE("receive, 3 after a filtered one", while (waitFrame(50)) own += DATALEN == strlen(hello));
+	failures += own != 3 || rxRejected != rejected;
+#ifndef RF69_LARGE_PACKETS
+	// a frame a byte longer than any this driver sends is dropped, not cut short, and the one after it comes through
+	char tooLong[RF69_DATA_LEN + 1];
+	memset(tooLong, 'x', sizeof(tooLong));
+	sim::AirFramePtr oversized = simAir.packet(simMcu.ns() + 500000, 1, PEER, 0, tooLong, sizeof(tooLong));
+	simAir.inject(oversized);
+	simAir.inject(simAir.packet(oversized->end + 3000000, 1, PEER, 0, hello, strlen(hello)));
+	own = 0;
+	MEASURE("receive, too long", while (waitFrame(200)) own += DATALEN == strlen(hello) ? 1 : 100);
+	failures += own != 1 || rxRejected != rejected + 1;
+#endif
+
+	// sendWindowed() frames 200..203 from PEER, out of order and with a repeat: 4 deliveries, then ACK "all up to 204"
+	const uint8_t order[] = { 200, 202, 201, 201, 203 };
+	next = simMcu.ns() + 500000;
+	for (size_t i = 0; i < sizeof(order); i++)
+	{
+		uint8_t frame[1 + sizeof("reading")] = { order[i] };
+		memcpy(frame + 1, "reading", sizeof("reading") - 1);
+		sim::AirFramePtr f = simAir.packet(next, 1, PEER, RFM69_CTL_ARQ | (i == sizeof(order) - 1 ? RFM69_CTL_REQACK : 0),
+		                                   frame, sizeof(frame) - 1);
+		simAir.inject(f);
+		next = f->end + 3000000;
+	}
+	uint16_t duplicates = rxDuplicates;
+	uint8_t delivered = 0;
+	lastAck.clear();
+	MEASURE("receive windowed, 5 frames", while (waitFrame(50)) delivered += DATALEN == 7 && !ACKRequested());
+	failures += delivered != 4 || rxDuplicates != duplicates + 1 || lastAck.size() != 2 || lastAck[0] != 204 || lastAck[1];
+	// PEER restarts and sends 202, 203 again: a new transfer, not repeats of the old one
+	idle(RF69_ARQ_HOLD_MS * 1000ul);
+	next = simMcu.ns() + 500000;
+	for (uint8_t seq = 202; seq <= 203; seq++)
+	{
+		uint8_t frame[1 + sizeof("reading")] = { seq };
+		memcpy(frame + 1, "reading", sizeof("reading") - 1);
+		sim::AirFramePtr f = simAir.packet(next, 1, PEER, RFM69_CTL_ARQ | (seq == 203 ? RFM69_CTL_REQACK : 0), frame,
+		                                   sizeof(frame) - 1);
+		simAir.inject(f);
+		next = f->end + 3000000;
+	}
+	delivered = 0;
+	lastAck.clear();
+	MEASURE("receive windowed, restarted", while (waitFrame(50)) delivered += DATALEN == 7);
+	failures += delivered != 2 || rxDuplicates != duplicates + 1 || lastAck.size() != 2 || lastAck[0] != 204 || lastAck[1];
+
+	// a 130 byte sendMessage() message from PEER in fragments 0, 2, 1: delivered once, whole
+	const uint8_t fragments[] = { 0, 2, 1 };
+	next = simMcu.ns() + 500000;
+	for (size_t i = 0; i < sizeof(fragments); i++)
+	{
+		uint8_t frame[4 + 57];
+		uint16_t offset = fragments[i] * 57;
+		uint8_t length = fragments[i] == 2 ? 130 - offset : 57;
+		frame[0] = 204 + fragments[i];
+		frame[1] = 9; // message id
+		frame[2] = offset;
+		frame[3] = offset >> 8 | (fragments[i] == 2 ? 0x80 : 0);
+		for (uint8_t j = 0; j < length; j++)
+			frame[4 + j] = bulk[offset + j];
+		sim::AirFramePtr f = simAir.packet(next, 1, PEER, RFM69_CTL_ARQ | RFM69_CTL_FRAG | (i == 2 ? RFM69_CTL_REQACK : 0),
+		                                   frame, 4 + length);
+		simAir.inject(f);
+		next = f->end + 3000000;
+	}
+	delivered = 0;
+	lastAck.clear();
+	MEASURE("receive message, 3 fragments", while (waitFrame(200)) delivered += MESSAGELEN == 130 && !memcmp(MESSAGE, bulk, 130));
+	failures += delivered != 1 || lastAck.size() != 2 || lastAck[0] != 207;
+	// the last fragment again (PEER missed the ACK): acknowledged, but it doesn't start a message that never completes
+	uint8_t repeat[4 + 130 - 2 * 57] = { 206, 9, 2 * 57, 0x80 };
+	memcpy(repeat + 4, bulk + 2 * 57, sizeof(repeat) - 4);
+	simAir.inject(simAir.packet(simMcu.ns() + 500000, 1, PEER, RFM69_CTL_ARQ | RFM69_CTL_FRAG | RFM69_CTL_REQACK, repeat, sizeof(repeat)));
+	duplicates = rxDuplicates;
+	lastAck.clear();
+	MEASURE("receive message, last fragment again", failures += waitFrame(200));
+	failures += rxDuplicates != duplicates + 1 || lastAck.size() != 2 || lastAck[0] != 207 || msgPool[0].state == RF69_MSG_BUSY;
+
+	// numbered frames 7, 7 again (PEER missed the ACK), 8: the repeat is dropped but still acknowledged
+	const uint8_t numbers[] = { 7, 7, 8 };
+	next = simMcu.ns() + 500000;
+	for (size_t i = 0; i < sizeof(numbers); i++)
+	{
+		uint8_t frame[1 + sizeof("reading")] = { numbers[i] };
+		memcpy(frame + 1, "reading", sizeof("reading") - 1);
+		sim::AirFramePtr f = simAir.packet(next, 1, PEER, RFM69_CTL_SEQ | (i < 2 ? RFM69_CTL_REQACK : 0), frame,
+		                                   sizeof(frame) - 1);
+		simAir.inject(f);
+		next = f->end + 20000000; // room for an ACK
+	}
+	duplicates = rxDuplicates;
+	delivered = 0;
+	uint64_t acks = simRadio.stats.txFrames;
+	MEASURE("receive numbered, 3 frames", while (waitFrame(200)) { delivered += DATALEN == 7; if (ACKRequested()) sendACK(); });
+	failures += delivered != 2 || rxDuplicates != duplicates + 1 || simRadio.stats.txFrames - acks != 2;
+
+	// numbered frames from RF69_SENDERS + 1 nodes, then the last one's again: there is room to catch that repeat
+	next = simMcu.ns() + 500000;
+	for (int i = 0; i <= RF69_SENDERS + 1; i++)
+	{
+		uint8_t frame[1 + sizeof("reading")] = { 1 };
+		memcpy(frame + 1, "reading", sizeof("reading") - 1);
+		sim::AirFramePtr f = simAir.packet(next, 1, 20 + (i <= RF69_SENDERS ? i : RF69_SENDERS), RFM69_CTL_SEQ, frame,
+		                                   sizeof(frame) - 1);
+		simAir.inject(f);
+		next = f->end + 3000000;
+	}
+	duplicates = rxDuplicates;
+	delivered = 0;
+	MEASURE("receive numbered, 9 nodes", while (waitFrame(50)) delivered += DATALEN == 7);
+	failures += delivered != RF69_SENDERS + 1 || rxDuplicates != duplicates + 1;
+
+	// 3 messages in one frame from PEER, delivered one by one, the ACK request comes with the last
+	const uint8_t packed[] = { 3, 'a', 'b', 'c', 0, 5, 'h', 'e', 'l', 'l', 'o' };
+	simAir.inject(simAir.packet(simMcu.ns() + 500000, 1, PEER, RFM69_CTL_AGGR | RFM69_CTL_REQACK, packed, sizeof(packed)));
+	uint8_t lengths = 0;
+	acks = simRadio.stats.txFrames;
+	delivered = 0;
+	MEASURE("receive 3 aggregated", while (waitFrame(100)) { lengths += DATALEN; delivered++; if (ACKRequested()) sendACK(); });
+	failures += delivered != 3 || lengths != 8 || memcmp((const char*) DATA, "hello", 6) || simRadio.stats.txFrames - acks != 1;
+
+	// a sender running RF69_ATPC asks for the RSSI, the ACK carries it in front of the payload
+	receiveDone();
+	idle(2000);
+	simAir.inject(simAir.packet(simMcu.ns() + 500000, 1, PEER, RFM69_CTL_REQACK | RFM69_CTL_RSSI, hello, strlen(hello)));
+	lastAck.clear();
+	int16_t rssi = 0;
+	MEASURE("receive, ACK with RSSI", if (waitFrame(100) && ACKRequested()) { rssi = RSSI; sendACK(); });
+	failures += !rssi || DATALEN != strlen(hello) || lastAck.size() != 1 || (int8_t) lastAck[0] != rssi;
+
+	// numbered frames asking for the RSSI from PEER and node 21, then both repeated (they missed the ACKs) before
+	// receiveDone() gets to them: every repeat still gets its ACK, with the RSSI like the first one
+	memset(acksTo, 0, sizeof(acksTo));
+	rssiAcks = 0;
+	duplicates = rxDuplicates;
+	delivered = 0;
+	for (int repeat = 0; repeat < 2; repeat++)
+	{
+		receiveDone();
+		idle(2000);
+		next = simMcu.ns() + 500000;
+		for (uint8_t sender : { PEER, (uint8_t) 21 })
+		{
+			uint8_t frame[1 + sizeof("reading")] = { 30 };
+			memcpy(frame + 1, "reading", sizeof("reading") - 1);
+			sim::AirFramePtr f = simAir.packet(next, 1, sender, RFM69_CTL_SEQ | RFM69_CTL_REQACK | RFM69_CTL_RSSI, frame,
+			                                   sizeof(frame) - 1);
+			simAir.inject(f);
+			next = f->end + (repeat ? 3000000 : 20000000); // the first time with room for the ACK
+		}
+		if (repeat)
+			idle((next - simMcu.ns()) / 1000); // both repeats queued before receiveDone() runs
+		MEASURE(repeat ? "receive numbered, 2 nodes repeating" : "receive numbered, 2 nodes",
+		        while (waitFrame(200)) { delivered += DATALEN == 7; if (ACKRequested()) sendACK(); });
+	}
+	failures += delivered != 2 || rxDuplicates != duplicates + 2 || acksTo[PEER] != 2 || acksTo[21] != 2 || rssiAcks != 4;
+
+	// compressed frames from PEER: a record, a delta against it, the delta again (PEER missed the ACK) and a delta
+	// against a record this node never got, which is dropped without an ACK
+	uint16_t records[2][6] = { { 2150, 4520, 10132, 3010, 100, 870 }, { 2149, 4522, 10132, 3010, 101, 870 } };
+	uint8_t zFrames[4][RF69_MAX_DATA_LEN], zLens[4];
+	zLens[0] = compressFrame(zFrames[0], (const uint8_t*) records[0], 12, 1, 0);
+	zLens[1] = compressFrame(zFrames[1], (const uint8_t*) records[1], 12, 2, (const uint8_t*) records[0]);
+	memcpy(zFrames[2], zFrames[1], zLens[2] = zLens[1]);
+	memcpy(zFrames[3], zFrames[1], zLens[3] = zLens[1]);
+	zFrames[3][0] = RF69_Z_DELTA | 9;
+	next = simMcu.ns() + 500000;
+	for (size_t i = 0; i < 4; i++)
+	{
+		sim::AirFramePtr f = simAir.packet(next, 1, PEER, RFM69_CTL_COMPRESSED | RFM69_CTL_REQACK, zFrames[i], zLens[i]);
+		simAir.inject(f);
+		next = f->end + 20000000;
+	}
+	uint16_t undecodable = rxUndecodable;
+	acks = simRadio.stats.txFrames;
+	delivered = 0;
+	MEASURE("receive compressed, 4 frames", while (waitFrame(200))
+	{
+		delivered += DATALEN == 12 && !memcmp((const void*) DATA, records[delivered ? 1 : 0], 12);
+		if (ACKRequested())
+			sendACK();
+	});
+	failures += zFrames[1][0] >> 4 != RF69_Z_DELTA >> 4 || delivered != 3 || rxUndecodable != undecodable + 1
+	         || simRadio.stats.txFrames - acks != 3;
+
+	// TDMA with PEER as the gateway, its beacons give this node slot 3: tdmaSend() listens for a beacon and sends
+	// two slots after its end. sent again right away, it sleeps through the rest of the superframe and the next
+	// beacon's slot comes with its ACK at the beginning of the slot
+	uint8_t beacon[RF69_TDMA_SLOTS] = { 1 };
+	beacon[3] = 1;
+	tdmaBegin(PEER);
+	sim::AirFramePtr b = simAir.packet(simMcu.ns() + 10000000, RF69_BROADCAST_ADDR, PEER, RFM69_CTL_BEACON, beacon,
+	                                   sizeof(beacon));
+	simAir.inject(b);
+	MEASURE("tdmaSend, first beacon", failures += !tdmaSend(PEER, hello, strlen(hello), 0, 40));
+	uint64_t slotStart = b->end + 2 * RF69_TDMA_SLOT_MS * 1000000ull;
+	failures += tdmaBeacons != 1 || lastStart < slotStart || lastStart > slotStart + (RF69_TDMA_GUARD_MS + 2) * 1000000ull;
+	beacon[0]++;
+	b = simAir.packet(b->start + RF69_TDMA_SUPERFRAME_MS * 1000000, RF69_BROADCAST_ADDR, PEER, RFM69_CTL_BEACON, beacon,
+	                  sizeof(beacon));
+	simAir.inject(b);
+	uint64_t rxOn = simRadio.receiverOnNs();
+	MEASURE("tdmaSend, next superframe", failures += !tdmaSend(PEER, hello, strlen(hello), 0, 40));
+	slotStart = b->end + 2 * RF69_TDMA_SLOT_MS * 1000000ull;
+	failures += tdmaBeacons != 2 || lastStart < slotStart || lastStart > slotStart + (RF69_TDMA_GUARD_MS + 2) * 1000000ull
+	         || simRadio.receiverOnNs() - rxOn > 2 * RF69_TDMA_SLOT_MS * 1000000ull;
+	// a frame for the application that comes while tdmaSync() listens for the beacon stays queued for it
+	tdmaBegin(PEER);
+	simAir.inject(simAir.packet(simMcu.ns() + 2000000, 1, 3, 0, hello, strlen(hello)));
+	beacon[0]++;
+	simAir.inject(simAir.packet(simMcu.ns() + 40000000, RF69_BROADCAST_ADDR, PEER, RFM69_CTL_BEACON, beacon, sizeof(beacon)));
+	MEASURE("tdmaSync, frame first", failures += !tdmaSync());
+	failures += !receiveDone() || SENDERID != 3 || DATALEN != strlen(hello);
+	// as the gateway: PEER's frame gets it the first free slot in the next beacon
+	tdmaBegin(1);
+	MEASURE("tdmaPoll, beacon", tdmaPoll());
+	simAir.inject(simAir.packet(simMcu.ns() + 5000000, 1, PEER, 0, hello, strlen(hello)));
+	failures += !waitFrame(100) || DATALEN != strlen(hello);
+	lastBeacon.clear();
+	while (lastBeacon.empty())
+	{
+		tdmaPoll();
+		idle(1000);
+	}
+	failures += lastBeacon.size() != RF69_TDMA_SLOTS || lastBeacon[1] != PEER || lastBeacon[2];
+	tdmaEnd();
+	// not in TDMA mode any more, a beacon from PEER that comes while waiting for its ACK isn't one
+	autoAck = 0;
+	simAir.inject(simAir.packet(simMcu.ns() + 40000000, RF69_BROADCAST_ADDR, PEER, RFM69_CTL_BEACON, beacon, sizeof(beacon)));
+	MEASURE("sendWithRetry, beacon in the wait", failures += sendWithRetry(PEER, hello, strlen(hello), 0, 100));
+	autoAck = 1;
+	// and the application doesn't get it either
+	receiveDone();
+	idle(2000);
+	simAir.inject(simAir.packet(simMcu.ns() + 500000, RF69_BROADCAST_ADDR, PEER, RFM69_CTL_BEACON, beacon, sizeof(beacon)));
+	simAir.inject(simAir.packet(simMcu.ns() + 40000000, 1, 3, 0, hello, strlen(hello)));
+	unsigned got = 0;
+	MEASURE("receive, beacon then a frame", while (waitFrame(100)) got += SENDERID == 3 && DATALEN == strlen(hello) ? 1 : 100);
+	failures += got != 1;
+
+	// FHSS with PEER as the gateway: its beacons go out 2ms into every dwell (fhssPoll() sends them once it notices the
+	// hop, and says how late), on that hop's channel, and from hop 100 on they blacklist one channel. fhssSend()
+	// listens for a beacon on one channel, then sends within a dwell on its channel. PEER doesn't hear on another one:
+	// the retries go to other hops and the node soon avoids that channel
+	uint32_t band = getFrequency();
+	const uint64_t dwellNs = RF69_FHSS_DWELL_MS * 1000000ull;
+	fhssBegin(PEER);
+	uint8_t deaf = fhssSeq[2], banned = fhssSeq[6];
+	uint64_t hop0 = simMcu.ns() + 1000000 - 5 * dwellNs; // hop 5 is the first one on the air
+	for (uint16_t h = 5; h < 300; h++)
+	{
+		uint8_t hb[RF69_FHSS_BEACON_LEN] = { (uint8_t) h, (uint8_t) (h >> 8), RF69_FHSS_DWELL_MS & 0xFF, RF69_FHSS_DWELL_MS >> 8, 2 };
+		if (h >= 100)
+			hb[5 + banned / 8] = 1 << banned % 8;
+		fhssBanned[banned / 8] = hb[5 + banned / 8];
+		sim::AirFramePtr f = simAir.packet(hop0 + h * dwellNs + hb[4] * 1000000ull, RF69_BROADCAST_ADDR, PEER, RFM69_CTL_HOP, hb,
+		                                   sizeof(hb));
+		f->frf = RF69_FHSS_FRF[fhssChannel(h)];
+		simAir.inject(f);
+	}
+	fhssBanned[banned / 8] = 0;
+	MEASURE("fhssSend, scan", failures += !fhssSend(PEER, hello, strlen(hello), 0, 40));
+	uint64_t hop = (lastStart - hop0) / dwellNs, into = (lastStart - hop0) % dwellNs;
+	failures += fhssBeacons != 1 || hop != 8 || lastFrf != RF69_FHSS_FRF[fhssSeq[0]] || into < RF69_FHSS_GUARD_MS * 1000000ull;
+	MEASURE("fhssSend, same dwell", failures += !fhssSend(PEER, hello, strlen(hello), 0, 40));
+	failures += fhssBeacons != 1 || (lastStart - hop0) / dwellNs != hop;
+	deafFrf = RF69_FHSS_FRF[deaf];
+	unsigned sent = 0, onDeaf = 0, onBanned = 0, tries = 0;
+	while (simMcu.ns() < hop0 + 290 * dwellNs)
+	{
+		uint16_t told = fhssHop; // hop of the last beacon it went by
+		sent += fhssSend(PEER, hello, strlen(hello), 3, 40);
+		hop = (lastStart - hop0) / dwellNs;
+		into = (lastStart - hop0) % dwellNs;
+		// that hop's channel, with the blacklist or, until a beacon has told it, without
+		uint8_t map = fhssBanned[banned / 8], listed = fhssChannel(hop);
+		fhssBanned[banned / 8] = 0;
+		uint8_t unlisted = fhssChannel(hop);
+		fhssBanned[banned / 8] = map;
+		failures += (lastFrf != RF69_FHSS_FRF[listed] && lastFrf != RF69_FHSS_FRF[unlisted]) || into < RF69_FHSS_GUARD_MS * 1000000ull
+		         || into > dwellNs - RF69_FHSS_GUARD_MS * 1000000ull;
+		onDeaf += lastFrf == deafFrf;
+		onBanned += told >= 100 && lastFrf == RF69_FHSS_FRF[banned]; // once a beacon has told it
+		// 0.3 to 1.5 dwells, so the sends come by every channel. the main loop follows the hops meanwhile, so the
+		// beacons with the blacklist reach it whatever channel the sends leave it on
+		for (uint32_t ms = (tries++ % 5 + 1) * RF69_FHSS_DWELL_MS * 3 / 10; ms; ms--)
+		{
+			fhssPoll();
+			receiveDone();
+			idle(1000);
+		}
+	}
+	printf("%-28s %u sent, %u of %u lost on it, %s, %u beacons, %u missed\n", "fhssSend, 1 channel deaf", sent,
+	       (unsigned) fhssLost[deaf], (unsigned) fhssSent[deaf], fhssAvoiding(deaf) ? "avoided" : "in use",
+	       (unsigned) fhssBeacons, (unsigned) fhssMissed);
+	failures += sent < 100 || onDeaf || onBanned || !fhssAvoiding(deaf) || !fhssIsBanned(banned)
+	         || fhssLost[deaf] < RF69_FHSS_PER_MIN;
+	deafFrf = 0;
+	// a frame for the application that comes while fhssSync() listens for a beacon stays queued for it
+	while (simMcu.ns() < hop0 + 300 * dwellNs) // past PEER's beacons
+		idle(1000);
+	while (rxQueueCount()) // the beacons it heard meanwhile
+		receiveDone();
+	fhssBegin(PEER);
+	sim::AirFramePtr app = simAir.packet(simMcu.ns() + 2000000, 1, 3, 0, hello, strlen(hello));
+	app->frf = RF69_FHSS_FRF[fhssSeq[fhssScan % RF69_FHSS_COUNT]]; // where it listens
+	simAir.inject(app);
+	uint8_t hb[RF69_FHSS_BEACON_LEN] = { 300 & 0xFF, 300 >> 8, RF69_FHSS_DWELL_MS & 0xFF, RF69_FHSS_DWELL_MS >> 8 };
+	sim::AirFramePtr hopBeacon = simAir.packet(app->end + 10000000, RF69_BROADCAST_ADDR, PEER, RFM69_CTL_HOP, hb, sizeof(hb));
+	hopBeacon->frf = app->frf;
+	simAir.inject(hopBeacon);
+	MEASURE("fhssSync, frame first", failures += !fhssSync());
+	failures += !receiveDone() || SENDERID != 3 || DATALEN != strlen(hello);
+	// as the gateway: the first fhssPoll() starts hop 0 on its channel with a beacon
+	fhssBegin(1);
+	lastBeacon.clear();
+	MEASURE("fhssPoll, beacon", fhssPoll());
+	failures += lastBeacon.size() != RF69_FHSS_BEACON_LEN || lastBeacon[0] || lastBeacon[1] || lastBeacon[2] != RF69_FHSS_DWELL_MS % 256
+	         || lastFrf != RF69_FHSS_FRF[fhssSeq[0]];
+	fhssEnd();
+	setFrequency(band);
+
+	MEASURE("encrypt", encrypt(KEY));
+	MEASURE("sendWithRetry, AES", failures += !sendWithRetry(PEER, hello, strlen(hello), 2, 40));
+	receiveDone();
+	idle(2000);
+	simAir.inject(simAir.packet(simMcu.ns() + 500000, 1, PEER, 0, hello, strlen(hello), (const uint8_t*) KEY));
+	MEASURE("receive, AES", failures += !waitFrame(100));
+	failures += DATALEN != strlen(hello) || memcmp((const char*) DATA, hello, DATALEN);
+	MEASURE("encrypt(0)", encrypt(0));
+
+	MEASURE("setModemProfile 55555", setModemProfile(RF69_MODEM_55555));
+	MEASURE("send 24 bytes @55k", send(PEER, hello, strlen(hello)));
+	MEASURE("setModemProfile default", setModemProfile(RF69_MODEM_DEFAULT));
+
+	MEASURE("listenBegin", listenBegin());
+	// a burst long enough to span a whole idle period, like sendBurst() sends it
+	uint64_t at = simMcu.ns() + 100000000;
+	for (int i = 0; i < 100; i++)
+	{
+		sim::AirFramePtr f = simAir.packet(at, 1, PEER, 0, hello, strlen(hello));
+		simAir.inject(f);
+		at = f->end + 200000;
+	}
+	MEASURE("receive while listening", failures += !waitFrame(2000));
+#ifndef RF69_LARGE_PACKETS
+	// and drops a frame that is too long the same way
+	at = simMcu.ns() + 100000000;
+	for (int i = 0; i < 100; i++)
+	{
+		sim::AirFramePtr f = simAir.packet(at, 1, PEER, 0, tooLong, sizeof(tooLong));
+		simAir.inject(f);
+		at = f->end + 200000;
+	}
+	rejected = rxRejected;
+	MEASURE("listening, too long", failures += waitFrame(2000));
+	failures += rxRejected == rejected;
+#endif
+	MEASURE("sleep", sleep());
+
+	printf("\nradio: %llu frames sent, %llu received, %llu CRC errors, %llu filtered, %llu listen windows\n",
+	       (unsigned long long) simRadio.stats.txFrames, (unsigned long long) simRadio.stats.rxFrames,
+	       (unsigned long long) simRadio.stats.rxCrcErrors, (unsigned long long) simRadio.stats.rxFiltered,
+	       (unsigned long long) simRadio.stats.listenWindows);
+	printf("driver: %u SPI transactions saved by shadow registers, irqOffMax %u Timer1 ticks, rx dropped %u rejected %u "
+	       "duplicates %u\n", (unsigned) spiSaved, (unsigned) irqOffMax, (unsigned) rxDropped, (unsigned) rxRejected,
+	       (unsigned) rxDuplicates);
+	printf("mcu: longest interrupts-off stretch %u cycles, INT5 max %u cycles, TIMER1_COMPA max %u cycles\n",
+	       (unsigned) simMcu.stats.irqOffMaxCycles, (unsigned) simMcu.stats.isrMaxCycles[sim::Mcu::VEC_INT5],
+	       (unsigned) simMcu.stats.isrMaxCycles[sim::Mcu::VEC_TIMER1_COMPA]);
+	printf("%s\n", failures ? "FAILED" : "ok");
+	return failures ? 1 : 0;
+}
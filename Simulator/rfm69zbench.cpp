@@ -0,0 +1,88 @@
+// host simulator: what sendCompressed() saves on the telemetry samples of zsamples.h, as CSV on stdout. one row per
+// sample: its size, the method compressFrame() picked, the frame payload, the airtime of the frame sent as it is
+// and compressed, at the default modem profile, and the CPU cycles of compressFrame() and decompressFrame(). those
+// are the estimates of mcu.h per step of the compression loops, RF69_Z_STEP() charges them.
+// see README.md, "Host simulator"
+#include <stdio.h>
+#include <string.h>
+#include "mcu.h"
+#include "sx1231.h"
+#include "air.h"
+
+namespace sim { Hal* hal; }
+
+#define RF69_COMPRESS
+#define RF69_Z_STEP(step) sim::hal->charge(sim::CYCLES_Z_##step)
+#include "../RFM69.h"
+#include "zsamples.h"
+
+#define PEER 2
+
+static sim::Mcu simMcu;
+static sim::ScriptedAir simAir;
+static sim::Sx1231 simRadio;
+
+static double airtimeUs(const void* buffer, uint8_t size)
+{
+	uint64_t before = simRadio.stats.txAirNs;
+	send(PEER, buffer, size);
+	simMcu.delayNs(1000000);
+	return (simRadio.stats.txAirNs - before) / 1000.0;
+}
+
+static const char* methodName(uint8_t header)
+{
+	switch (header & 0xF0)
+	{
+		case RF69_Z_LZ: return "lz";
+		case RF69_Z_DELTA: return "delta";
+		default: return "stored";
+	}
+}
+
+// returns 1 if the frame doesn't decode back to the sample
+static uint8_t row(const char* name, const void* sample, uint8_t size, const uint8_t* ref, uint8_t tag)
+{
+	uint8_t frame[RF69_MAX_DATA_LEN], back[RF69_DATA_LEN];
+	uint64_t start = simMcu.cycles();
+	uint8_t len = compressFrame(frame, (const uint8_t*) sample, size, tag, ref);
+	uint64_t packed = simMcu.cycles();
+	rf69_sender_t* peer = findSender(PEER);
+	if (!ref)
+		peer->flags &= ~RF69_SENDER_ZREF;
+	uint64_t unpacking = simMcu.cycles();
+	uint8_t decoded = decompressFrame(peer, back, frame, len);
+	uint64_t unpacked = simMcu.cycles();
+	double raw = airtimeUs(sample, size), coded = airtimeUs(frame, len);
+	printf("%s,%u,%s,%u,%.2f,%.1f,%.1f,%llu,%llu\n", name, size, methodName(frame[0]), len, (double) len / size, raw, coded,
+	       (unsigned long long) (packed - start), (unsigned long long) (unpacked - unpacking));
+	return decoded != size || memcmp(back, sample, size);
+}
+
+int main()
+{
+	sim::hal = &simMcu;
+	simMcu.attach(&simRadio);
+	simMcu.setVector(sim::Mcu::VEC_INT5, INT5_vect);
+	simMcu.setVector(sim::Mcu::VEC_TIMER1_COMPA, TIMER1_COMPA_vect);
+	simAir.attach(&simRadio);
+	rfm69_init(RF_868MHZ, 1, 100);
+
+	printf("sample,bytes,method,frame_bytes,ratio,airtime_us,compressed_airtime_us,compress_cycles,decompress_cycles\n");
+	unsigned failures = 0;
+	char name[32];
+	for (uint8_t i = 0; i < ZSAMPLE_RECORDS; i++)
+	{
+		snprintf(name, sizeof(name), "record %u", i);
+		// the first one is what receivers start from, the others are coded against the one before
+		failures += row(name, zRecords[i], sizeof(zRecords[i]), i ? (const uint8_t*) zRecords[i - 1] : 0, i + 1);
+	}
+	for (uint8_t i = 0; i < ZSAMPLE_TEXTS; i++)
+	{
+		snprintf(name, sizeof(name), "text %u", i);
+		failures += row(name, zTexts[i], strlen(zTexts[i]), 0, 0);
+	}
+	if (failures)
+		fprintf(stderr, "%u samples didn't decode\n", failures);
+	return failures ? 1 : 0;
+}
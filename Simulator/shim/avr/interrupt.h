@@ -0,0 +1,12 @@
+// host simulator shim for <avr/interrupt.h>
+#ifndef SIM_AVR_INTERRUPT_H
+#define SIM_AVR_INTERRUPT_H
+
+#include "io.h"
+
+// vectors are plain C functions, the simulated MCU calls them (see sim::Mcu::setVector())
+#define ISR(vector, ...) extern "C" void vector(void); void vector(void)
+#define sei() sim::hal->setInterrupts(true)
+#define cli() sim::hal->setInterrupts(false)
+
+#endif
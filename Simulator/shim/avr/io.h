@@ -0,0 +1,127 @@
+// host simulator shim for <avr/io.h>: atmega64 register and bit names backed by sim::Mcu
+#ifndef SIM_AVR_IO_H
+#define SIM_AVR_IO_H
+
+#include "../hal.h"
+
+#define DDRB    (sim::Io<sim::IO_DDRB>{})
+#define PORTB   (sim::Io<sim::IO_PORTB>{})
+#define PINB    (sim::Io<sim::IO_PINB>{})
+#define DDRD    (sim::Io<sim::IO_DDRD>{})
+#define PORTD   (sim::Io<sim::IO_PORTD>{})
+#define PIND    (sim::Io<sim::IO_PIND>{})
+#define DDRE    (sim::Io<sim::IO_DDRE>{})
+#define PORTE   (sim::Io<sim::IO_PORTE>{})
+#define PINE    (sim::Io<sim::IO_PINE>{})
+#define EICRA   (sim::Io<sim::IO_EICRA>{})
+#define EICRB   (sim::Io<sim::IO_EICRB>{})
+#define EIMSK   (sim::Io<sim::IO_EIMSK>{})
+#define EIFR    (sim::Io<sim::IO_EIFR>{})
+#define SPCR    (sim::Io<sim::IO_SPCR>{})
+#define SPSR    (sim::Io<sim::IO_SPSR>{})
+#define SPDR    (sim::Io<sim::IO_SPDR>{})
+#define TCCR1A  (sim::Io<sim::IO_TCCR1A>{})
+#define TCCR1B  (sim::Io<sim::IO_TCCR1B>{})
+#define OCR1AH  (sim::Io<sim::IO_OCR1AH>{})
+#define OCR1AL  (sim::Io<sim::IO_OCR1AL>{})
+#define OCR1A   (sim::Io<sim::IO_OCR1A, uint16_t>{})
+#define TCNT1   (sim::Io<sim::IO_TCNT1, uint16_t>{})
+#define TIMSK   (sim::Io<sim::IO_TIMSK>{})
+#define TIFR    (sim::Io<sim::IO_TIFR>{})
+#define SREG    (sim::Io<sim::IO_SREG>{})
+#define MCUCR   (sim::Io<sim::IO_MCUCR>{})
+
+// port pins
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PB6 6
+#define PB7 7
+#define PD0 0
+#define PD1 1
+#define PD2 2
+#define PD3 3
+#define PD4 4
+#define PD5 5
+#define PD6 6
+#define PD7 7
+#define PE0 0
+#define PE1 1
+#define PE2 2
+#define PE3 3
+#define PE4 4
+#define PE5 5
+#define PE6 6
+#define PE7 7
+
+// EICRA / EICRB / EIMSK / EIFR
+#define ISC00 0
+#define ISC01 1
+#define ISC10 2
+#define ISC11 3
+#define ISC20 4
+#define ISC21 5
+#define ISC30 6
+#define ISC31 7
+#define ISC40 0
+#define ISC41 1
+#define ISC50 2
+#define ISC51 3
+#define ISC60 4
+#define ISC61 5
+#define ISC70 6
+#define ISC71 7
+#define INT0 0
+#define INT1 1
+#define INT2 2
+#define INT3 3
+#define INT4 4
+#define INT5 5
+#define INT6 6
+#define INT7 7
+#define INTF0 0
+#define INTF1 1
+#define INTF2 2
+#define INTF3 3
+#define INTF4 4
+#define INTF5 5
+#define INTF6 6
+#define INTF7 7
+
+// SPCR / SPSR
+#define SPIE 7
+#define SPE  6
+#define DORD 5
+#define MSTR 4
+#define CPOL 3
+#define CPHA 2
+#define SPR1 1
+#define SPR0 0
+#define SPIF 7
+#define WCOL 6
+#define SPI2X 0
+
+// TCCR1B / TIMSK / TIFR
+#define ICNC1 7
+#define ICES1 6
+#define WGM13 4
+#define WGM12 3
+#define CS12 2
+#define CS11 1
+#define CS10 0
+#define OCIE1A 4
+#define OCF1A 4
+
+// SREG
+#define SREG_I 7
+
+// MCUCR, the sleep bits
+#define SE 5
+#define SM1 4
+#define SM0 3
+#define SM2 2
+
+#endif
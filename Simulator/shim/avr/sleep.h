@@ -0,0 +1,19 @@
+// host simulator shim for <avr/sleep.h>: sleep_cpu() idles the simulated MCU until something interrupts it, whatever
+// the mode bits in MCUCR say
+#ifndef SIM_AVR_SLEEP_H
+#define SIM_AVR_SLEEP_H
+
+#include "io.h"
+
+#define _SLEEP_CONTROL_REG MCUCR
+#define _SLEEP_MODE_MASK ((1 << SM0) | (1 << SM1) | (1 << SM2))
+#define SLEEP_MODE_IDLE 0
+#define SLEEP_MODE_PWR_DOWN (1 << SM1)
+#define SLEEP_MODE_PWR_SAVE ((1 << SM0) | (1 << SM1))
+#define set_sleep_mode(mode) (_SLEEP_CONTROL_REG = (_SLEEP_CONTROL_REG & ~_SLEEP_MODE_MASK) | (mode))
+#define sleep_enable() (_SLEEP_CONTROL_REG |= 1 << SE)
+#define sleep_disable() (_SLEEP_CONTROL_REG &= ~(1 << SE))
+#define sleep_cpu() sim::hal->idle()
+#define sleep_mode() do { sleep_enable(); sleep_cpu(); sleep_disable(); } while (0)
+
+#endif
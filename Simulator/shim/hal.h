@@ -0,0 +1,53 @@
+// host simulator: the interface the AVR shim headers talk to.
+// the driver is compiled unmodified against shim/avr/*.h and shim/util/*.h, every I/O register
+// access, sei()/cli() and delay ends up here and is forwarded to the simulated MCU (sim::Mcu)
+#ifndef SIM_HAL_H
+#define SIM_HAL_H
+
+#include <stdint.h>
+
+namespace sim {
+
+// I/O registers the driver, spi.h and get_millis.h touch (atmega64 names)
+enum IoId
+{
+	IO_DDRB, IO_PORTB, IO_PINB,
+	IO_DDRD, IO_PORTD, IO_PIND,
+	IO_DDRE, IO_PORTE, IO_PINE,
+	IO_EICRA, IO_EICRB, IO_EIMSK, IO_EIFR,
+	IO_SPCR, IO_SPSR, IO_SPDR,
+	IO_TCCR1A, IO_TCCR1B, IO_OCR1AH, IO_OCR1AL, IO_OCR1A, IO_TCNT1, IO_TIMSK, IO_TIFR,
+	IO_SREG, IO_MCUCR,
+	IO_COUNT
+};
+
+class Hal
+{
+public:
+	virtual ~Hal() {}
+	virtual uint16_t ioRead(int id) = 0;
+	virtual void ioWrite(int id, uint16_t value) = 0;
+	virtual void setInterrupts(bool on) = 0; // sei() / cli()
+	virtual bool interrupts() = 0;
+	virtual void delayNs(uint64_t ns) = 0; // _delay_us() / _delay_ms(), and idle time of the application
+	virtual void idle() = 0; // sleep_cpu(): until the next interrupt
+	virtual void charge(uint32_t cycles) = 0; // CPU time of code the simulator can't see (see shim/util/atomic.h)
+	virtual uint64_t timeNs() = 0; // simulated time, for the test applications (not an AVR thing)
+};
+
+extern Hal* hal; // MCU the driver code is running on, set by the simulator
+
+// an 8 or 16 bit I/O register: reads and writes go to the simulated MCU
+template <int ID, typename T = uint8_t>
+struct Io
+{
+	operator T() const { return (T) hal->ioRead(ID); }
+	Io& operator=(unsigned value) { hal->ioWrite(ID, (T) value); return *this; }
+	Io& operator|=(unsigned value) { hal->ioWrite(ID, (T) (hal->ioRead(ID) | value)); return *this; }
+	Io& operator&=(unsigned value) { hal->ioWrite(ID, (T) (hal->ioRead(ID) & value)); return *this; }
+	Io& operator^=(unsigned value) { hal->ioWrite(ID, (T) (hal->ioRead(ID) ^ value)); return *this; }
+};
+
+} // namespace sim
+
+#endif
@@ -0,0 +1,21 @@
+// host simulator shim for <util/atomic.h>
+#ifndef SIM_UTIL_ATOMIC_H
+#define SIM_UTIL_ATOMIC_H
+
+#include "../avr/interrupt.h"
+
+namespace sim {
+// cli() on the way in, sei() or the saved state on the way out, like the avr-libc macros
+struct AtomicBlock
+{
+	bool restore, done;
+	AtomicBlock(bool force) : restore(force || hal->interrupts()), done(false) { hal->setInterrupts(false); hal->charge(2); }
+	~AtomicBlock() { hal->setInterrupts(restore); }
+};
+} // namespace sim
+
+#define ATOMIC_FORCEON true
+#define ATOMIC_RESTORESTATE false
+#define ATOMIC_BLOCK(type) for (sim::AtomicBlock sim_atomic_(type); !sim_atomic_.done; sim_atomic_.done = true)
+
+#endif
@@ -0,0 +1,10 @@
+// host simulator shim for <util/delay.h>: delays advance simulated time
+#ifndef SIM_UTIL_DELAY_H
+#define SIM_UTIL_DELAY_H
+
+#include "../hal.h"
+
+#define _delay_us(us) sim::hal->delayNs((uint64_t) ((us) * 1000.0))
+#define _delay_ms(ms) sim::hal->delayNs((uint64_t) ((ms) * 1000000.0))
+
+#endif
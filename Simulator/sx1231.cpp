@@ -0,0 +1,848 @@
+// host simulator: SX1231 model, see sx1231.h. timings are the typical values of the datasheet
+#include "sx1231.h"
+#include "aes.h"
+#include "../RFM69registers.h"
+#include <string.h>
+
+namespace sim {
+
+static const uint64_t NEVER = ~(uint64_t) 0;
+static const uint32_t FXOSC = 32000000;
+static const uint64_t TS_OSC = 250000; // crystal start-up, sleep -> standby
+static const uint64_t TS_FS = 60000; // PLL lock, standby -> FS
+static const uint64_t TS_TEMP = 100000; // temperature measurement
+static const uint32_t listenResolNs[4] = { 0, 64000, 4100000, 262000000 }; // ListenResolIdle/Rx
+static const uint16_t paRampUs[16] = { 3400, 2000, 1000, 500, 250, 125, 100, 62, 50, 40, 31, 25, 20, 15, 12, 10 };
+
+// register values after reset, the ones that matter here
+static const struct { uint8_t addr, value; } resetValues[] =
+{
+	{ REG_OPMODE, RF_OPMODE_STANDBY }, { REG_BITRATEMSB, 0x1A }, { REG_BITRATELSB, 0x0B }, { REG_FDEVMSB, 0x00 },
+	{ REG_FDEVLSB, 0x52 }, { REG_FRFMSB, 0xE4 }, { REG_FRFMID, 0xC0 }, { REG_FRFLSB, 0x00 }, { REG_OSC1, 0x41 },
+	{ REG_LISTEN1, 0x92 }, { REG_LISTEN2, 0xF5 }, { REG_LISTEN3, 0x20 }, { REG_VERSION, 0x24 }, { REG_PALEVEL, 0x9F },
+	{ REG_PARAMP, 0x09 }, { REG_OCP, 0x1A }, { REG_LNA, 0x08 }, { REG_RXBW, 0x86 }, { REG_AFCBW, 0x8A },
+	{ REG_DIOMAPPING2, 0x07 }, { REG_RSSITHRESH, 0xE4 }, { REG_PREAMBLELSB, 0x03 }, { REG_SYNCCONFIG, 0x98 },
+	{ REG_SYNCVALUE1, 0x01 }, { REG_SYNCVALUE2, 0x01 }, { REG_SYNCVALUE3, 0x01 }, { REG_SYNCVALUE4, 0x01 },
+	{ REG_PACKETCONFIG1, 0x10 }, { REG_PAYLOADLENGTH, 0x40 }, { REG_FIFOTHRESH, 0x8F }, { REG_PACKETCONFIG2, 0x02 },
+	{ REG_TESTLNA, 0x1B }, { REG_TESTPA1, 0x55 }, { REG_TESTPA2, 0x70 }, { REG_TESTDAGC, 0x30 }
+};
+
+Sx1231::Sx1231(Air* medium, int id)
+	: air(medium), nodeId(id), now(0), selected(false), spiFirst(false), spiWrite(false), spiAddr(0),
+	  fifoHead(0), fifoCount(0), fifoOverrun(false), packetSent(false), payloadReady(false), crcOk(false),
+	  syncMatch(false), timeout(false), mode(MODE_STANDBY), modeReadyAt(0), tempDoneAt(0),
+	  txState(TX_OFF), txWireLen(0), txNextAt(NEVER), txCrc(false),
+	  rxState(RX_OFF), rxReadyAt(NEVER), rxRestartAt(NEVER), rxOnSince(0), rxWireLen(0), rxLength(0), rxLevel(-127),
+	  listenOn(false), listenRx(false), listenMet(false), listenPhaseEnd(NEVER), listenCheckAt(NEVER),
+	  timeoutAt(NEVER), stepPrev(0)
+{
+	memset(&stats, 0, sizeof(stats));
+	memset(regs, 0, sizeof(regs));
+	memset(fifo, 0, sizeof(fifo));
+	for (size_t i = 0; i < sizeof(resetValues) / sizeof(resetValues[0]); i++)
+		regs[resetValues[i].addr] = resetValues[i].value;
+}
+
+uint32_t Sx1231::frf() const
+{
+	return (uint32_t) regs[REG_FRFMSB] << 16 | (uint32_t) regs[REG_FRFMID] << 8 | regs[REG_FRFLSB];
+}
+
+uint32_t Sx1231::bitrate() const
+{
+	uint16_t divider = (uint16_t) (regs[REG_BITRATEMSB] << 8 | regs[REG_BITRATELSB]);
+	return FXOSC / (divider ? divider : 1);
+}
+
+uint32_t Sx1231::rxBandwidth() const
+{
+	static const uint8_t mant[4] = { 16, 20, 24, 24 };
+	return FXOSC / (mant[(regs[REG_RXBW] >> 3) & 3] << ((regs[REG_RXBW] & 7) + 2));
+}
+
+uint64_t Sx1231::byteNs() const
+{
+	return 8000000000ull / bitrate();
+}
+
+uint64_t Sx1231::preambleNs() const
+{
+	uint8_t syncLen = (regs[REG_SYNCCONFIG] & RF_SYNC_ON) ? ((regs[REG_SYNCCONFIG] >> 3) & 7) + 1 : 0;
+	return ((regs[REG_PREAMBLEMSB] << 8 | regs[REG_PREAMBLELSB]) + syncLen) * byteNs();
+}
+
+double Sx1231::txPowerDbm() const
+{
+	uint8_t pa = regs[REG_PALEVEL];
+	int out = pa & 0x1F;
+	if (pa & RF_PALEVEL_PA0_ON)
+		return -18 + out;
+	if ((pa & (RF_PALEVEL_PA1_ON | RF_PALEVEL_PA2_ON)) == (RF_PALEVEL_PA1_ON | RF_PALEVEL_PA2_ON))
+		return (regs[REG_TESTPA1] == 0x5D && regs[REG_TESTPA2] == 0x7C) ? -11 + out : -14 + out;
+	if (pa & RF_PALEVEL_PA1_ON)
+		return -18 + out;
+	return -127; // no PA enabled
+}
+
+double Sx1231::rssiThreshold() const
+{
+	return -regs[REG_RSSITHRESH] / 2.0;
+}
+
+bool Sx1231::aesOn() const
+{
+	return regs[REG_PACKETCONFIG2] & RF_PACKET2_AES_ON;
+}
+
+uint8_t Sx1231::addressBytes() const
+{
+	return (regs[REG_PACKETCONFIG1] & 0x06) ? 1 : 0;
+}
+
+uint64_t Sx1231::modeStartNs(uint8_t from, uint8_t to) const
+{
+	uint64_t ns = from == MODE_SLEEP && to != MODE_SLEEP ? TS_OSC : 0;
+	if (to <= MODE_STANDBY)
+		return ns;
+	if (from <= MODE_STANDBY)
+		ns += TS_FS;
+	if (to == MODE_TX) // TS_TR: 5us + 1.25 PA ramp + 1 bit
+		ns += 5000 + paRampUs[regs[REG_PARAMP] & 0x0F] * 1250ull + byteNs() / 8;
+	return ns;
+}
+
+uint64_t Sx1231::rxReadyNs() const
+{
+	// TS_RE is about 15 / RxBw + 2 bits (1.7ms at 10kHz/4.8kb/s, 96us at 250kHz/100kb/s)
+	return 15000000000ull / rxBandwidth() + byteNs() / 4;
+}
+
+uint64_t Sx1231::restartDelayNs() const
+{
+	uint8_t n = regs[REG_PACKETCONFIG2] >> 4;
+	return n < 12 ? (byteNs() << n) / 8 : 0;
+}
+
+AirFramePtr Sx1231::makeFrame(uint64_t start, const uint8_t* packet, const uint8_t* aesKey) const
+{
+	AirFramePtr frame = std::make_shared<AirFrame>();
+	AirFrame& f = *frame;
+	f.id = 0;
+	f.source = nodeId;
+	f.frf = frf();
+	f.bitrate = bitrate();
+	f.powerDbm = txPowerDbm();
+	f.byteNs = byteNs();
+	f.syncLen = (regs[REG_SYNCCONFIG] & RF_SYNC_ON) ? ((regs[REG_SYNCCONFIG] >> 3) & 7) + 1 : 0;
+	memcpy(f.sync, &regs[REG_SYNCVALUE1], 8);
+	f.start = start;
+	f.syncEnd = start + preambleNs();
+	f.end = 0;
+	f.ended = false;
+	f.truncated = false;
+	if (!packet)
+		return frame;
+
+	uint8_t length = packet[0];
+	uint8_t head = 1 + addressBytes(); // length and address byte go out in the clear
+	f.data.assign(packet, packet + (aesKey ? (head < 1 + length ? head : 1 + length) : 1 + length));
+	if (aesKey)
+	{
+		for (unsigned i = head; i < 1u + length; i += 16)
+		{
+			uint8_t block[16] = { 0 }, cipher[16];
+			memcpy(block, packet + i, (1u + length - i) < 16 ? 1u + length - i : 16);
+			aesEncrypt(aesKey, block, cipher);
+			f.data.insert(f.data.end(), cipher, cipher + 16);
+		}
+	}
+	if (regs[REG_PACKETCONFIG1] & RF_PACKET1_CRC_ON)
+	{
+		uint16_t crc = crc16(&f.data[0], (unsigned) f.data.size());
+		f.data.push_back(crc >> 8);
+		f.data.push_back(crc & 0xFF);
+	}
+	return frame;
+}
+
+void Sx1231::airFrame(const AirFramePtr& frame)
+{
+	if (frame->source != nodeId || frame->source < 0)
+		if (frame->syncEnd >= now)
+			heard.push_back(frame);
+}
+
+// SPI: address byte (bit 7 = write) then data bytes, the address auto-increments except on the FIFO
+void Sx1231::spiSelect(bool select)
+{
+	selected = select;
+	spiFirst = true;
+}
+
+uint8_t Sx1231::spiTransfer(uint8_t mosi)
+{
+	if (!selected)
+		return 0xFF;
+	if (spiFirst)
+	{
+		spiFirst = false;
+		spiAddr = mosi & 0x7F;
+		spiWrite = mosi & 0x80;
+		return 0;
+	}
+	uint8_t miso = 0;
+	if (spiWrite)
+	{
+		stats.regWrites[spiAddr]++;
+		writeRegister(spiAddr, mosi);
+	}
+	else
+	{
+		stats.regReads[spiAddr]++;
+		miso = readRegister(spiAddr);
+	}
+	if (spiAddr != REG_FIFO)
+		spiAddr = (spiAddr + 1) & 0x7F;
+	return miso;
+}
+
+uint8_t Sx1231::readRegister(uint8_t addr)
+{
+	switch (addr)
+	{
+		case REG_FIFO:
+		{
+			uint8_t value = fifoPop();
+			if (!fifoCount)
+				rxFifoEmpty();
+			return value;
+		}
+		case REG_OPMODE:
+			return (regs[REG_OPMODE] & ~RF_OPMODE_LISTENABORT) | (listenOn ? RF_OPMODE_LISTEN_ON : 0);
+		case REG_OSC1:
+			return regs[REG_OSC1] | RF_OSC1_RCCAL_DONE;
+		case REG_RSSICONFIG:
+			return regs[REG_RSSICONFIG] | RF_RSSI_DONE;
+		case REG_RSSIVALUE:
+		{
+			double dbm = rxLevel;
+			if (receiving() && rxState != RX_DONE && now >= rxReadyAt && air)
+				dbm = air->rssi(this, now);
+			int value = (int) (-2 * dbm);
+			return value < 0 ? 0 : value > 255 ? 255 : (uint8_t) value;
+		}
+		case REG_IRQFLAGS1:
+		{
+			uint8_t flags = 0;
+			bool ready = now >= modeReadyAt;
+			if (ready)
+				flags |= RF_IRQFLAGS1_MODEREADY;
+			if (receiving() && now >= rxReadyAt)
+			{
+				flags |= RF_IRQFLAGS1_RXREADY;
+				if (air && air->rssi(this, now) >= rssiThreshold())
+					flags |= RF_IRQFLAGS1_RSSI;
+			}
+			if (ready && mode == MODE_TX)
+				flags |= RF_IRQFLAGS1_TXREADY;
+			if (ready && mode >= MODE_FS)
+				flags |= RF_IRQFLAGS1_PLLLOCK;
+			if (timeout)
+				flags |= RF_IRQFLAGS1_TIMEOUT;
+			if (syncMatch)
+				flags |= RF_IRQFLAGS1_SYNCADDRESSMATCH;
+			return flags;
+		}
+		case REG_IRQFLAGS2:
+		{
+			uint8_t flags = 0;
+			if (fifoCount == FIFO_SIZE)
+				flags |= RF_IRQFLAGS2_FIFOFULL;
+			if (fifoCount)
+				flags |= RF_IRQFLAGS2_FIFONOTEMPTY;
+			if (fifoCount > (regs[REG_FIFOTHRESH] & 0x7F))
+				flags |= RF_IRQFLAGS2_FIFOLEVEL;
+			if (fifoOverrun)
+				flags |= RF_IRQFLAGS2_FIFOOVERRUN;
+			if (packetSent)
+				flags |= RF_IRQFLAGS2_PACKETSENT;
+			if (payloadReady)
+				flags |= RF_IRQFLAGS2_PAYLOADREADY;
+			if (crcOk)
+				flags |= RF_IRQFLAGS2_CRCOK;
+			return flags;
+		}
+		case REG_TEMP1:
+			return (regs[REG_TEMP1] & 0x01) | (now < tempDoneAt ? RF_TEMP1_MEAS_RUNNING : 0);
+		case REG_TEMP2:
+			return 140; // ~25C with the driver's COURSE_TEMP_COEF
+		default:
+			return regs[addr];
+	}
+}
+
+void Sx1231::writeRegister(uint8_t addr, uint8_t value)
+{
+	switch (addr)
+	{
+		case REG_FIFO:
+			fifoPush(value);
+			return;
+		case REG_OPMODE:
+			writeOpMode(value);
+			return;
+		case REG_VERSION:
+		case REG_RSSIVALUE:
+		case REG_TEMP2:
+			return; // read only
+		case REG_IRQFLAGS1:
+			if (value & RF_IRQFLAGS1_TIMEOUT)
+				timeout = false;
+			return;
+		case REG_IRQFLAGS2:
+			if (value & RF_IRQFLAGS2_FIFOOVERRUN)
+			{
+				// clears the FIFO and its flags, the receiver starts over
+				fifoClear();
+				payloadReady = crcOk = syncMatch = false;
+				if (rxState == RX_DONE || rxState == RX_HOLD)
+					rxRestart(0);
+			}
+			return;
+		case REG_PACKETCONFIG2:
+			regs[addr] = value & ~RF_PACKET2_RXRESTART;
+			if ((value & RF_PACKET2_RXRESTART) && rxState != RX_OFF)
+				rxRestart(rxReadyNs());
+			return;
+		case REG_TEMP1:
+			regs[addr] = value & 0x01;
+			if (value & RF_TEMP1_MEAS_START)
+				tempDoneAt = now + TS_TEMP;
+			return;
+		case REG_OSC1:
+			regs[addr] = value & ~RF_OSC1_RCCAL_START;
+			return;
+		default:
+			regs[addr] = value;
+	}
+}
+
+// ListenOn can only be cleared together with ListenAbort, the mode bits are ignored while listening
+void Sx1231::writeOpMode(uint8_t value)
+{
+	uint8_t newMode = (value >> 2) & 7;
+	if (newMode > MODE_RX)
+		newMode = mode;
+	if (listenOn)
+	{
+		if (!(value & RF_OPMODE_LISTENABORT))
+		{
+			regs[REG_OPMODE] = value | RF_OPMODE_LISTEN_ON;
+			return;
+		}
+		listenExit();
+	}
+	regs[REG_OPMODE] = value & ~RF_OPMODE_LISTENABORT;
+	if (value & RF_OPMODE_LISTEN_ON && !(value & RF_OPMODE_LISTENABORT))
+	{
+		enterMode(MODE_STANDBY);
+		listenEnter();
+	}
+	else
+		enterMode(newMode);
+}
+
+void Sx1231::enterMode(uint8_t newMode)
+{
+	if (newMode == mode)
+		return;
+	uint8_t old = mode;
+	if (old == MODE_TX)
+	{
+		if (txState == TX_FRAME)
+			txEnd(true);
+		txState = TX_OFF;
+		packetSent = false;
+	}
+	if (old == MODE_RX)
+		rxStop();
+	mode = newMode;
+	modeReadyAt = now + modeStartNs(old, newMode);
+	// the datasheet is vague about when the FIFO is cleared: here on sleep, on entering RX, on FifoOverrun and at
+	// the start of every listen mode RX period, never when going to TX or standby (the driver loads it in standby)
+	if (newMode == MODE_SLEEP)
+		fifoClear();
+	else if (newMode == MODE_TX)
+		txState = TX_WAIT;
+	else if (newMode == MODE_RX)
+	{
+		fifoClear();
+		payloadReady = crcOk = false;
+		rxStart(modeReadyAt + rxReadyNs());
+	}
+}
+
+void Sx1231::fifoClear()
+{
+	fifoHead = fifoCount = 0;
+	fifoOverrun = false;
+}
+
+void Sx1231::fifoPush(uint8_t value)
+{
+	if (fifoCount == FIFO_SIZE)
+	{
+		fifoOverrun = true;
+		stats.fifoOverruns++;
+		return;
+	}
+	fifo[(fifoHead + fifoCount++) % FIFO_SIZE] = value;
+}
+
+uint8_t Sx1231::fifoPop()
+{
+	if (!fifoCount)
+		return 0;
+	uint8_t value = fifo[fifoHead];
+	fifoHead = (fifoHead + 1) % FIFO_SIZE;
+	fifoCount--;
+	return value;
+}
+
+// events: time moves in steps from one state change to the next
+uint64_t Sx1231::nextEventNs()
+{
+	uint64_t next = NEVER;
+#define SIM_AT(t) do { uint64_t at_ = (t); if (at_ < next) next = at_; } while (0)
+	if (txState == TX_WAIT && txCanStart())
+		SIM_AT(modeReadyAt > now ? modeReadyAt : now);
+	if (txState == TX_FRAME)
+		SIM_AT(txNextAt);
+	if (rxState == RX_PAYLOAD)
+		SIM_AT(rxFrame->byteEnd(rxWire.size()));
+	if (rxState == RX_RESTART)
+		SIM_AT(rxRestartAt);
+	for (size_t i = 0; i < heard.size(); i++)
+	{
+		SIM_AT(heard[i]->syncEnd);
+		if (heard[i]->start > now)
+			SIM_AT(heard[i]->start);
+	}
+	if (listenOn)
+	{
+		SIM_AT(listenPhaseEnd);
+		SIM_AT(listenCheckAt);
+		SIM_AT(timeoutAt);
+	}
+#undef SIM_AT
+	return next;
+}
+
+void Sx1231::update(uint64_t ns)
+{
+	for (;;)
+	{
+		uint64_t next = nextEventNs();
+		if (next > ns)
+			break;
+		if (next > now)
+			now = next;
+		step();
+	}
+	if (ns > now)
+		now = ns;
+}
+
+void Sx1231::step()
+{
+	if (txState == TX_WAIT && now >= modeReadyAt && txCanStart())
+		txBegin();
+	if (txState == TX_FRAME && txNextAt <= now)
+		txByte();
+	if (rxState == RX_PAYLOAD && rxFrame->byteEnd(rxWire.size()) <= now)
+		rxByte();
+	if (rxState == RX_RESTART && rxRestartAt <= now)
+	{
+		rxState = RX_SEARCH;
+		rxReadyAt = now;
+	}
+	for (size_t i = 0; i < heard.size();)
+	{
+		AirFramePtr frame = heard[i];
+		if (listenRx && !listenMet && frame->start > stepPrev && frame->start <= now && now >= rxReadyAt
+		 && air && air->level(this, *frame) >= rssiThreshold() && !(regs[REG_LISTEN1] & RF_LISTEN1_CRITERIA_RSSIANDSYNC))
+			listenTriggered();
+		if (frame->syncEnd <= now)
+		{
+			heard.erase(heard.begin() + i);
+			rxSync(frame);
+		}
+		else
+			i++;
+	}
+	if (listenOn)
+	{
+		if (listenCheckAt <= now)
+		{
+			listenCheckAt = NEVER;
+			if (!listenMet && !(regs[REG_LISTEN1] & RF_LISTEN1_CRITERIA_RSSIANDSYNC) && air && air->rssi(this, now) >= rssiThreshold())
+				listenTriggered();
+		}
+		if (timeoutAt <= now)
+		{
+			// RSSI but no PayloadReady in time: the end condition applies as if a frame had come in
+			timeoutAt = NEVER;
+			timeout = true;
+			listenPacket();
+		}
+		else if (listenPhaseEnd <= now)
+		{
+			if (!listenRx)
+			{
+				// RX period: the FIFO content of the last one is lost
+				stats.listenWindows++;
+				listenRx = true;
+				fifoClear();
+				payloadReady = crcOk = false;
+				rxStart(now + TS_OSC + TS_FS + rxReadyNs());
+				listenCheckAt = rxReadyAt;
+				listenPhaseEnd = now + (uint64_t) listenResolNs[(regs[REG_LISTEN1] >> 4) & 3] * regs[REG_LISTEN3];
+			}
+			else if (listenMet || rxState == RX_PAYLOAD)
+				listenPhaseEnd = NEVER; // stay on until PayloadReady or timeout
+			else
+				listenIdle();
+		}
+	}
+	stepPrev = now;
+}
+
+// transmitter: starts a frame when the FIFO satisfies TxStartCondition (all of it with AES), then sends
+// preamble, sync word, and the FIFO bytes as they are needed followed by the CRC
+bool Sx1231::txCanStart() const
+{
+	bool start = (regs[REG_FIFOTHRESH] & RF_FIFOTHRESH_TXSTART_FIFONOTEMPTY) ? fifoCount > 0
+	           : fifoCount > (regs[REG_FIFOTHRESH] & 0x7F);
+	if (start && aesOn())
+		start = fifoCount >= fifo[fifoHead] + 1;
+	return start;
+}
+
+void Sx1231::txBegin()
+{
+	if (aesOn())
+	{
+		uint8_t packet[FIFO_SIZE];
+		uint8_t size = fifo[fifoHead] + 1;
+		for (uint8_t i = 0; i < size; i++)
+			packet[i] = fifoPop();
+		txFrame = makeFrame(now, packet, &regs[REG_AESKEY1]);
+		txImage.swap(txFrame->data);
+		txWireLen = txImage.size();
+	}
+	else
+	{
+		txFrame = makeFrame(now, 0, 0);
+		txWireLen = 0;
+	}
+	txCrc = regs[REG_PACKETCONFIG1] & RF_PACKET1_CRC_ON;
+	txState = TX_FRAME;
+	txNextAt = txFrame->syncEnd;
+	stats.txFrames++;
+	stats.txDbmSum += txFrame->powerDbm;
+	if (air)
+		air->transmit(this, txFrame);
+}
+
+void Sx1231::txByte()
+{
+	AirFrame& f = *txFrame;
+	size_t i = f.data.size();
+	if (txWireLen && i == txWireLen)
+	{
+		txEnd(false);
+		return;
+	}
+	uint8_t value;
+	if (!txImage.empty())
+		value = txImage[i];
+	else
+	{
+		size_t body = txWireLen ? txWireLen - (txCrc ? 2 : 0) : 1;
+		if (i < body)
+		{
+			if (!fifoCount)
+			{
+				txEnd(true); // FIFO underrun: cut short here, PacketSent still comes so the driver doesn't hang
+				return;
+			}
+			value = fifoPop();
+			if (i == 0)
+				txWireLen = 1 + value + (txCrc ? 2 : 0);
+		}
+		else
+		{
+			uint16_t crc = crc16(&f.data[0], (unsigned) body);
+			value = i == body ? crc >> 8 : crc & 0xFF;
+		}
+	}
+	f.data.push_back(value);
+	txNextAt += f.byteNs;
+}
+
+void Sx1231::txEnd(bool truncated)
+{
+	txFrame->end = now;
+	txFrame->ended = true;
+	txFrame->truncated = truncated;
+	stats.txAirNs += now - txFrame->start;
+	AirFramePtr frame = txFrame;
+	txFrame.reset();
+	txImage.clear();
+	txWireLen = 0;
+	txNextAt = NEVER;
+	txState = TX_WAIT;
+	packetSent = true;
+	if (air)
+		air->transmitEnd(this, frame);
+}
+
+// receiver
+void Sx1231::rxStart(uint64_t readyAt)
+{
+	if (rxState == RX_OFF)
+		rxOnSince = now;
+	rxState = RX_SEARCH;
+	rxReadyAt = readyAt;
+	rxFrame.reset();
+	syncMatch = false;
+}
+
+void Sx1231::rxStop()
+{
+	if (rxState != RX_OFF)
+		stats.rxOnNs += now - rxOnSince;
+	rxState = RX_OFF;
+	rxFrame.reset();
+	syncMatch = false;
+}
+
+void Sx1231::rxRestart(uint64_t delay)
+{
+	rxFrame.reset();
+	syncMatch = false;
+	rxState = RX_RESTART;
+	rxRestartAt = now + delay;
+}
+
+// the sync word of a frame has gone by: lock on to it if the receiver was up in time, and it is loud enough
+// and on our channel, bitrate and sync word
+void Sx1231::rxSync(const AirFramePtr& frame)
+{
+	const AirFrame& f = *frame;
+	if (rxState != RX_SEARCH || f.syncEnd < rxReadyAt + (f.syncLen + 1ull) * f.byteNs)
+		return;
+	uint8_t syncLen = (regs[REG_SYNCCONFIG] & RF_SYNC_ON) ? ((regs[REG_SYNCCONFIG] >> 3) & 7) + 1 : 0;
+	if (!syncLen || f.syncLen != syncLen || memcmp(f.sync, &regs[REG_SYNCVALUE1], syncLen))
+		return;
+	uint32_t rate = bitrate();
+	if (f.bitrate > rate + rate / 50 || f.bitrate + rate / 50 < rate)
+		return;
+	uint64_t offsetHz = (uint64_t) (f.frf > frf() ? f.frf - frf() : frf() - f.frf) * FXOSC >> 19;
+	if (offsetHz > rxBandwidth() / 2)
+		return;
+	double level = air ? air->level(this, f) : -127;
+	if (level < rssiThreshold())
+		return;
+	rxFrame = frame;
+	rxWire.clear();
+	rxWireLen = 0;
+	rxLevel = level;
+	syncMatch = true;
+	rxState = RX_PAYLOAD;
+	if (listenOn && !listenMet)
+		listenTriggered();
+}
+
+void Sx1231::rxByte()
+{
+	const AirFrame& f = *rxFrame;
+	size_t i = rxWire.size();
+	if (i >= f.data.size() && !f.ended && air)
+		air->sync(this, now); // the transmitter is elsewhere and may be behind
+	if (i >= f.data.size())
+	{
+		rxRestart(0); // carrier gone mid frame
+		return;
+	}
+	uint8_t value = f.data[i];
+	rxWire.push_back(value);
+	uint8_t address = addressBytes();
+	size_t crcBytes = (regs[REG_PACKETCONFIG1] & RF_PACKET1_CRC_ON) ? 2 : 0;
+	if (i == 0)
+	{
+		rxLength = value;
+		if (value > regs[REG_PAYLOADLENGTH] || value < address)
+		{
+			stats.rxFiltered++;
+			rxRestart(0);
+			return;
+		}
+		rxWireLen = 1 + (aesOn() ? address + (value - address + 15) / 16 * 16 : value) + crcBytes;
+		fifoPush(value);
+	}
+	else if (i == 1 && address)
+	{
+		if (value != regs[REG_NODEADRS]
+		 && !((regs[REG_PACKETCONFIG1] & 0x06) == RF_PACKET1_ADRSFILTERING_NODEBROADCAST && value == regs[REG_BROADCASTADRS]))
+		{
+			stats.rxFiltered++;
+			fifoClear();
+			rxRestart(0);
+			return;
+		}
+		fifoPush(value);
+	}
+	else if (i < rxWireLen - crcBytes && !aesOn())
+		fifoPush(value);
+	if (rxWire.size() == rxWireLen)
+		rxFinish();
+}
+
+void Sx1231::rxFinish()
+{
+	bool crcOn = regs[REG_PACKETCONFIG1] & RF_PACKET1_CRC_ON;
+	size_t body = rxWireLen - (crcOn ? 2 : 0);
+	bool ok = !air || air->intact(this, *rxFrame);
+	if (crcOn)
+	{
+		uint16_t crc = crc16(&rxWire[0], (unsigned) body);
+		ok = ok && rxWire[body] == (crc >> 8) && rxWire[body + 1] == (crc & 0xFF);
+	}
+	if (aesOn())
+	{
+		size_t head = 1 + addressBytes();
+		size_t remaining = rxLength + 1 - head;
+		for (size_t i = head; i < body; i += 16, remaining -= remaining < 16 ? remaining : 16)
+		{
+			uint8_t plain[16];
+			aesDecrypt(&regs[REG_AESKEY1], &rxWire[i], plain);
+			for (size_t j = 0; j < 16 && j < remaining; j++)
+				fifoPush(plain[j]);
+		}
+	}
+	rxFrame.reset();
+	if (!ok)
+		stats.rxCrcErrors++;
+	if (!ok && crcOn && !(regs[REG_PACKETCONFIG1] & RF_PACKET1_CRCAUTOCLEAR_OFF))
+	{
+		stats.rxFiltered++;
+		fifoClear();
+		rxRestart(0);
+		return;
+	}
+	stats.rxFrames++;
+	payloadReady = true;
+	crcOk = ok && crcOn;
+	rxState = RX_DONE;
+	if (listenOn)
+		listenPacket();
+}
+
+// PayloadReady and CrcOk go once the FIFO has been read out, AutoRxRestart then re-arms the receiver
+void Sx1231::rxFifoEmpty()
+{
+	if (!payloadReady)
+		return;
+	payloadReady = crcOk = syncMatch = false;
+	if (rxState == RX_DONE)
+	{
+		if (regs[REG_PACKETCONFIG2] & RF_PACKET2_AUTORXRESTART_ON)
+			rxRestart(restartDelayNs());
+		else
+			rxState = RX_HOLD; // until RestartRx
+	}
+}
+
+// listen mode: idle for coefIdle * resolIdle, receive for coefRx * resolRx, until the criteria are met
+void Sx1231::listenEnter()
+{
+	listenOn = true;
+	listenIdle();
+}
+
+void Sx1231::listenExit()
+{
+	listenOn = false;
+	listenRx = false;
+	listenMet = false;
+	rxStop();
+	listenPhaseEnd = listenCheckAt = timeoutAt = NEVER;
+}
+
+void Sx1231::listenIdle()
+{
+	rxStop(); // a received frame stays in the FIFO until the next RX period
+	listenRx = false;
+	listenMet = false;
+	listenCheckAt = timeoutAt = NEVER;
+	listenPhaseEnd = now + (uint64_t) listenResolNs[regs[REG_LISTEN1] >> 6] * regs[REG_LISTEN2];
+	if (listenPhaseEnd == now)
+		listenPhaseEnd++;
+}
+
+void Sx1231::listenTriggered()
+{
+	listenMet = true;
+	if (regs[REG_RXTIMEOUT2])
+		timeoutAt = now + regs[REG_RXTIMEOUT2] * 16ull * byteNs() / 8;
+}
+
+// PayloadReady (or Timeout) while listening: what happens next is ListenEnd
+void Sx1231::listenPacket()
+{
+	timeoutAt = NEVER;
+	switch (regs[REG_LISTEN1] & 0x06)
+	{
+		case RF_LISTEN1_END_10: // back to idle, listen mode goes on
+			listenIdle();
+			break;
+		case RF_LISTEN1_END_01: // to the mode in OpMode, listen mode stops
+			listenExit(); // the frame stays in the FIFO
+			enterMode((regs[REG_OPMODE] >> 2) & 7);
+			break;
+		default: // RF_LISTEN1_END_00: stays in RX, listen mode stops
+			listenOn = false;
+			listenRx = false;
+			listenPhaseEnd = listenCheckAt = NEVER;
+			mode = MODE_RX;
+			break;
+	}
+}
+
+bool Sx1231::dio0()
+{
+	uint8_t map = regs[REG_DIOMAPPING1] >> 6;
+	if (mode == MODE_RX || listenOn || receiving())
+	{
+		switch (map)
+		{
+			case 0: return crcOk;
+			case 1: return payloadReady;
+			case 2: return syncMatch;
+			default: return receiving() && now >= rxReadyAt && air && air->rssi(this, now) >= rssiThreshold();
+		}
+	}
+	if (mode == MODE_TX)
+	{
+		switch (map)
+		{
+			case 0: return packetSent;
+			case 1: return now >= modeReadyAt; // TxReady
+			default: return map == 3 && now >= modeReadyAt;
+		}
+	}
+	return map == 3 && now >= modeReadyAt; // ModeReady
+}
+
+} // namespace sim
@@ -0,0 +1,149 @@
+// host simulator: SX1231(H) / RFM69 behind the SPI bus. register file with burst access, operating modes with
+// their start-up times (ModeReady, RxReady, TxReady), the 66 byte FIFO, the packet engine in variable length mode
+// (sync word, address filtering, CRC, AES), AutoRxRestart, listen mode and DIO0.
+// what it leaves out: fixed length and unlimited packet formats, AFC/FEI, OOK, DIO1-5 and the automodes
+#ifndef SIM_SX1231_H
+#define SIM_SX1231_H
+
+#include "mcu.h"
+#include "air.h"
+
+namespace sim {
+
+class Sx1231 : public SpiDevice
+{
+public:
+	struct Stats
+	{
+		uint64_t txFrames;
+		uint64_t txAirNs; // preamble to last bit
+		double txDbmSum; // transmit power of every frame added up, divide by txFrames for the average
+		uint64_t rxFrames; // PayloadReady
+		uint64_t rxCrcErrors;
+		uint64_t rxFiltered; // dropped by the length/address filter or CrcAutoClear, DIO0 never rose
+		uint64_t fifoOverruns;
+		uint64_t listenWindows; // listen mode RX periods
+		uint64_t rxOnNs; // receiver on, RX mode and listen mode RX periods, up to the last time it went off
+		uint32_t regReads[0x80];
+		uint32_t regWrites[0x80];
+	};
+
+	explicit Sx1231(Air* air = 0, int id = 0);
+	void setAir(Air* medium) { air = medium; }
+	int id() const { return nodeId; }
+	uint64_t timeNs() const { return now; }
+	Stats stats;
+
+	// SpiDevice
+	void spiSelect(bool selected);
+	uint8_t spiTransfer(uint8_t mosi);
+	void update(uint64_t ns);
+	uint64_t nextEventNs();
+	bool dio0();
+
+	// what the air and the test harness look at
+	uint8_t reg(uint8_t addr) const { return regs[addr & 0x7F]; }
+	uint32_t frf() const;
+	uint32_t bitrate() const; // bits/s
+	uint32_t rxBandwidth() const; // Hz
+	uint64_t byteNs() const;
+	uint64_t preambleNs() const; // preamble and sync word of a frame sent with the current settings
+	double txPowerDbm() const;
+	double rssiThreshold() const; // dBm
+	bool receiving() const { return rxState != RX_OFF; } // RX mode or a listen mode RX period
+	uint64_t receiverOnNs() const { return stats.rxOnNs + (receiving() ? now - rxOnSince : 0); } // so far
+	bool listening() const { return listenOn; }
+	uint8_t chipMode() const { return mode; } // RF_OPMODE_* >> 2
+
+	// a frame went on air (or will, injected frames can start in the future). its data may still be coming
+	void airFrame(const AirFramePtr& frame);
+	// the frame this radio would send for a FIFO image (length byte first) with its current settings
+	AirFramePtr makeFrame(uint64_t start, const uint8_t* packet, const uint8_t* aesKey) const;
+
+private:
+	enum { MODE_SLEEP, MODE_STANDBY, MODE_FS, MODE_TX, MODE_RX };
+	enum RxState { RX_OFF, RX_SEARCH, RX_PAYLOAD, RX_DONE, RX_RESTART, RX_HOLD };
+	enum TxState { TX_OFF, TX_WAIT, TX_FRAME };
+	enum { FIFO_SIZE = 66 };
+
+	uint8_t readRegister(uint8_t addr);
+	void writeRegister(uint8_t addr, uint8_t value);
+	void writeOpMode(uint8_t value);
+	void enterMode(uint8_t newMode);
+	void step();
+
+	void fifoClear();
+	void fifoPush(uint8_t value);
+	uint8_t fifoPop();
+
+	bool txCanStart() const;
+	void txBegin();
+	void txByte();
+	void txEnd(bool truncated);
+
+	void rxStart(uint64_t readyAt);
+	void rxStop();
+	void rxRestart(uint64_t delay);
+	void rxSync(const AirFramePtr& frame);
+	void rxByte();
+	void rxFinish();
+	void rxFifoEmpty();
+
+	void listenEnter();
+	void listenExit();
+	void listenIdle();
+	void listenTriggered();
+	void listenPacket();
+
+	uint64_t modeStartNs(uint8_t from, uint8_t to) const; // ModeReady delay
+	uint64_t rxReadyNs() const; // TS_RE, PLL locked to RxReady
+	uint64_t restartDelayNs() const;
+	bool aesOn() const;
+	uint8_t addressBytes() const;
+
+	Air* air;
+	int nodeId;
+	uint64_t now;
+	uint8_t regs[0x80];
+
+	bool selected, spiFirst, spiWrite;
+	uint8_t spiAddr;
+
+	uint8_t fifo[FIFO_SIZE];
+	uint8_t fifoHead, fifoCount;
+	bool fifoOverrun, packetSent, payloadReady, crcOk, syncMatch, timeout;
+
+	uint8_t mode;
+	uint64_t modeReadyAt;
+	uint64_t tempDoneAt;
+
+	TxState txState;
+	AirFramePtr txFrame;
+	std::vector<uint8_t> txImage; // whole wire image when AES is on, the FIFO is encrypted in one go
+	size_t txWireLen; // 0 until the length byte went out
+	uint64_t txNextAt;
+	bool txCrc;
+
+	RxState rxState;
+	uint64_t rxReadyAt;
+	uint64_t rxRestartAt;
+	uint64_t rxOnSince;
+	std::vector<AirFramePtr> heard; // frames whose sync word hasn't gone by yet
+	AirFramePtr rxFrame;
+	std::vector<uint8_t> rxWire;
+	size_t rxWireLen;
+	uint8_t rxLength;
+	double rxLevel; // RssiValue is frozen at this once PayloadReady is set
+
+	bool listenOn;
+	bool listenRx; // in an RX period, idle otherwise
+	bool listenMet; // the criteria were met in this RX period, stay on until PayloadReady or timeout
+	uint64_t listenPhaseEnd;
+	uint64_t listenCheckAt;
+	uint64_t timeoutAt;
+	uint64_t stepPrev; // time of the previous step(), frames starting after it haven't been looked at yet
+};
+
+} // namespace sim
+
+#endif
@@ -0,0 +1,28 @@
+// telemetry samples for the compression benchmark rfm69zbench: a sensor record (six 16 bit
+// readings) as it changes from one report to the next, and text status lines
+#ifndef SIM_ZSAMPLES_H
+#define SIM_ZSAMPLES_H
+
+#define ZSAMPLE_RECORDS 8
+
+// temperature in 0.01C, humidity in 0.01%, pressure in 0.1hPa, battery mV, uptime in minutes, light in lux
+static const uint16_t zRecords[ZSAMPLE_RECORDS][6] = {
+	{ 2150, 4520, 10132, 3010, 100, 870 },
+	{ 2153, 4518, 10132, 3010, 101, 874 },
+	{ 2157, 4511, 10133, 3009, 102, 881 },
+	{ 2162, 4507, 10133, 3009, 103, 890 },
+	{ 2160, 4509, 10132, 3009, 104, 902 },
+	{ 2158, 4515, 10131, 3008, 105, 917 },
+	{ 2155, 4522, 10131, 3008, 106, 935 },
+	{ 2151, 4530, 10130, 3008, 107, 954 },
+};
+
+static const char* const zTexts[] = {
+	"t=21.50 h=45.20 p=1013.2 v=3.01",
+	"node=12 t=21.5 t=21.6 t=21.6 t=21.7 t=21.7 t=21.8",
+	"{\"t\":21.5,\"h\":45.2,\"p\":1013.2,\"v\":3.01,\"up\":6000}",
+	"ERR sensor timeout, sensor timeout, sensor timeout",
+};
+#define ZSAMPLE_TEXTS (sizeof(zTexts) / sizeof(zTexts[0]))
+
+#endif
@@ -21,7 +21,11 @@ void millis_init()
 	sei();
 	
     // Enable the compare match interrupt
+#ifdef TIMSK1
+    TIMSK1 |= (1 << OCIE1A); // atmega328p and friends
+#else
     TIMSK |= (1 << OCIE1A);
+#endif
 }
 
 unsigned long millis()
@@ -27,11 +27,18 @@
 */
 
 #define SPI_DDR DDRB
-//define pin number. In this case atmega64
+//define pin number. atmega64 unless the part has its SPI pins elsewhere
+#if defined(__AVR_ATmega328P__) || defined(__AVR_ATmega328__) || defined(__AVR_ATmega168__) || defined(__AVR_ATmega88__)
+#define MISO 4
+#define MOSI 3
+#define SCK 5
+#define SS 2
+#else
 #define MISO 3
 #define MOSI 2
 #define SCK 1
 #define SS 0
+#endif
 
 void spi_init()
 // Initialize pins for spi communication